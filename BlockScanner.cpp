@@ -0,0 +1,214 @@
+#include "BlockScanner.h"
+
+#include <nlohmann/json.hpp>
+#include <stdexcept>
+#include <cstdint>
+
+class BlockScanner::Handler
+{
+public:
+	typedef nlohmann::json::number_integer_t number_integer_t;
+	typedef nlohmann::json::number_unsigned_t number_unsigned_t;
+	typedef nlohmann::json::number_float_t number_float_t;
+	typedef nlohmann::json::string_t string_t;
+
+	Handler(const std::string& contract, const std::string& sig, std::vector<Block>& blocks)
+	: contract_(contract)
+	, sig_(sig)
+	, blocks_(blocks)
+	{
+	}
+
+	bool null()
+	{
+		if (top() == Response && key_ == "result")
+			response_.error_ = "no such block";
+		return true;
+	}
+
+	bool boolean(bool) { return true; }
+	bool number_float(number_float_t, const string_t&) { return true; }
+
+	bool number_integer(number_integer_t val)
+	{
+		if (top() == Response && key_ == "id")
+			id_ = val;
+		return true;
+	}
+
+	bool number_unsigned(number_unsigned_t val)
+	{
+		if (top() == Response && key_ == "id")
+			id_ = (int64_t)val;
+		return true;
+	}
+
+	bool string(string_t& val)
+	{
+		switch (top()) {
+		case Result:
+			if (key_ == "timestamp")
+				response_.timestamp_ = std::move(val);
+			break;
+		case Tx:
+			if (key_ == "to")
+				to_ = std::move(val);
+			else if (key_ == "input")
+				input_.assign(val, 0, 10);
+			else if (key_ == "hash")
+				tx_.hash_ = std::move(val);
+			else if (key_ == "from")
+				tx_.from_ = std::move(val);
+			else if (key_ == "gas")
+				tx_.gas_ = std::move(val);
+			else if (key_ == "gasPrice")
+				tx_.gas_price_ = std::move(val);
+			break;
+		case Error:
+			if (key_ == "message")
+				response_.error_ = std::move(val);
+			break;
+		default:
+			break;
+		}
+		return true;
+	}
+
+	template <typename Binary>
+	bool binary(Binary&) { return true; }
+
+	bool key(string_t& val)
+	{
+		key_ = std::move(val);
+		return true;
+	}
+
+	bool start_object(std::size_t)
+	{
+		Context context = Skip;
+		switch (top()) {
+		case None:
+		case Batch:
+			context = Response;
+			response_ = Block();
+			id_ = -1;
+			break;
+		case Response:
+			if (key_ == "result") {
+				context = Result;
+				response_.found_ = true;
+			}
+			else if (key_ == "error") {
+				context = Error;
+				response_.error_ = "error";
+			}
+			break;
+		case Transactions:
+			context = Tx;
+			tx_ = BlockScanner::Tx();
+			to_.clear();
+			input_.clear();
+			break;
+		default:
+			break;
+		}
+		stack_.push_back(context);
+		return true;
+	}
+
+	bool end_object()
+	{
+		Context context = top();
+		stack_.pop_back();
+		if (context == Tx) {
+			if ((contract_.empty() || to_ == contract_) && input_ == sig_) {
+				tx_.to_ = std::move(to_);
+				response_.transactions_.push_back(std::move(tx_));
+			}
+		}
+		else if (context == Response) {
+			if (id_ >= 0 && (std::size_t)id_ < blocks_.size())
+				blocks_[id_] = std::move(response_);
+			else if (top() == None && !response_.found_)
+				whole_batch_error_ = response_.error_;
+		}
+		return true;
+	}
+
+	bool start_array(std::size_t)
+	{
+		Context context = Skip;
+		if (top() == None)
+			context = Batch;
+		else if (top() == Result && key_ == "transactions")
+			context = Transactions;
+		stack_.push_back(context);
+		return true;
+	}
+
+	bool end_array()
+	{
+		stack_.pop_back();
+		return true;
+	}
+
+	template <typename Exception>
+	bool parse_error(std::size_t, const std::string&, const Exception& e)
+	{
+		throw std::logic_error(std::string("Parse error: ") + e.what());
+	}
+
+	const std::string& whole_batch_error() const { return whole_batch_error_; }
+
+private:
+	enum Context {
+		None,
+		Batch,  // top level array
+		Response,  // {"jsonrpc", "id", "result"|"error"}
+		Result,  // the block
+		Transactions,
+		Tx,
+		Error,
+		Skip,  // anything else, including everything below it
+	};
+
+	Context top() const { return stack_.empty() ? None : stack_.back(); }
+
+	const std::string& contract_;
+	const std::string& sig_;
+	std::vector<Block>& blocks_;
+
+	std::vector<Context> stack_;
+	std::string key_;
+
+	Block response_;
+	int64_t id_ {-1};
+	BlockScanner::Tx tx_;
+	std::string to_;
+	std::string input_;
+
+	std::string whole_batch_error_;
+};
+
+BlockScanner::BlockScanner(const std::string& contract, const std::string& sig)
+: contract_(contract)
+, sig_(sig)
+{
+}
+
+std::vector<BlockScanner::Block> BlockScanner::scan(const std::string& response, std::size_t count) const
+{
+	std::vector<Block> blocks(count);
+	Handler handler(contract_, sig_, blocks);
+	nlohmann::json::sax_parse(response, &handler);
+
+	for (auto& block : blocks) {
+		if (block.found_ || !block.error_.empty())
+			continue;
+		if (!handler.whole_batch_error().empty())
+			block.error_ = handler.whole_batch_error();
+		else
+			block.error_ = "no response in batch";
+	}
+	return blocks;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Streaming filter over eth_getBlockByNumber(n, true) responses, single or batched.
+// The response is walked with the nlohmann SAX interface and only the transactions
+// sent to the given contract with the given method signature are materialized;
+// the rest of a multi-MB block never becomes a DOM.
+class BlockScanner
+{
+public:
+	struct Tx {
+		std::string hash_;
+		std::string from_;
+		std::string to_;
+		std::string gas_;
+		std::string gas_price_;
+	};
+
+	struct Block {
+		bool found_ {false};  // "result" was a block object
+		std::string timestamp_;
+		std::vector<Tx> transactions_;  // matching ones only
+		std::string error_;  // when !found_
+	};
+
+	// contract is "0x..." as the node reports "to", empty for any contract;
+	// sig is "0x" + 8 hex digits
+	BlockScanner(const std::string& contract, const std::string& sig);
+
+	// blocks are indexed by JSON-RPC id, as in Bot::make_json_rpc_batch;
+	// throws std::logic_error if the response is not valid JSON
+	std::vector<Block> scan(const std::string& response, std::size_t count) const;
+
+private:
+	class Handler;
+
+	const std::string contract_;
+	const std::string sig_;
+};
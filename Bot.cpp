@@ -1,7 +1,22 @@
 #include "Bot.h"
 #include "Transaction.h"
 #include "DB.h"
-#include "binacpp/binacpp.h"
+#include "Broadcaster.h"
+#include "PreciseTimer.h"
+#include "ClockSync.h"
+#include "DeltaTuner.h"
+#include "CompetitorStats.h"
+#include "BlockScanner.h"
+#include "ChainCache.h"
+#include "SignPool.h"
+#include "WsClient.h"
+#include "MempoolWatcher.h"
+#include "TxLadder.h"
+#include "NonceManager.h"
+#include "HexCodec.h"
+#include "FastLog.h"
+#include "binacpp/AsioCURL.h"
+#include "binacpp/AsyncURL.h"
 
 #include <HexCoding.h>
 #include <PrivateKey.h>
@@ -25,27 +40,104 @@ const std::vector<std::string> Bot::headers_ {
 	"Content-Type: application/json"
 };
 
-Bot::Bot(nlohmann::json& config, boost::asio::io_service& io, DB* db)
+struct Bot::ExtraWallet
+{
+	ExtraWallet(boost::asio::io_service::strand& strand)
+	: timer_(strand)
+	{
+	}
+
+	~ExtraWallet()
+	{
+		delete broadcaster_;
+		delete private_key_;
+	}
+
+	std::string wallet_hex_;
+	std::string sender_;  // as the node reports "from"
+	TW::PrivateKey* private_key_ {nullptr};  // null with signer_, which keeps the only copy
+	NonceManager* nonces_ {nullptr};  // of sender_, shared with whoever else signs for it
+	std::size_t nonce_holder_ {0};
+	Broadcaster* broadcaster_ {nullptr};
+	PreciseTimer timer_;
+	std::chrono::milliseconds offset_ {0};
+	std::vector<std::string> raws_;  // by rung of ladder_
+	TW::uint256_t raws_nonce_;  // of raws_ and the requests prepared on broadcaster_
+	std::size_t sign_key_ {0};  // private_key_ in signer_
+	unsigned prepare_seq_ {0};
+	unsigned signed_seq_ {0};  // the latest prepare_extra answered by sign_ladder
+	TW::uint256_t fired_nonce_;
+	std::size_t fired_rung_ {0};
+	bool armed_ {false};  // timer_ waits for extra_timer_cb
+};
+
+Bot::Bot(nlohmann::json& config, boost::asio::io_service& io, DB* db, AsioCURL* http, AsyncURL* async, LatencyStats* stats, ChainCache* cache,
+	SignPool* signer, NonceManagers* nonces)
 : config_(config)
-, rest_(nullptr)
+, io_(io)
+, strand_(io)
+, http_(http)
+, async_(async)
+, broadcaster_(nullptr)
+, clock_sync_(nullptr)
+, delta_tuner_(nullptr)
+, competitors_(nullptr)
+, mempool_(nullptr)
+, ladder_(nullptr)
+, nonce_managers_(nonces)
+, nonces_(nullptr)
+, nonce_holder_(0)
 , db_(db)
-, nonce_(0)
+, stats_(stats)
+, cache_(cache)
+, signer_(signer)
+, sign_key_(0)
+, prepare_seq_(0)
+, signed_seq_(0)
+, ladder_signed_(false)
 , gas_price_(0)
 , gas_limit_(0)
 , nearest_compounding_time_(0)
+, shot_counter_(10)
+, pending_delta_msec_(0)
+, pending_block_(0)
+, cooling_down_(false)
+, shot_armed_(false)
+, mempool_outbid_(false)
+, outbid_price_(0)
+, replacement_rung_(0)
 , private_key_(nullptr)
-, main_timer_(io)
+, main_timer_(strand_)
 , gather_tx_timer_(io)
+, warm_up_timer_(io)
+, clock_sync_timer_(io)
+, mempool_timer_(io)
 , delta_msec_(0)
+, fire_delta_msec_(0)
+, warm_up_sec_(5)
+, clock_sync_msec_(0)
+, mempool_poll_msec_(0)
+, mempool_fire_early_msec_(0)
+, nonce_stuck_sec_(60)
 , approve_func_(nullptr)
 , compound_func_(nullptr)
 , nearestCompoundingTime_func_(nullptr)
+, prepared_func_(nullptr)
 {
 }
 
 Bot::~Bot()
 {
-	delete rest_;
+	if (ws_)
+		ws_->stop();
+	delete mempool_;
+	for (auto w : extra_wallets_)
+		delete w;
+	delete ladder_;
+	delete delta_tuner_;
+	delete competitors_;
+	delete clock_sync_;
+	delete broadcaster_;
 	delete private_key_;
 	delete approve_func_;
 	delete compound_func_;
@@ -98,26 +190,185 @@ void Bot::init()
 	check_config("start_time", start_time);
 	check_config("delta_msec", delta);
 
-	delta_msec_ = boost::posix_time::milliseconds(delta);
+	delta_msec_ = std::chrono::milliseconds(delta);
+
+	// start() runs from a response handler, where nothing may throw
+	if (mode_ != MODE_approve10x1min && mode_ != MODE_compound10x1min && mode_ != MODE_compound)
+		throw std::invalid_argument("Unknown mode: " + mode_);
+	if (mode_ != MODE_compound && std::chrono::system_clock::from_time_t(start_time) + delta_msec_ < std::chrono::system_clock::now())
+		throw std::invalid_argument("start_time in the past");
+
+	int warm_up_sec = warm_up_sec_.count();
+	if (config_["warm_up_sec"].is_number())
+		check_config("warm_up_sec", warm_up_sec);
+	warm_up_sec_ = std::chrono::seconds(warm_up_sec);
+
+	std::vector<TW::uint256_t> gas_prices;
+	if (config_["gas_ladder"].is_array()) {
+		for (auto& price : config_["gas_ladder"])
+			gas_prices.push_back((uint64_t)price);
+	}
+	else {
+		gas_prices.push_back(gas_price_);
+	}
+	ladder_ = new TxLadder(gas_prices);
+
+	if (config_["extra_wallets"].is_array() && !config_["extra_wallets"].empty()) {
+		if (mode_ != MODE_compound)
+			throw std::invalid_argument("extra_wallets: only in " + std::string(MODE_compound) + " mode");
+		for (auto& wc : config_["extra_wallets"]) {
+			if (!wc["secret"].is_string() || !wc["wallet"].is_string())
+				throw std::invalid_argument("extra_wallets: keystore or secret and wallet expected");
+			auto w = new ExtraWallet(strand_);
+			extra_wallets_.push_back(w);
+			w->wallet_hex_ = wc["wallet"];
+			w->sender_ = "0x" + w->wallet_hex_;
+			std::transform(w->sender_.begin(), w->sender_.end(), w->sender_.begin(), ::tolower);
+			w->private_key_ = new TW::PrivateKey(TW::parse_hex(wc["secret"]));
+			if (signer_) {
+				w->sign_key_ = signer_->add_key(w->private_key_->bytes);
+				delete w->private_key_;  // wiped by ~PrivateKey
+				w->private_key_ = nullptr;
+			}
+			w->offset_ = std::chrono::milliseconds(wc.value("offset_msec", 0));
+		}
+	}
+
+	if (stats_)
+		stats_->register_bot(id);
+	if (config_["latency_file"].is_string())
+		latency_file_ = config_["latency_file"];
+
+	// bots and extra wallets of one address must not sign the same nonce
+	nonces_ = nonce_manager(sender());
+	nonce_holder_ = nonces_->add_holder([this] {
+		strand_.post([this] {
+			if (prepared_func_)
+				prepare_transaction(prepared_func_);  // our nonce was taken or has moved
+		});
+	});
+	for (auto w : extra_wallets_) {
+		w->nonces_ = nonce_manager(w->sender_);
+		w->nonce_holder_ = w->nonces_->add_holder([this, w] {
+			strand_.post([this, w] {
+				if (w->broadcaster_)
+					prepare_extra(*w);
+			});
+		});
+	}
+	int nonce_stuck_sec = nonce_stuck_sec_.count();
+	if (config_["nonce_stuck_sec"].is_number())
+		check_config("nonce_stuck_sec", nonce_stuck_sec);
+	nonce_stuck_sec_ = std::chrono::seconds(nonce_stuck_sec);
+
+	clock_sync_ = new ClockSync();
+	if (config_["auto_delta"].is_boolean() && config_["auto_delta"]) {
+		int step = 10, min_delta = -1000, max_delta = 1000;
+		if (config_["auto_delta_step_msec"].is_number())
+			check_config("auto_delta_step_msec", step);
+		if (config_["auto_delta_min_msec"].is_number())
+			check_config("auto_delta_min_msec", min_delta);
+		if (config_["auto_delta_max_msec"].is_number())
+			check_config("auto_delta_max_msec", max_delta);
+		delta_tuner_ = new DeltaTuner(delta, step, min_delta, max_delta);
+		clock_sync_msec_ = std::chrono::milliseconds(1000);
+	}
+	if (config_["competitor_stats"].is_boolean() && config_["competitor_stats"]) {
+		int window = 50;
+		if (config_["competitor_window"].is_number())
+			check_config("competitor_window", window);
+		competitors_ = new CompetitorStats(window);
+	}
+	if (db_ && (delta_tuner_ || competitors_ || ladder_->size() > 1)) {
+		auto history = db_->load_history(id, 5000);
+		if (!extra_wallets_.empty())
+			history = as_ours(history);
+		if (delta_tuner_)
+			delta_tuner_->load_history(history, sender());
+		if (competitors_) {
+			competitors_->load_history(history, sender());
+			ladder_->set_floor(competitors_->winning_gas_price());
+		}
+		ladder_->load_history(history, sender());
+	}
+	if (config_["clock_sync_msec"].is_number()) {
+		int clock_sync_msec;
+		check_config("clock_sync_msec", clock_sync_msec);
+		clock_sync_msec_ = std::chrono::milliseconds(clock_sync_msec);
+	}
+
+	int spin_usec = 300;
+	if (config_["spin_usec"].is_number())
+		check_config("spin_usec", spin_usec);
+	main_timer_.set_spin(std::chrono::microseconds(spin_usec));
+	for (auto w : extra_wallets_)
+		w->timer_.set_spin(std::chrono::microseconds(spin_usec));
 
 	LOG(DEBUG) << "Init Bot #" << id << ": " << name;
 
 	contract_ = TW::parse_hex(contract_hex_);
 	private_key_ = new TW::PrivateKey(TW::parse_hex(secret));
+	if (signer_) {
+		sign_key_ = signer_->add_key(private_key_->bytes);
+		delete private_key_;  // wiped by ~PrivateKey
+		private_key_ = nullptr;
+	}
 	wallet_ = TW::parse_hex(wallet_hex_);
-	rest_ = new BinaCPP(url_);
-	rest_->init("", "");
+
+	broadcaster_ = make_broadcaster();
 
 	approve_func_ = new TW::Ethereum::ABI::Function("approve", std::vector<std::shared_ptr<TW::Ethereum::ABI::ParamBase>>{
 		std::make_shared<TW::Ethereum::ABI::ParamAddress>(wallet_),
 		std::make_shared<TW::Ethereum::ABI::ParamUInt256>(0)
 	});
 
+	if (mode_ == MODE_compound && config_["ws_url"].is_string() && !config_["ws_url"].empty()) {
+		ws_ = std::make_shared<WsClient>(strand_, config_["ws_url"]);
+		ws_->subscribe(nlohmann::json::array({"newHeads"}), std::bind(&Bot::new_head_cb, this, std::placeholders::_1));
+		nlohmann::json filter;
+		filter["address"] = "0x" + contract_hex_;
+		ws_->subscribe(nlohmann::json::array({"logs", filter}), std::bind(&Bot::vault_log_cb, this, std::placeholders::_1));
+	}
+
 	compound_func_ = new TW::Ethereum::ABI::Function("compound");
 	nearestCompoundingTime_func_ = new TW::Ethereum::ABI::Function("nearestCompoundingTime");
 
-	auto response = eth_getTransactionCount(wallet_hex_);
-	nonce_ = hexToUInt256(response["result"]);
+	bool mempool_ws = config_["mempool_ws"].is_boolean() && config_["mempool_ws"];
+	if (mode_ == MODE_compound && (mempool_ws || config_["mempool_poll_msec"].is_number())) {
+		std::vector<std::string> ours {sender()};
+		for (auto w : extra_wallets_)
+			ours.push_back(w->sender_);
+		mempool_ = new MempoolWatcher("0x" + contract_hex_, "0x" + TW::hex(compound_func_->getSignature()), ours,
+			std::bind(&Bot::on_competitor_seen, this, std::placeholders::_1));
+
+		if (mempool_ws) {
+			if (!ws_)
+				throw std::invalid_argument("mempool_ws: ws_url expected");
+			// full transactions where the node supports it, hashes otherwise
+			ws_->subscribe(nlohmann::json::array({"newPendingTransactions", true}), std::bind(&Bot::pending_tx_cb, this, std::placeholders::_1));
+		}
+		int poll_msec = 0, fire_early_msec = 0;
+		if (config_["mempool_poll_msec"].is_number())
+			check_config("mempool_poll_msec", poll_msec);
+		if (config_["mempool_fire_early_msec"].is_number())
+			check_config("mempool_fire_early_msec", fire_early_msec);
+		mempool_poll_msec_ = std::chrono::milliseconds(poll_msec);
+		mempool_fire_early_msec_ = std::chrono::milliseconds(fire_early_msec);
+		mempool_outbid_ = config_["mempool_outbid"].is_boolean() && config_["mempool_outbid"];
+	}
+
+	for (auto w : extra_wallets_)
+		start_extra_wallet(*w);
+
+	// "pending" skips transactions of a previous run still waiting in the mempool
+	eth_getTransactionCount(wallet_hex_, "pending", [this](nlohmann::json& response) {
+		if (!response["result"].is_string()) {
+			LOG(ERROR) << "Bot #" << config_["id"] << " not started, cannot get nonce: " << pretty_print(response);
+			return;
+		}
+		nonces_->init(hexToUInt256(response["result"]));
+		start();
+	});
 }
 
 std::string Bot::pretty_print(const nlohmann::json& val, bool indent)
@@ -136,69 +387,168 @@ nlohmann::json Bot::parse_json(const std::string& str_result)
 	return json_result;
 }
 
-nlohmann::json Bot::make_json_rpc(const std::string& method)
+nlohmann::json Bot::make_json_rpc(const std::string& method, int id)
 {
 	nlohmann::json doc;
 	doc["method"] = method;
-	doc["id"] = 1;
+	doc["id"] = id;
+	doc["jsonrpc"] = "2.0";
+	return doc;
+}
+
+nlohmann::json Bot::make_json_rpc_error(const std::string& message, int id)
+{
+	nlohmann::json doc;
+	doc["id"] = id;
 	doc["jsonrpc"] = "2.0";
+	doc["error"]["code"] = -32000;
+	doc["error"]["message"] = message;
 	return doc;
 }
 
-TW::uint256_t Bot::hexToUInt256(std::string s)
+nlohmann::json Bot::make_json_rpc_batch(std::vector<nlohmann::json>& docs)
+{
+	// ids are renumbered to the position in the batch
+	auto batch = nlohmann::json::array();
+	for (std::size_t i = 0; i < docs.size(); ++i) {
+		docs[i]["id"] = i;
+		batch.push_back(std::move(docs[i]));
+	}
+	return batch;
+}
+
+std::vector<nlohmann::json> Bot::split_json_rpc_batch(nlohmann::json& response, std::size_t count)
 {
-	if (s.length() % 2)
-		s.insert(s.begin() + 2, '0');
-	TW::Ethereum::ABI::ParamUInt256 result;
-	result.setValueJson(s);
-	return result.getVal();
+	// the node may answer in any order, elements are correlated by id
+	std::vector<nlohmann::json> result(count);
+	if (response.is_array()) {
+		for (auto& element : response) {
+			if (!element.is_object() || !element["id"].is_number_unsigned())
+				continue;
+			std::size_t id = element["id"];
+			if (id < count)
+				result[id] = std::move(element);
+		}
+	}
+	for (std::size_t i = 0; i < count; ++i) {
+		if (!result[i].is_null())
+			continue;
+		if (response.is_object() && response["error"].is_object()) {
+			// whole batch rejected
+			result[i] = response;
+			result[i]["id"] = i;
+		}
+		else {
+			result[i] = make_json_rpc_error("no response in batch", i);
+		}
+	}
+	return result;
+}
+
+TW::uint256_t Bot::hexToUInt256(std::string_view s)
+{
+	TW::uint256_t result;
+	if (!HexCodec::parse(s, result))
+		return 0;
+	return result;
+}
+
+TW::uint256_t Bot::hexToUInt256(const nlohmann::json& val)
+{
+	return hexToUInt256(std::string_view(val.get_ref<const nlohmann::json::string_t&>()));
 }
 
 std::string Bot::UInt256ToHex(const TW::uint256_t& val)
 {
-	auto data = TW::store(val);
-	return TW::hexEncoded(data);
+	return HexCodec::to_hex(val);
+}
+
+void Bot::handle_response(HttpResponse& response, ResponseHandler& handler, bool logged)
+{
+	if (logged)
+		FAST_LOG(Debug, "Response: {}", response.data);
+
+	nlohmann::json result;
+	if (!response.error.empty()) {
+		LOG(ERROR) << "rest_request: " << response.error;
+		result = make_json_rpc_error(response.error);
+	}
+	else {
+		try {
+			result = parse_json(response.data);
+		}
+		catch (std::exception& e) {
+			LOG(ERROR) << "rest_request: " << e.what();
+			result = make_json_rpc_error(e.what());
+		}
+	}
+	handler(result);
 }
 
-nlohmann::json Bot::rest_request(nlohmann::json doc, bool logged)
+void Bot::rest_request(const nlohmann::json& doc, ResponseHandler handler, bool logged)
 {
 	std::string request = pretty_print(doc);
 
 	if (logged)
-		LOG(DEBUG) << "Request: " << request;
+		FAST_LOG(Debug, "Request: {}", request);
 
-	std::string str_result;
-	rest_->curl_api_with_header(url_, str_result, headers_, request, "POST");
+	async_->request(url_, headers_, request, "POST", on_strand(strand_, [handler, logged](HttpResponse& response) mutable {
+		handle_response(response, handler, logged);
+	}));
+}
 
-	if (logged)
-		LOG(DEBUG) << "Response: " << str_result;
+void Bot::fire_request(const nlohmann::json& doc, ResponseHandler handler)
+{
+	std::string request = pretty_print(doc);
+	FAST_LOG(Debug, "Request: {}", request);
 
-	return parse_json(str_result);
+	broadcaster_->broadcast(request, handler);
 }
 
-nlohmann::json Bot::eth_getTransactionCount(const std::string& address)
+void Bot::rest_batch_request(std::vector<nlohmann::json> docs, BatchHandler handler, bool logged)
+{
+	const auto count = docs.size();
+	if (count == 0) {
+		std::vector<nlohmann::json> empty;
+		handler(empty);
+		return;
+	}
+
+	auto batch = make_json_rpc_batch(docs);
+	rest_request(batch, [handler, count](nlohmann::json& response) {
+		auto responses = split_json_rpc_batch(response, count);
+		handler(responses);
+	}, logged);
+}
+
+nlohmann::json Bot::getTransactionCount_doc(const std::string& address, const std::string& block)
 {
 	auto doc = make_json_rpc("eth_getTransactionCount");
 
 	auto arr = nlohmann::json::array();
 	arr.push_back("0x" + address);
-	arr.push_back(nlohmann::json("latest"));
+	arr.push_back(nlohmann::json(block));
 	doc["params"] = arr;
 
-	return rest_request(doc);
+	return doc;
+}
+
+void Bot::eth_getTransactionCount(const std::string& address, const std::string& block, ResponseHandler handler)
+{
+	rest_request(getTransactionCount_doc(address, block), handler);
 }
 
-nlohmann::json Bot::eth_gasPrice()
+void Bot::eth_gasPrice(ResponseHandler handler)
 {
 	auto doc = make_json_rpc("eth_gasPrice");
 
 	auto arr = nlohmann::json::array();
 	doc["params"] = arr;
 
-	return rest_request(doc);
+	rest_request(doc, handler);
 }
 
-nlohmann::json Bot::eth_estimateGas()
+void Bot::eth_estimateGas(ResponseHandler handler)
 {
 	auto doc = make_json_rpc("eth_estimateGas");
 
@@ -207,10 +557,10 @@ nlohmann::json Bot::eth_estimateGas()
 	arr.push_back(params);
 	doc["params"] = arr;
 
-	return rest_request(doc);
+	rest_request(doc, handler);
 }
 
-TW::uint256_t Bot::eth_getBalance()
+void Bot::eth_getBalance(std::function<void(const TW::uint256_t&)> handler)
 {
 	auto doc = make_json_rpc("eth_getBalance");
 
@@ -219,13 +569,15 @@ TW::uint256_t Bot::eth_getBalance()
 	arr.push_back(nlohmann::json("latest"));
 	doc["params"] = arr;
 
-	auto response = rest_request(doc);
-	if (response["result"].is_string())
-		return hexToUInt256(response["result"]);
-	return 0;
+	rest_request(doc, [handler](nlohmann::json& response) {
+		if (response["result"].is_string())
+			handler(hexToUInt256(response["result"]));
+		else
+			handler(0);
+	});
 }
 
-nlohmann::json Bot::eth_getTransactionReceipt(const std::string& tx_hash, bool logged)
+nlohmann::json Bot::getTransactionReceipt_doc(const std::string& tx_hash)
 {
 	auto doc = make_json_rpc("eth_getTransactionReceipt");
 
@@ -233,10 +585,15 @@ nlohmann::json Bot::eth_getTransactionReceipt(const std::string& tx_hash, bool l
 	arr.push_back(tx_hash);
 	doc["params"] = arr;
 
-	return rest_request(doc, logged);
+	return doc;
 }
 
-nlohmann::json Bot::eth_getTransactionByHash(const std::string& tx_hash, bool logged)
+void Bot::eth_getTransactionReceipt(const std::string& tx_hash, bool logged, ResponseHandler handler)
+{
+	rest_request(getTransactionReceipt_doc(tx_hash), handler, logged);
+}
+
+void Bot::eth_getTransactionByHash(const std::string& tx_hash, bool logged, ResponseHandler handler)
 {
 	auto doc = make_json_rpc("eth_getTransactionByHash");
 
@@ -244,10 +601,10 @@ nlohmann::json Bot::eth_getTransactionByHash(const std::string& tx_hash, bool lo
 	arr.push_back(tx_hash);
 	doc["params"] = arr;
 
-	return rest_request(doc, logged);
+	rest_request(doc, handler, logged);
 }
 
-nlohmann::json Bot::eth_getBlockByNumber(const TW::uint256_t& number, bool full_tx_data, bool logged)
+nlohmann::json Bot::getBlockByNumber_doc(const TW::uint256_t& number, bool full_tx_data)
 {
 	auto doc = make_json_rpc("eth_getBlockByNumber");
 
@@ -256,10 +613,15 @@ nlohmann::json Bot::eth_getBlockByNumber(const TW::uint256_t& number, bool full_
 	arr.push_back(full_tx_data);
 	doc["params"] = arr;
 
-	return rest_request(doc, logged);
+	return doc;
 }
 
-nlohmann::json Bot::eth_call(const std::string& from, const std::string& to, const std::string& data)
+void Bot::eth_getBlockByNumber(const TW::uint256_t& number, bool full_tx_data, bool logged, ResponseHandler handler)
+{
+	rest_request(getBlockByNumber_doc(number, full_tx_data), handler, logged);
+}
+
+void Bot::eth_call(const std::string& from, const std::string& to, const std::string& data, ResponseHandler handler)
 {
 	auto doc = make_json_rpc("eth_call");
 
@@ -272,202 +634,974 @@ nlohmann::json Bot::eth_call(const std::string& from, const std::string& to, con
 	arr.push_back(nlohmann::json("latest"));
 	doc["params"] = arr;
 
-	return rest_request(doc);
+	rest_request(doc, handler);
 }
 
-nlohmann::json Bot::eth_sendRawTransaction(const std::string& data)
+nlohmann::json Bot::sendRawTransaction_doc(const std::string& data)
 {
 	auto doc = make_json_rpc("eth_sendRawTransaction");
 
 	auto arr = nlohmann::json::array();
 	arr.push_back("0x" + data);
 	doc["params"] = arr;
+	return doc;
+}
 
-	return rest_request(doc);
+void Bot::eth_sendRawTransaction(const std::string& data, ResponseHandler handler)
+{
+	fire_request(sendRawTransaction_doc(data), handler);
 }
 
-void Bot::prepare_transaction(TW::Ethereum::ABI::Function* func)
+Broadcaster* Bot::make_broadcaster()
 {
-	LOG(DEBUG) << "nonce = " << nonce_
-				<< ", gas_price = " << gas_price_
-				<< ", gas_limit = " << gas_limit_;
+	auto broadcaster = new Broadcaster(http_, strand_, headers_);
+	if (config_["send_urls"].is_array() && !config_["send_urls"].empty()) {
+		for (auto& url : config_["send_urls"])
+			broadcaster->add_endpoint(url);
+	}
+	else {
+		broadcaster->add_endpoint(url_);
+	}
+	if (config_["raw_send"].is_boolean() && config_["raw_send"]) {
+		int busy_poll_usec = 0;
+		if (config_["busy_poll_usec"].is_number())
+			check_config("busy_poll_usec", busy_poll_usec);
+		broadcaster->enable_raw(busy_poll_usec);
+	}
+	return broadcaster;
+}
 
+void Bot::sign_ladder(const TW::PrivateKey* key, std::size_t sign_key, const TW::uint256_t& nonce, TW::Ethereum::ABI::Function* func, RawsHandler handler)
+{
 	TW::Data payload;
 	func->encode(payload);
 
-	auto transaction = std::make_shared<TW::Ethereum::TransactionNonTyped>(nonce_++, gas_price_, gas_limit_, contract_, 0, payload);
+	// every rung replaces the others: same nonce, different gas price
+	if (signer_) {
+		std::vector<SignPool::Spec> specs(ladder_->size());
+		for (std::size_t i = 0; i < ladder_->size(); ++i)
+			specs[i] = SignPool::Spec{nonce, ladder_->gas_price(i), gas_limit_, contract_, 0, payload};
+		signer_->sign(sign_key, chain_id_, std::move(specs), [this, handler](std::vector<std::string>& raws) {
+			strand_.dispatch([handler, raws = std::move(raws)]() mutable {
+				handler(raws);
+			});
+		});
+		return;
+	}
+
+	std::vector<std::string> raws(ladder_->size());
+	for (std::size_t i = 0; i < ladder_->size(); ++i) {
+		auto transaction = std::make_shared<TW::Ethereum::TransactionNonTyped>(nonce, ladder_->gas_price(i), gas_limit_, contract_, 0, payload);
+		auto signature = TW::Ethereum::Signer::sign(*key, chain_id_, transaction);
+		auto encoded = transaction->encoded(signature, chain_id_);
+		raws[i] = TW::hex(encoded);
+	}
+	handler(raws);
+}
+
+std::vector<std::string> Bot::sendRawTransaction_requests(const std::vector<std::string>& raws)
+{
+	std::vector<std::string> requests;
+	for (auto& raw : raws)
+		requests.push_back(pretty_print(sendRawTransaction_doc(raw)));
+	return requests;
+}
+
+void Bot::prepare_transaction(TW::Ethereum::ABI::Function* func)
+{
+	prepared_func_ = func;
+	auto nonce = nonces_->next(nonce_holder_);
+	FAST_LOG(Debug, "nonce = {}, gas_price = {}..{}, gas_limit = {}", (uint64_t)nonce,
+		(uint64_t)ladder_->gas_price(0), (uint64_t)ladder_->gas_price(ladder_->size() - 1), (uint64_t)gas_limit_);
+
+	auto seq = ++prepare_seq_;
+	sign_ladder(private_key_, sign_key_, nonce, func, [this, seq, nonce](std::vector<std::string>& raws) {
+		if (seq != prepare_seq_)
+			return;  // prepared again meanwhile
+		signed_seq_ = seq;
+		if (raws.empty()) {
+			LOG(ERROR) << "prepare_transaction: nonce " << nonce << " not signed, the ladder of nonce " << ladder_nonce_ << " is kept";
+			return;
+		}
+		for (std::size_t i = 0; i < raws.size(); ++i)
+			ladder_->set_raw(i, raws[i]);
+		ladder_nonce_ = nonce;
+		ladder_signed_ = true;
+		// serialized and handed to curl now, timer_cb only sends
+		broadcaster_->prepare(sendRawTransaction_requests(raws), [this](nlohmann::json& response) {
+			on_fired(response);
+		});
+	});
+}
+
+void Bot::on_sent(const TW::uint256_t& nonce, const TW::uint256_t& gas_price, nlohmann::json& response)
+{
+	if (response["result"].is_string())
+		nonces_->sent(nonce_holder_, nonce, response["result"], gas_price);
+	else
+		resync_nonce();
+}
+
+void Bot::resync_nonce()
+{
+	std::vector<nlohmann::json> docs;
+	docs.push_back(getTransactionCount_doc(wallet_hex_, "latest"));
+	docs.push_back(getTransactionCount_doc(wallet_hex_, "pending"));
+
+	bool logged = false;
+	rest_batch_request(std::move(docs), [this](std::vector<nlohmann::json>& counts) {
+		if (!counts[0]["result"].is_string() || !counts[1]["result"].is_string()) {
+			LOG(ERROR) << "resync_nonce: " << pretty_print(counts[0]) << ", " << pretty_print(counts[1]);
+			return;
+		}
+		nonces_->resync(hexToUInt256(counts[0]["result"]), hexToUInt256(counts[1]["result"]));
+		replace_stuck();
+	}, logged);
+
+	for (auto w : extra_wallets_)
+		resync_extra_nonce(*w);
+}
+
+void Bot::replace_stuck()
+{
+	TW::uint256_t nonce;
+	NonceManager::InFlight tx;
+	if (!nonces_->stuck(nonce_stuck_sec_, nonce, tx))
+		return;
+
+	// a cancel: empty transfer to ourselves, priced over both the stuck one (replacement needs +10%) and the ladder
+	TW::uint256_t gas_price = std::max<TW::uint256_t>(tx.gas_price_ * 12 / 10, ladder_->gas_price(ladder_->size() - 1));
+	LOG(ERROR) << "replace_stuck: nonce " << nonce << " (" << tx.hash_ << ") not mined, cancelling at gas price " << gas_price;
+
+	auto send = [this, nonce, gas_price](const std::string& raw) {
+		eth_sendRawTransaction(raw, [this, nonce, gas_price](nlohmann::json& response) {
+			if (response["result"].is_string())
+				nonces_->sent(nonce_holder_, nonce, response["result"], gas_price);
+			else
+				LOG(ERROR) << "replace_stuck: " << pretty_print(response);
+		});
+	};
+
+	if (signer_) {
+		std::vector<SignPool::Spec> specs {SignPool::Spec{nonce, gas_price, 21000, wallet_, 0, TW::Data()}};
+		signer_->sign(sign_key_, chain_id_, std::move(specs), [this, send](std::vector<std::string>& raws) {
+			strand_.dispatch([send, raws = std::move(raws)] {
+				if (!raws.empty())
+					send(raws[0]);
+			});
+		});
+		return;
+	}
+
+	auto transaction = std::make_shared<TW::Ethereum::TransactionNonTyped>(nonce, gas_price, 21000, wallet_, 0, TW::Data());
 	auto signature = TW::Ethereum::Signer::sign(*private_key_, chain_id_, transaction);
-	auto encoded = transaction->encoded(signature, chain_id_);
-	prepared_tx_ = TW::hex(encoded);
+	send(TW::hex(transaction->encoded(signature, chain_id_)));
+}
+
+std::string Bot::sender() const
+{
+	// as the node reports "from"
+	std::string wallet = "0x" + wallet_hex_;
+	std::transform(wallet.begin(), wallet.end(), wallet.begin(), ::tolower);
+	return wallet;
+}
+
+void Bot::start_extra_wallet(ExtraWallet& w)
+{
+	w.broadcaster_ = make_broadcaster();
+	eth_getTransactionCount(w.wallet_hex_, "pending", [this, &w](nlohmann::json& response) {
+		if (!response["result"].is_string()) {
+			LOG(ERROR) << "Bot #" << config_["id"] << ": " << w.sender_ << " not used, cannot get nonce: " << pretty_print(response);
+			return;
+		}
+		w.nonces_->init(hexToUInt256(response["result"]));
+		prepare_extra(w);
+	});
+}
+
+void Bot::prepare_extra(ExtraWallet& w)
+{
+	auto seq = ++w.prepare_seq_;
+	auto nonce = w.nonces_->next(w.nonce_holder_);
+	sign_ladder(w.private_key_, w.sign_key_, nonce, compound_func_, [this, &w, seq, nonce](std::vector<std::string>& raws) {
+		if (seq != w.prepare_seq_)
+			return;  // prepared again meanwhile
+		w.signed_seq_ = seq;
+		if (raws.empty()) {
+			LOG(ERROR) << "prepare_extra: " << w.sender_ << ": nonce " << nonce << " not signed";
+			return;
+		}
+		w.raws_ = raws;
+		w.raws_nonce_ = nonce;
+		w.broadcaster_->prepare(sendRawTransaction_requests(raws), [this, &w](nlohmann::json& response) {
+			on_extra_fired(w, response);
+		});
+	});
+}
+
+void Bot::schedule_extra_wallets(std::chrono::system_clock::time_point target)
+{
+	// wallets at the same offset go out one after the other on the strand
+	for (auto w : extra_wallets_) {
+		w->timer_.expires_at(target + w->offset_);
+		w->timer_.async_wait([this, w](const boost::system::error_code& e) {
+			extra_timer_cb(*w, e);
+		});
+		w->armed_ = true;
+	}
+}
+
+void Bot::extra_timer_cb(ExtraWallet& w, const boost::system::error_code& e)
+{
+	if (e || !w.armed_)
+		return;  // rescheduled, or fired early by on_competitor_seen
+	w.armed_ = false;
+
+	if (!w.nonces_->reserved(w.nonce_holder_, w.fired_nonce_) || w.raws_.empty() || w.raws_nonce_ != w.fired_nonce_) {
+		// still signing, or the raws are of a nonce sent already
+		FAST_LOG(Error, "extra_timer_cb: {} not signed for its next nonce, shot skipped", w.sender_);
+		if (w.signed_seq_ == w.prepare_seq_)
+			prepare_extra(w);  // the last signing failed
+		return;
+	}
+	w.fired_rung_ = ladder_->selected();
+	if (!w.broadcaster_->fire(w.fired_rung_)) {
+		FAST_LOG(Error, "extra_timer_cb: no prepared request for {}", w.sender_);
+		w.broadcaster_->broadcast(pretty_print(sendRawTransaction_doc(w.raws_[w.fired_rung_])), [this, &w](nlohmann::json& response) {
+			on_extra_fired(w, response);
+		});
+	}
+	FAST_LOG(Debug, "extra_timer_cb: {} sent at {} ms", w.sender_, (int64_t)(fire_delta_msec_ + w.offset_).count());
+}
+
+void Bot::on_extra_fired(ExtraWallet& w, nlohmann::json& response)
+{
+	if (!response["result"].is_string()) {
+		LOG(ERROR) << "on_extra_fired: " << w.sender_ << ": " << pretty_print(response);
+		resync_extra_nonce(w);
+		return;
+	}
+	LOG(DEBUG) << "on_extra_fired: " << w.sender_ << " sent " << pretty_print(response["result"]);
+	w.nonces_->sent(w.nonce_holder_, w.fired_nonce_, response["result"], ladder_->gas_price(w.fired_rung_));
+	prepare_extra(w);
+}
+
+void Bot::resync_extra_nonce(ExtraWallet& w)
+{
+	std::vector<nlohmann::json> docs;
+	docs.push_back(getTransactionCount_doc(w.wallet_hex_, "latest"));
+	docs.push_back(getTransactionCount_doc(w.wallet_hex_, "pending"));
+
+	bool logged = false;
+	rest_batch_request(std::move(docs), [this, &w](std::vector<nlohmann::json>& counts) {
+		if (!counts[0]["result"].is_string() || !counts[1]["result"].is_string()) {
+			LOG(ERROR) << "resync_extra_nonce: " << pretty_print(counts[0]) << ", " << pretty_print(counts[1]);
+			return;
+		}
+		w.nonces_->resync(hexToUInt256(counts[0]["result"]), hexToUInt256(counts[1]["result"]));
+	}, logged);
+}
+
+NonceManager* Bot::nonce_manager(const std::string& sender)
+{
+	auto& nonces = (*nonce_managers_)[sender];
+	if (!nonces)
+		nonces.reset(new NonceManager());
+	return nonces.get();
+}
+
+Bot::ExtraWallet* Bot::extra_wallet(const std::string& from) const
+{
+	for (auto w : extra_wallets_) {
+		if (w->sender_ == from)
+			return w;
+	}
+	return nullptr;
+}
+
+std::vector<Transaction> Bot::as_ours(const std::vector<Transaction>& rows) const
+{
+	// TxLadder, DeltaTuner and CompetitorStats know one wallet of ours
+	auto result = rows;
+	auto me = sender();
+	for (auto& t : result) {
+		if (extra_wallet(t.from_))
+			t.from_ = me;
+	}
+	return result;
 }
 
 void Bot::schedule_for_10x1min()
 {
-	auto start = boost::posix_time::from_time_t(config_["start_time"]);
+	auto start = std::chrono::system_clock::from_time_t(config_["start_time"]);
 	start += delta_msec_;
 
-	if (start < boost::posix_time::second_clock::universal_time())
-		throw std::logic_error("start_time in the past");
+	if (start < std::chrono::system_clock::now()) {
+		LOG(ERROR) << "Bot #" << config_["id"] << " not started: start_time in the past";
+		return;
+	}
 
 	main_timer_.expires_at(start + delta_msec_);
 	main_timer_.async_wait(std::bind(&Bot::timer_cb, this, std::placeholders::_1));
+	schedule_warm_up();
 	log_schedule();
 }
 
 void Bot::schedule_for_compound_time()
 {
-	auto response = eth_call(wallet_hex_, contract_hex_, TW::hex(nearestCompoundingTime_func_->getSignature()));
-	auto next = hexToUInt256(response["result"]);
-	LOG(DEBUG) << "next = " << next;
+	eth_call(wallet_hex_, contract_hex_, TW::hex(nearestCompoundingTime_func_->getSignature()), [this](nlohmann::json& response) {
+		if (!response["result"].is_string()) {
+			LOG(ERROR) << "nearestCompoundingTime failed: " << pretty_print(response);
+			cooling_down_ = false;
+			shot_armed_ = false;
+			main_timer_.expires_at(std::chrono::system_clock::now() + std::chrono::seconds(30));
+			main_timer_.async_wait(std::bind(&Bot::cooldown_cb, this, std::placeholders::_1));
+			log_schedule();
+			return;
+		}
 
-	if (nearest_compounding_time_ != next) {
-		nearest_compounding_time_ = next;
-		auto start = boost::posix_time::from_time_t((time_t)next);
-		main_timer_.expires_at(start + delta_msec_);
-		main_timer_.async_wait(std::bind(&Bot::timer_cb, this, std::placeholders::_1));
-	}
-	else {
-		// reschedule for 30 sec after bounty distribution
-		main_timer_.expires_at(boost::posix_time::second_clock::universal_time() + boost::posix_time::seconds(30));
-		main_timer_.async_wait(std::bind(&Bot::cooldown_cb, this, std::placeholders::_1));
+		auto next = hexToUInt256(response["result"]);
+		LOG(DEBUG) << "next = " << next;
+
+		cooling_down_ = nearest_compounding_time_ == next;
+		if (!cooling_down_) {
+			nearest_compounding_time_ = next;
+			auto start = std::chrono::system_clock::from_time_t((time_t)next);
+			fire_delta_msec_ = current_delta();
+			main_timer_.expires_at(start + fire_delta_msec_);
+			main_timer_.async_wait(std::bind(&Bot::timer_cb, this, std::placeholders::_1));
+			shot_armed_ = true;
+			schedule_extra_wallets(main_timer_.expires_at());
+			schedule_warm_up();
+		}
+		else {
+			// reschedule for 30 sec after bounty distribution, or earlier on a vault log
+			shot_armed_ = false;
+			main_timer_.expires_at(std::chrono::system_clock::now() + std::chrono::seconds(30));
+			main_timer_.async_wait(std::bind(&Bot::cooldown_cb, this, std::placeholders::_1));
+		}
+		log_schedule();
+	});
+}
+
+void Bot::schedule_warm_up()
+{
+	auto at = main_timer_.expires_at() - warm_up_sec_;
+	if (at <= std::chrono::system_clock::now())
+		return;
+	warm_up_timer_.expires_at(at);
+	warm_up_timer_.async_wait(strand_.wrap(std::bind(&Bot::warm_up_cb, this, std::placeholders::_1)));
+}
+
+void Bot::warm_up_cb(const boost::system::error_code& e)
+{
+	if (e)
+		return;
+	LOG(DEBUG) << "warm_up_cb";
+
+	if (mode_ == MODE_compound && delta_tuner_) {
+		// pick up the latest clock offset estimate
+		auto delta = current_delta();
+		if (delta != fire_delta_msec_ && shot_armed_) {
+			fire_delta_msec_ = delta;
+			main_timer_.expires_at(std::chrono::system_clock::from_time_t((time_t)nearest_compounding_time_) + fire_delta_msec_);
+			main_timer_.async_wait(std::bind(&Bot::timer_cb, this, std::placeholders::_1));
+			schedule_extra_wallets(main_timer_.expires_at());
+			log_schedule();
+		}
 	}
-	log_schedule();
+	auto doc = make_json_rpc("eth_blockNumber");
+	doc["params"] = nlohmann::json::array();
+	broadcaster_->warm_up(pretty_print(doc));
+	for (auto w : extra_wallets_)
+		w->broadcaster_->warm_up(pretty_print(doc));
+
+	resync_nonce();
+}
+
+std::chrono::milliseconds Bot::current_delta()
+{
+	if (delta_tuner_)
+		return std::chrono::milliseconds(delta_tuner_->delta_msec(*clock_sync_));
+	return delta_msec_;
+}
+
+void Bot::schedule_clock_sync()
+{
+	if (clock_sync_msec_.count() <= 0)
+		return;
+	clock_sync_timer_.expires_after(clock_sync_msec_);
+	clock_sync_timer_.async_wait(strand_.wrap(std::bind(&Bot::clock_sync_cb, this, std::placeholders::_1)));
+}
+
+void Bot::clock_sync_cb(const boost::system::error_code& e)
+{
+	if (e)
+		return;
+
+	auto doc = make_json_rpc("eth_getBlockByNumber");
+	doc["params"] = nlohmann::json::array({"latest", false});
+
+	bool logged = false;
+	auto sent = std::chrono::system_clock::now();
+	rest_request(doc, [this, sent](nlohmann::json& block) {
+		auto received = std::chrono::system_clock::now();
+		if (block["result"].is_object()) {
+			auto samples = clock_sync_->samples();
+			clock_sync_->add_sample((uint64_t)hexToUInt256(block["result"]["number"]), (int64_t)hexToUInt256(block["result"]["timestamp"]), sent, received);
+			if (clock_sync_->samples() != samples && clock_sync_->samples() % 20 == 0)
+				LOG(DEBUG) << "clock offset " << clock_sync_->offset().count() << " us, rtt " << clock_sync_->rtt().count() << " us, delta " << current_delta().count() << " ms";
+		}
+		schedule_clock_sync();
+	}, logged);
 }
 
 void Bot::log_schedule()
 {
-	LOG(DEBUG) << std::string(config_["name"]) << ": timer_cb scheduled for " << mode_ << " at " << to_simple_string(main_timer_.expires_at()) << " UTC";
+	FAST_LOG(Debug, "{}: timer_cb scheduled for {} at {} UTC", config_["name"].get_ref<const std::string&>(), mode_, main_timer_.expires_at());
 }
 
-void Bot::timer_cb(const boost::system::error_code& /*e*/)
+void Bot::timer_cb(const boost::system::error_code& e)
 {
-	if (mode_ == MODE_approve10x1min) {
-		static int counter = 10;
-		static const boost::posix_time::minutes interval(1);
+	if (e == boost::asio::error::operation_aborted)
+		return;  // rescheduled
+	if (mode_ == MODE_compound && !shot_armed_)
+		return;  // fired early by on_competitor_seen
 
-		LOG(DEBUG) << "timer_cb approve #" << counter << " start";
-		auto response = eth_sendRawTransaction(prepared_tx_);
-		LOG(DEBUG) << "timer_cb approve #" << counter << " end";
+	auto entered = LatencyStats::clock::now();
+	shoot(entered - std::chrono::duration_cast<LatencyStats::clock::duration>(main_timer_.last_offset()), entered);
 
-		--counter;
+	if (mode_ == MODE_approve10x1min) {
+		static const std::chrono::minutes interval(1);
+
+		FAST_LOG(Info, "timer_cb approve #{} sent", shot_counter_);
+		--shot_counter_;
 
-		if (counter > 0) {
-			prepare_transaction(approve_func_);
+		if (shot_counter_ > 0) {
 			main_timer_.expires_at(main_timer_.expires_at() + interval);
 			main_timer_.async_wait(std::bind(&Bot::timer_cb, this, std::placeholders::_1));
+			schedule_warm_up();
 			log_schedule();
 		}
 	}
 	else if (mode_ == MODE_compound10x1min) {
-		static int counter = 10;
-		static const boost::posix_time::minutes interval(1);
-
-		LOG(DEBUG) << "timer_cb compound #" << counter << " start";
-		auto response = eth_sendRawTransaction(prepared_tx_);
-		LOG(DEBUG) << "timer_cb compound #" << counter << " end";
+		static const std::chrono::minutes interval(1);
 
-		--counter;
+		FAST_LOG(Info, "timer_cb compound #{} sent", shot_counter_);
+		--shot_counter_;
 
-		if (counter > 0) {
-			prepare_transaction(compound_func_);
+		if (shot_counter_ > 0) {
 			main_timer_.expires_at(main_timer_.expires_at() + interval);
 			main_timer_.async_wait(std::bind(&Bot::timer_cb, this, std::placeholders::_1));
+			schedule_warm_up();
 			log_schedule();
 		}
 	}
 	else if (mode_ == MODE_compound) {
-		LOG(DEBUG) << "timer_cb compound start";
-		auto response = eth_sendRawTransaction(prepared_tx_);
-		if (response["result"].is_string()) {
-			std::string my_tx_hash = response["result"];
-			gather_tx_timer_.expires_at(boost::posix_time::second_clock::universal_time() + boost::posix_time::seconds(GATHER_TX_TIMEOUT));
-			gather_tx_timer_.async_wait(std::bind(&Bot::gather_tx_cb, this, my_tx_hash, std::placeholders::_1));
+		FAST_LOG(Info, "timer_cb compound sent");
+	}
+
+	FAST_LOG(Info, "timer_cb fire offset {} us", (int64_t)std::chrono::duration_cast<std::chrono::microseconds>(main_timer_.last_offset()).count());
+}
+
+void Bot::shoot(LatencyStats::clock::time_point due, LatencyStats::clock::time_point entered)
+{
+	shot_armed_ = false;
+	shot_ = LatencyStats::Shot();
+	shot_.due_ = due;
+	shot_.stages_[LatencyStats::stage_entered] = entered;
+
+	fired_.n_ = shot_counter_;
+	fired_.delta_msec_ = (int)fire_delta_msec_.count();
+	bool reserved = nonces_->reserved(nonce_holder_, fired_.nonce_);
+	if (!reserved || !ladder_signed_ || ladder_nonce_ != fired_.nonce_) {
+		// signing failed or is still running: the ladder's raws would be rejected, or replace a shot sent already
+		FAST_LOG(Error, "shoot: ladder not signed for the next nonce, shot skipped: reserved nonce {}, ladder nonce {}{}",
+			reserved ? (int64_t)fired_.nonce_ : (int64_t)-1, (int64_t)ladder_nonce_, ladder_signed_ ? "" : " (never signed)");
+		if (signed_seq_ == prepare_seq_ && prepared_func_)
+			prepare_transaction(prepared_func_);  // the last signing failed
+		auto response = make_json_rpc_error("ladder not signed for the next nonce");
+		on_fired(response);
+		return;
+	}
+	fired_.rung_ = ladder_->selected();
+	if (outbid_price_ > 0)
+		fired_.rung_ = std::max(fired_.rung_, ladder_->above(outbid_price_));
+	fire();
+}
+
+void Bot::fire()
+{
+	// the request was serialized by prepare_transaction, stage_serialized is left unset;
+	// only the fallback below serializes on the fire path and records it.
+	// shoot() has checked that the ladder is signed for fired_.nonce_
+	if (!broadcaster_->fire(fired_.rung_)) {
+		FAST_LOG(Error, "fire: no prepared request for rung {}", fired_.rung_);
+		std::string request = pretty_print(sendRawTransaction_doc(ladder_->raw(fired_.rung_)));
+		shot_.stages_[LatencyStats::stage_serialized] = LatencyStats::clock::now();
+		FAST_LOG(Debug, "Request: {}", request);
+		broadcaster_->broadcast(request, [this](nlohmann::json& response) {
+			on_fired(response);
+		});
+	}
+}
+
+void Bot::on_fired(nlohmann::json& response)
+{
+	record_shot(response);
+
+	if (mode_ == MODE_approve10x1min || mode_ == MODE_compound10x1min) {
+		LOG(DEBUG) << "timer_cb " << (mode_ == MODE_approve10x1min ? "approve" : "compound") << " #" << fired_.n_ << " end";
+		on_sent(fired_.nonce_, ladder_->gas_price(fired_.rung_), response);
+		// signed once the nonce is taken, the next shot is a minute away
+		if (response["result"].is_string() && shot_counter_ > 0)
+			prepare_transaction(mode_ == MODE_approve10x1min ? approve_func_ : compound_func_);
+		return;
+	}
+
+	outbid_price_ = 0;
+	if (response["result"].is_string()) {
+		shot_comment_ = LatencyStats::describe(shot_);
+		track_shot(response["result"], fired_.delta_msec_);
+		if (mempool_outbid_) {
+			// copied, prepare_transaction below re-signs the ladder for the next nonce
+			replacement_raws_.resize(ladder_->size());
+			for (std::size_t i = 0; i < ladder_->size(); ++i)
+				replacement_raws_[i] = ladder_->raw(i);
+			replacement_rung_ = fired_.rung_;
+			replacement_nonce_ = fired_.nonce_;
 		}
+	}
 
-		LOG(DEBUG) << "timer_cb compound end";
+	LOG(DEBUG) << "timer_cb compound end, gas price " << ladder_->gas_price(fired_.rung_);
 
-		prepare_transaction(compound_func_);
-		schedule_for_compound_time();
+	on_sent(fired_.nonce_, ladder_->gas_price(fired_.rung_), response);
+	if (response["result"].is_string())
+		prepare_transaction(compound_func_);  // otherwise the signed ladder is kept while its nonce is free
+	schedule_for_compound_time();
+}
+
+void Bot::track_shot(const std::string& hash, int delta_msec)
+{
+	shot_hash_ = hash;
+	if (ws_) {
+		pending_tx_hash_ = hash;
+		pending_delta_msec_ = delta_msec;
+		pending_block_ = 0;
 	}
+	// with ws_ this is only a fallback, gather_tx usually starts from new_head_cb
+	gather_tx_timer_.expires_at(boost::posix_time::second_clock::universal_time() + boost::posix_time::seconds(GATHER_TX_TIMEOUT));
+	gather_tx_timer_.async_wait(strand_.wrap(std::bind(&Bot::gather_tx_cb, this, hash, delta_msec, std::placeholders::_1)));
 }
 
-void Bot::cooldown_cb(const boost::system::error_code& /*e*/)
+void Bot::record_shot(nlohmann::json& response)
 {
+	if (response["result"].is_string()) {
+		auto& timings = broadcaster_->last_timings();
+		shot_.stages_[LatencyStats::stage_on_wire] = timings.on_wire_;
+		shot_.stages_[LatencyStats::stage_first_byte] = timings.first_byte_;
+		shot_.stages_[LatencyStats::stage_parsed] = timings.parsed_;
+	}
+	LOG(DEBUG) << "timer_cb " << LatencyStats::describe(shot_);
+
+	if (stats_) {
+		stats_->add_shot(config_["id"], shot_);
+		if (!latency_file_.empty())
+			stats_->write(latency_file_);
+	}
+}
+
+void Bot::cooldown_cb(const boost::system::error_code& e)
+{
+	if (e == boost::asio::error::operation_aborted)
+		return;  // rescheduled by vault_log_cb
+
 	if (mode_ == MODE_compound) {
 		LOG(DEBUG) << "cooldown_cb compound";
 		schedule_for_compound_time();
 	}
 }
 
-void Bot::gather_tx_cb(const std::string& my_tx_hash, const boost::system::error_code& /*e*/)
+void Bot::gather_tx_cb(const std::string& my_tx_hash, int delta_msec, const boost::system::error_code& e)
 {
+	if (e == boost::asio::error::operation_aborted)
+		return;  // started by new_head_cb
+
 	if (mode_ == MODE_compound) {
 		LOG(DEBUG) << "gather_tx_cb compound";
-		gather_tx(my_tx_hash);
+		if (my_tx_hash == pending_tx_hash_)
+			pending_tx_hash_.clear();
+		gather_tx(my_tx_hash, delta_msec);
+	}
+}
+
+void Bot::new_head_cb(nlohmann::json& head)
+{
+	if (!head["number"].is_string() || !head["timestamp"].is_string())
+		return;
+	auto received = std::chrono::system_clock::now();
+	auto number = hexToUInt256(head["number"]);
+
+	// a pushed head is a sample without request latency
+	clock_sync_->add_sample((uint64_t)number, (int64_t)hexToUInt256(head["timestamp"]), received, received);
+
+	if (pending_tx_hash_.empty())
+		return;
+
+	if (pending_block_ == 0) {
+		// reverted transactions leave no logs, so the receipt is checked on every head
+		bool logged = false;
+		eth_getTransactionReceipt(pending_tx_hash_, logged, [this, hash = pending_tx_hash_](nlohmann::json& receipt) {
+			if (hash == pending_tx_hash_ && pending_block_ == 0 && receipt["result"].is_object() && receipt["result"]["blockNumber"].is_string()) {
+				pending_block_ = hexToUInt256(receipt["result"]["blockNumber"]);
+				LOG(DEBUG) << "new_head_cb: " << hash << " mined in block #" << pending_block_;
+			}
+		});
+	}
+	else if (number >= pending_block_ + 2) {
+		// gather_blocks looks 2 blocks past ours
+		LOG(DEBUG) << "new_head_cb: block #" << number << ", gathering " << pending_tx_hash_;
+		gather_tx_timer_.cancel();
+		auto hash = pending_tx_hash_;
+		pending_tx_hash_.clear();
+		gather_tx(hash, pending_delta_msec_);
 	}
 }
 
+void Bot::vault_log_cb(nlohmann::json& log)
+{
+	if (log["removed"].is_boolean() && log["removed"])
+		return;
+
+	if (cooling_down_) {
+		// the compound has been executed, nearestCompoundingTime has moved
+		LOG(DEBUG) << "vault_log_cb: " << pretty_print(log["transactionHash"]) << " in block " << pretty_print(log["blockNumber"]) << ", rescheduling";
+		cooling_down_ = false;
+		schedule_for_compound_time();
+	}
+}
+
+void Bot::pending_tx_cb(nlohmann::json& tx)
+{
+	if (tx.is_object()) {
+		mempool_->add(tx);
+	}
+	else if (tx.is_string()) {
+		// the node sends hashes only, every one costs a request
+		bool logged = false;
+		eth_getTransactionByHash(tx, logged, [this](nlohmann::json& response) {
+			if (response["result"].is_object())
+				mempool_->add(response["result"]);
+		});
+	}
+}
+
+void Bot::schedule_mempool_poll(std::chrono::milliseconds after)
+{
+	mempool_timer_.expires_after(after);
+	mempool_timer_.async_wait(strand_.wrap(std::bind(&Bot::mempool_poll_cb, this, std::placeholders::_1)));
+}
+
+void Bot::mempool_poll_cb(const boost::system::error_code& e)
+{
+	if (e)
+		return;
+
+	auto doc = make_json_rpc("txpool_content");
+	doc["params"] = nlohmann::json::array();
+
+	bool logged = false;
+	rest_request(doc, [this](nlohmann::json& response) {
+		if (!response["result"].is_object()) {
+			LOG(ERROR) << "mempool_poll_cb: " << pretty_print(response) << ", retrying in 30 sec";
+			schedule_mempool_poll(std::chrono::seconds(30));
+			return;
+		}
+		mempool_->add_txpool(response["result"]);
+		schedule_mempool_poll(mempool_poll_msec_);
+	}, logged);
+}
+
+void Bot::on_competitor_seen(const MempoolWatcher::Seen& seen)
+{
+	FAST_LOG(Debug, "mempool: {} from {}, nonce {}, gas price {}", seen.hash_, seen.from_, seen.nonce_, seen.gas_price_);
+
+	if (!shot_armed_) {
+		if (mempool_outbid_ && !replacement_raws_.empty())
+			outbid(seen.gas_price_);
+		return;
+	}
+
+	// only a competitor going for the same bounty as our armed shot counts
+	auto left = main_timer_.expires_at() - std::chrono::system_clock::now();
+	if (left > warm_up_sec_)
+		return;
+	if (mempool_outbid_ && seen.gas_price_ > outbid_price_)
+		outbid_price_ = seen.gas_price_;
+	if (mempool_fire_early_msec_.count() > 0 && left <= mempool_fire_early_msec_) {
+		FAST_LOG(Debug, "mempool: firing {} ms early", (int64_t)std::chrono::duration_cast<std::chrono::milliseconds>(left).count());
+		// the shot is due now, not at the target of main_timer_
+		auto entered = LatencyStats::clock::now();
+		main_timer_.cancel();
+		shoot(entered, entered);
+		// the extra wallets go with it, those that have not fired yet
+		for (auto w : extra_wallets_) {
+			if (!w->armed_)
+				continue;
+			w->timer_.cancel();
+			extra_timer_cb(*w, boost::system::error_code());
+		}
+	}
+}
+
+void Bot::outbid(const TW::uint256_t& gas_price)
+{
+	auto rung = ladder_->above(gas_price);
+	if (rung <= replacement_rung_)
+		return;  // ours is priced over it already, or the ladder ends
+	replacement_rung_ = rung;
+
+	auto nonce = replacement_nonce_;
+	auto price = ladder_->gas_price(rung);
+	FAST_LOG(Debug, "outbid: replacing {} at gas price {}", shot_hash_, (uint64_t)price);
+	eth_sendRawTransaction(replacement_raws_[rung], [this, nonce, price](nlohmann::json& response) {
+		if (!response["result"].is_string()) {
+			LOG(ERROR) << "outbid: " << pretty_print(response);
+			return;
+		}
+		nonces_->sent(nonce_holder_, nonce, response["result"], price);
+		if (replacement_raws_.empty())
+			return;  // gather_tx has started meanwhile
+		shot_comment_ += ", replaced at gas price " + price.str();
+		track_shot(response["result"], fired_.delta_msec_);
+	});
+}
+
 double Bot::tx_fee(const TW::uint256_t& gas_used, const TW::uint256_t& gas_price)
 {
 	return double(gas_used * gas_price) / pow(10, 18);
 }
 
-void Bot::gather_tx(const std::string& my_tx_hash)
+struct Bot::GatherState
 {
+	std::string my_tx_hash_;
+	TW::uint256_t my_block_number_;
+	std::string contr_;
+	std::string sig_;
+	int delta_msec_ {0};
+	TW::uint256_t timestamp_ {0};
+	std::vector<ChainCache::Block> blocks_;  // my_block_number_ - 2 on; timestamp 0 if missing
+	std::vector<Transaction> transactions_;
+};
+
+void Bot::gather_tx(const std::string& my_tx_hash, int delta_msec)
+{
+	replacement_raws_.clear();  // the nonce is mined
 	bool logged = false;
-	auto my_tx = eth_getTransactionByHash(my_tx_hash, logged);
-	const auto my_block_number = hexToUInt256(my_tx["result"]["blockNumber"]);
-	const auto contr = my_tx["result"]["to"];
-
-	std::string sig = my_tx["result"]["input"];
-	if (sig.length() > 10)
-		sig = sig.substr(0, 10);
-
-	TW::uint256_t timestamp = 0;
-
-	std::vector<Transaction> transactions;
-	for (auto i = 0; i < 5; ++i) {
-		auto block = eth_getBlockByNumber(my_block_number - 2 + i, true, logged);
-		if (timestamp == 0)
-			timestamp = hexToUInt256(block["result"]["timestamp"]);
-		//LOG(DEBUG) << pretty_print(block, true);
-		for (auto& tr : block["result"]["transactions"]) {
-			if (!tr["to"].is_string())
+	eth_getTransactionByHash(my_tx_hash, logged, [this, my_tx_hash, delta_msec](nlohmann::json& my_tx) {
+		if (!my_tx["result"].is_object() || !my_tx["result"]["blockNumber"].is_string()) {
+			LOG(ERROR) << "gather_tx: " << my_tx_hash << " not mined: " << pretty_print(my_tx);
+			return;
+		}
+
+		auto state = std::make_shared<GatherState>();
+		state->my_tx_hash_ = my_tx_hash;
+		state->delta_msec_ = delta_msec;
+		state->my_block_number_ = hexToUInt256(my_tx["result"]["blockNumber"]);
+		state->contr_ = my_tx["result"]["to"];
+
+		state->sig_ = my_tx["result"]["input"];
+		if (state->sig_.length() > 10)
+			state->sig_ = state->sig_.substr(0, 10);
+
+		gather_blocks(state);
+	});
+}
+
+void Bot::gather_blocks(std::shared_ptr<GatherState> state)
+{
+	const std::size_t block_count = 5;
+	state->blocks_.resize(block_count);
+	std::vector<std::size_t> missing;
+	std::vector<nlohmann::json> docs;
+	for (std::size_t i = 0; i < block_count; ++i) {
+		auto number = state->my_block_number_ - 2 + i;
+		if (cache_ && cache_->get_block((uint64_t)number, state->sig_, state->blocks_[i]))
+			continue;
+		missing.push_back(i);
+		docs.push_back(getBlockByNumber_doc(number, true));
+	}
+
+	if (docs.empty()) {
+		add_blocks(state);
+		gather_receipts(state);
+		return;
+	}
+
+	// full-transaction blocks are large: the response is scanned as a stream, not parsed into a DOM
+	std::string request = pretty_print(make_json_rpc_batch(docs));
+	async_->request(url_, headers_, request, "POST", on_strand(strand_, [this, state, missing](HttpResponse& response) {
+		process_blocks(state, response, missing);
+		add_blocks(state);
+		gather_receipts(state);
+	}));
+}
+
+void Bot::process_blocks(std::shared_ptr<GatherState> state, HttpResponse& response, const std::vector<std::size_t>& missing)
+{
+	if (!response.error.empty()) {
+		LOG(ERROR) << "gather_blocks: " << response.error;
+		return;
+	}
+
+	// with a cache, calls to every contract are kept: the other bots look for theirs
+	std::vector<BlockScanner::Block> blocks;
+	try {
+		blocks = BlockScanner(cache_ ? std::string() : state->contr_, state->sig_).scan(response.data, missing.size());
+	}
+	catch (std::exception& e) {
+		LOG(ERROR) << "gather_blocks: " << e.what();
+		return;
+	}
+
+	for (std::size_t j = 0; j < blocks.size(); ++j) {
+		auto& block = blocks[j];
+		auto number = state->my_block_number_ - 2 + missing[j];
+		if (!block.found_) {
+			LOG(ERROR) << "gather_blocks: block #" << number << " missing: " << block.error_;
+			continue;
+		}
+		auto& cached = state->blocks_[missing[j]];
+		cached.timestamp_ = (uint64_t)hexToUInt256(block.timestamp_);
+		for (auto& tr : block.transactions_) {
+			ChainCache::Tx t;
+			t.hash_ = std::move(tr.hash_);
+			t.from_ = std::move(tr.from_);
+			t.to_ = std::move(tr.to_);
+			t.gas_ = (uint64_t)hexToUInt256(tr.gas_);
+			t.gas_price_ = (uint64_t)hexToUInt256(tr.gas_price_);
+			cached.transactions_.push_back(std::move(t));
+		}
+		if (cache_)
+			cache_->put_block((uint64_t)number, state->sig_, cached);
+	}
+}
+
+void Bot::add_blocks(std::shared_ptr<GatherState> state)
+{
+	for (std::size_t j = 0; j < state->blocks_.size(); ++j) {
+		auto& block = state->blocks_[j];
+		if (block.timestamp_ == 0)
+			continue;
+		if (state->timestamp_ == 0)
+			state->timestamp_ = block.timestamp_;
+		for (auto& tr : block.transactions_) {
+			if (tr.to_ != state->contr_)
 				continue;
-			std::string to = tr["to"];
-			std::string input = tr["input"];
-			if (input.length() > 10)
-				input = input.substr(0, 10);
-			if (to == contr && input == sig) {
-				// contract & signature match
-				Transaction t;
-				t.hash_ = tr["hash"];
-				t.from_ = tr["from"];
-				t.to_ = contr;
-				t.block_number_ = my_block_number - 2 + i;
-				t.gas_limit_ = hexToUInt256(tr["gas"]);
-				t.gas_price_ = hexToUInt256(tr["gasPrice"]);
-				transactions.push_back(t);
+			// contract & signature match
+			Transaction t;
+			t.hash_ = tr.hash_;
+			t.from_ = tr.from_;
+			t.to_ = state->contr_;
+			t.block_number_ = state->my_block_number_ - 2 + j;
+			t.gas_limit_ = tr.gas_;
+			t.gas_price_ = tr.gas_price_;
+			state->transactions_.push_back(t);
+		}
+	}
+}
+
+void Bot::gather_receipts(std::shared_ptr<GatherState> state)
+{
+	std::vector<std::size_t> missing;
+	std::vector<nlohmann::json> docs;
+	for (std::size_t i = 0; i < state->transactions_.size(); ++i) {
+		auto& t = state->transactions_[i];
+		ChainCache::Receipt receipt;
+		if (cache_ && cache_->get_receipt(t.hash_, receipt)) {
+			t.gas_used_ = receipt.gas_used_;
+			t.status_ = receipt.status_;
+			t.log_count_ = receipt.log_count_;
+			continue;
+		}
+		missing.push_back(i);
+		docs.push_back(getTransactionReceipt_doc(t.hash_));
+	}
+
+	if (docs.empty()) {
+		store_transactions(state);
+		return;
+	}
+
+	bool logged = false;
+	rest_batch_request(std::move(docs), [this, state, missing](std::vector<nlohmann::json>& receipts) {
+		process_receipts(state, receipts, missing);
+		store_transactions(state);
+	}, logged);
+}
+
+void Bot::process_receipts(std::shared_ptr<GatherState> state, std::vector<nlohmann::json>& receipts, const std::vector<std::size_t>& missing)
+{
+	for (std::size_t i = 0; i < missing.size(); ++i) {
+		auto& tr = receipts[i];
+		//LOG(DEBUG) << "TX # " << i << ":\n" << pretty_print(tr, true);
+		auto& t = state->transactions_[missing[i]];
+		if (tr["result"].is_object()) {
+			t.gas_used_ = hexToUInt256(tr["result"]["gasUsed"]);
+			t.status_ = (int)hexToUInt256(tr["result"]["status"]);
+			t.log_count_ = tr["result"]["logs"].size();
+			if (cache_) {
+				ChainCache::Receipt receipt;
+				receipt.gas_used_ = (uint64_t)t.gas_used_;
+				receipt.status_ = t.status_;
+				receipt.log_count_ = t.log_count_;
+				cache_->put_receipt(t.hash_, receipt);
 			}
 		}
-		//LOG(DEBUG) << pretty_print(block, true);
+		else {
+			LOG(ERROR) << "gather_receipts: no receipt for " << t.hash_ << ": " << pretty_print(tr);
+			t.gas_used_ = 0;
+			t.status_ = 0;
+			t.log_count_ = 0;
+		}
 	}
+}
+
+void Bot::store_transactions(std::shared_ptr<GatherState> state)
+{
 	auto counter = 0;
-	for (auto& t : transactions) {
-		auto tr = eth_getTransactionReceipt(t.hash_, logged);
-		//LOG(DEBUG) << "TX # " << counter << ":\n" << pretty_print(tr, true);
-		t.gas_used_ = hexToUInt256(tr["result"]["gasUsed"]);
-		t.status_ = (int)hexToUInt256(tr["result"]["status"]);
-		t.log_count_ = tr["result"]["logs"].size();
+	for (auto& t : state->transactions_) {
 		t.index_ = counter++;
 		t.tx_fee_ = tx_fee(t.gas_used_, t.gas_price_);
-		t.timestamp_ = timestamp;
+		t.timestamp_ = state->timestamp_;
 		t.bot_id_ = config_["id"];
-		t.delta_msec_ = t.hash_ == my_tx_hash ? (int)config_["delta_msec"] : 0;
-		LOG(DEBUG) << timestamp << ";" << t.index_ << ";" << t.from_ << ";" << t.tx_fee_ << ";" << t.log_count_ << ";"
+		t.delta_msec_ = t.hash_ == state->my_tx_hash_ ? state->delta_msec_ : 0;
+		if (t.hash_ == shot_hash_)
+			t.comment_ = shot_comment_;
+		if (auto w = extra_wallet(t.from_)) {
+			t.delta_msec_ = state->delta_msec_ + (int)w->offset_.count();
+			t.comment_ = "extra wallet, offset " + std::to_string(w->offset_.count()) + " ms";
+		}
+		else if (auto seen = mempool_ ? mempool_->find(t.hash_) : nullptr) {
+			auto bounty = std::chrono::system_clock::from_time_t((time_t)state->timestamp_);
+			t.comment_ = "mempool at " + std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(seen->first_seen_ - bounty).count()) + " ms";
+		}
+		LOG(DEBUG) << state->timestamp_ << ";" << t.index_ << ";" << t.from_ << ";" << t.tx_fee_ << ";" << t.log_count_ << ";"
 			<< t.gas_limit_ << ";" << t.status_ << ";" << t.hash_ << ";" << t.block_number_ << ";" << t.gas_limit_ << ";" << t.gas_price_;
-		db_->store_tx(t);
+		if (db_)
+			db_->store_tx(t);
+	}
+
+	auto round = extra_wallets_.empty() ? state->transactions_ : as_ours(state->transactions_);
+	if (delta_tuner_)
+		delta_tuner_->add_round(round, state->my_tx_hash_, state->delta_msec_);
+	resync_nonce();  // our receipt is in
+	if (competitors_) {
+		competitors_->add_round(round, sender());
+		competitors_->log_top(3);
+		ladder_->set_floor(competitors_->winning_gas_price());
 	}
+	ladder_->add_round(round, sender());
 }
 
 void Bot::start()
@@ -487,8 +1621,13 @@ void Bot::start()
 	else if (mode_ == MODE_compound) {
 		prepare_transaction(compound_func_);
 		schedule_for_compound_time();
+		schedule_clock_sync();
+		if (mempool_ && mempool_poll_msec_.count() > 0)
+			schedule_mempool_poll(mempool_poll_msec_);
+		if (ws_)
+			ws_->start();
 	}
 	else {
-		throw std::logic_error("Unknown mode: " + mode_);
+		LOG(ERROR) << "Bot #" << config_["id"] << " not started: unknown mode " << mode_;
 	}
 }
@@ -1,13 +1,32 @@
 #pragma once
 
 #include <string>
+#include <string_view>
+#include <functional>
 #include <nlohmann/json.hpp>
 #include <boost/asio.hpp>
+#include <boost/asio/system_timer.hpp>
 
 #include <uint256.h>
 
-class BinaCPP;
+#include "PreciseTimer.h"
+#include "LatencyStats.h"
+#include "MempoolWatcher.h"
+#include "NonceManager.h"
+
+class AsioCURL;
+class AsyncURL;
+class Broadcaster;
+class ClockSync;
+class DeltaTuner;
+class CompetitorStats;
+class WsClient;
+class TxLadder;
 class DB;
+class ChainCache;
+class SignPool;
+struct HttpResponse;
+struct Transaction;
 
 namespace TW {
 	class PrivateKey;
@@ -21,7 +40,13 @@ namespace TW {
 class Bot
 {
 public:
-	Bot(nlohmann::json& config, boost::asio::io_service& io, DB* db);
+	typedef std::function<void(nlohmann::json&)> ResponseHandler;
+	typedef std::function<void(std::vector<nlohmann::json>&)> BatchHandler;
+	typedef std::function<void(std::vector<std::string>&)> RawsHandler;
+
+	// http, async, db, stats, cache, signer and nonces may be shared with other bots running on the same io_service
+	Bot(nlohmann::json& config, boost::asio::io_service& io, DB* db, AsioCURL* http, AsyncURL* async, LatencyStats* stats, ChainCache* cache,
+		SignPool* signer, NonceManagers* nonces);
 	~Bot();
 
 	void init();
@@ -29,46 +54,143 @@ public:
 
 	static std::string pretty_print(const nlohmann::json& val, bool indent = false);
 	static nlohmann::json parse_json(const std::string& str_result);
-	static nlohmann::json make_json_rpc(const std::string& method);
-	static TW::uint256_t hexToUInt256(std::string s);
+	static nlohmann::json make_json_rpc(const std::string& method, int id = 1);
+	static nlohmann::json make_json_rpc_error(const std::string& message, int id = 1);
+	static nlohmann::json make_json_rpc_batch(std::vector<nlohmann::json>& docs);
+	static std::vector<nlohmann::json> split_json_rpc_batch(nlohmann::json& response, std::size_t count);
+	// 0 if s is not a hex quantity; see HexCodec
+	static TW::uint256_t hexToUInt256(std::string_view s);
+	static TW::uint256_t hexToUInt256(const std::string& s) { return hexToUInt256(std::string_view(s)); }
+	static TW::uint256_t hexToUInt256(const nlohmann::json& val);  // throws if val is not a string
 	static std::string UInt256ToHex(const TW::uint256_t& val);
 
 	void timer_cb(const boost::system::error_code& /*e*/);
 	void cooldown_cb(const boost::system::error_code& /*e*/);  // after bounty
-	void gather_tx_cb(const std::string& my_tx_hash, const boost::system::error_code& /*e*/);  // after bounty
+	void gather_tx_cb(const std::string& my_tx_hash, int delta_msec, const boost::system::error_code& /*e*/);  // after bounty
+	void clock_sync_cb(const boost::system::error_code& e);
+	void warm_up_cb(const boost::system::error_code& e);  // shortly before timer_cb
+	void new_head_cb(nlohmann::json& head);  // "ws_url" only
+	void vault_log_cb(nlohmann::json& log);  // "ws_url" only
+	void pending_tx_cb(nlohmann::json& tx);  // "mempool_ws" only
+	void mempool_poll_cb(const boost::system::error_code& e);  // "mempool_poll_msec" only
 
 private:
 	static const std::vector<std::string> headers_;
 
 	static double tx_fee(const TW::uint256_t& gas_used, const TW::uint256_t& gas_price);
 
-	void gather_tx(const std::string& my_tx_hash);
+	struct GatherState;
+
+	void gather_tx(const std::string& my_tx_hash, int delta_msec);
+	void gather_blocks(std::shared_ptr<GatherState> state);
+	void gather_receipts(std::shared_ptr<GatherState> state);
+	void process_blocks(std::shared_ptr<GatherState> state, HttpResponse& response, const std::vector<std::size_t>& missing);
+	void add_blocks(std::shared_ptr<GatherState> state);  // state->blocks_ to state->transactions_
+	void process_receipts(std::shared_ptr<GatherState> state, std::vector<nlohmann::json>& receipts, const std::vector<std::size_t>& missing);
+	void store_transactions(std::shared_ptr<GatherState> state);
 
 	void check_config(const std::string& tag, std::string& output);
 	void check_config(const std::string& tag, int& output);
 	void check_config(const std::string& tag, TW::uint256_t& output);
 
-	void prepare_transaction(TW::Ethereum::ABI::Function* func);
-	nlohmann::json rest_request(nlohmann::json doc, bool logged = true);
-
-	nlohmann::json eth_getTransactionCount(const std::string& address);
-	nlohmann::json eth_gasPrice();
-	nlohmann::json eth_estimateGas();
-	nlohmann::json eth_call(const std::string& from, const std::string& to, const std::string& data);
-	nlohmann::json eth_sendRawTransaction(const std::string& data);
-
-	TW::uint256_t eth_getBalance();
-	nlohmann::json eth_getTransactionByHash(const std::string& tx_hash, bool logged);
-	nlohmann::json eth_getTransactionReceipt(const std::string& tx_hash, bool logged);
-	nlohmann::json eth_getBlockByNumber(const TW::uint256_t& number, bool full_tx_data, bool logged);
+	void prepare_transaction(TW::Ethereum::ABI::Function* func);  // signs every rung of ladder_ and prepares its requests
+	// every rung of ladder_, on signer_ with sign_key if there is one, else with key; handler gets the signed
+	// transactions on strand_, none if one could not be signed
+	void sign_ladder(const TW::PrivateKey* key, std::size_t sign_key, const TW::uint256_t& nonce, TW::Ethereum::ABI::Function* func, RawsHandler handler);
+	static std::vector<std::string> sendRawTransaction_requests(const std::vector<std::string>& raws);  // serialized
+	Broadcaster* make_broadcaster();  // to "send_urls", raw if "raw_send"
+	void shoot(LatencyStats::clock::time_point due, LatencyStats::clock::time_point entered);  // fired_ and fire(), by timer_cb or early
+	void fire();  // the selected rung, as prepared
+	void on_fired(nlohmann::json& response);
+	std::string sender() const;
+	void on_sent(const TW::uint256_t& nonce, const TW::uint256_t& gas_price, nlohmann::json& response);
+
+	// "extra_wallets": more shots at the same bounty, each wallet with its nonces
+	// and its connections, fired by its own timer at "offset_msec" from ours
+	struct ExtraWallet;
+	void start_extra_wallet(ExtraWallet& w);
+	void prepare_extra(ExtraWallet& w);
+	void schedule_extra_wallets(std::chrono::system_clock::time_point target);  // the target of main_timer_
+	void extra_timer_cb(ExtraWallet& w, const boost::system::error_code& e);
+	void on_extra_fired(ExtraWallet& w, nlohmann::json& response);
+	void resync_extra_nonce(ExtraWallet& w);
+	ExtraWallet* extra_wallet(const std::string& from) const;  // by sender as the node reports it
+	std::vector<Transaction> as_ours(const std::vector<Transaction>& rows) const;  // rows of extra wallets under sender()
+	void resync_nonce();  // latest and pending counts in one batch, off the fire path
+	NonceManager* nonce_manager(const std::string& sender);  // of the process, added to nonce_managers_ if new
+
+	// "mempool_ws" or "mempool_poll_msec": competitors' compound calls before they are mined
+	void on_competitor_seen(const MempoolWatcher::Seen& seen);
+	void outbid(const TW::uint256_t& gas_price);  // replaces the shot in flight by a rung priced over gas_price
+	void track_shot(const std::string& hash, int delta_msec);  // gather_tx follows this transaction
+	void schedule_mempool_poll(std::chrono::milliseconds after);
+	void replace_stuck();
+	void record_shot(nlohmann::json& response);  // our wallet as "from" of the node's transactions
+	static void handle_response(HttpResponse& response, ResponseHandler& handler, bool logged);
+	void rest_request(const nlohmann::json& doc, ResponseHandler handler, bool logged = true);
+	void fire_request(const nlohmann::json& doc, ResponseHandler handler);
+	void rest_batch_request(std::vector<nlohmann::json> docs, BatchHandler handler, bool logged = true);
+
+	static nlohmann::json sendRawTransaction_doc(const std::string& data);
+	static nlohmann::json getTransactionCount_doc(const std::string& address, const std::string& block);
+	static nlohmann::json getTransactionReceipt_doc(const std::string& tx_hash);
+	static nlohmann::json getBlockByNumber_doc(const TW::uint256_t& number, bool full_tx_data);
+
+	void eth_getTransactionCount(const std::string& address, const std::string& block, ResponseHandler handler);
+	void eth_gasPrice(ResponseHandler handler);
+	void eth_estimateGas(ResponseHandler handler);
+	void eth_call(const std::string& from, const std::string& to, const std::string& data, ResponseHandler handler);
+	void eth_sendRawTransaction(const std::string& data, ResponseHandler handler);
+
+	void eth_getBalance(std::function<void(const TW::uint256_t&)> handler);
+	void eth_getTransactionByHash(const std::string& tx_hash, bool logged, ResponseHandler handler);
+	void eth_getTransactionReceipt(const std::string& tx_hash, bool logged, ResponseHandler handler);
+	void eth_getBlockByNumber(const TW::uint256_t& number, bool full_tx_data, bool logged, ResponseHandler handler);
 
 	void schedule_for_10x1min();
 	void schedule_for_compound_time();
 
+	void schedule_warm_up();
+	void schedule_clock_sync();
+	std::chrono::milliseconds current_delta();
 	void log_schedule();
 
-	BinaCPP* rest_;
+	boost::asio::io_service& io_;
+	boost::asio::io_service::strand strand_;  // all handlers of this bot run here
+	AsioCURL* http_;  // fire path only
+	AsyncURL* async_;  // all other RPC traffic
+	Broadcaster* broadcaster_;  // sends over http_ to every "send_urls" endpoint
+	ClockSync* clock_sync_;
+	DeltaTuner* delta_tuner_;  // only with "auto_delta"
+	CompetitorStats* competitors_;  // only with "competitor_stats", sets the floor of ladder_
+	std::shared_ptr<WsClient> ws_;  // newHeads and vault logs, only with "ws_url"; stopped by ~Bot
+	MempoolWatcher* mempool_;  // only with "mempool_ws" or "mempool_poll_msec"
+	TxLadder* ladder_;  // signed transactions for the next shot, "gas_ladder" or just "gas_price"
+	NonceManagers* nonce_managers_;  // shared by the bots, one per address
+	NonceManager* nonces_;  // of sender(), in nonce_managers_
+	std::size_t nonce_holder_;  // ours in nonces_
 	DB* db_;
+	LatencyStats* stats_;
+	ChainCache* cache_;  // blocks and receipts of gather_tx, shared by the bots; may be null
+	SignPool* signer_;  // shared by the bots; null signs on the io thread
+	std::size_t sign_key_;  // private_key_ in signer_
+	unsigned prepare_seq_;  // the latest prepare_transaction, older signatures are dropped
+	unsigned signed_seq_;  // the latest prepare_transaction answered by sign_ladder
+	bool ladder_signed_;  // ladder_ holds raws, of ladder_nonce_
+	TW::uint256_t ladder_nonce_;  // of the raws in ladder_ and the requests prepared on broadcaster_; shoot() fires no other
+	std::string latency_file_;  // Prometheus text file, rewritten after every shot
+	LatencyStats::Shot shot_;  // the last one
+	std::string shot_hash_;
+	std::string shot_comment_;  // stored with our row of shot_hash_
+
+	// the shot in flight, for on_fired
+	struct Fired {
+		int n_ {0};  // shot_counter_, 10x1min modes
+		int delta_msec_ {0};
+		TW::uint256_t nonce_;
+		std::size_t rung_ {0};
+	};
+	Fired fired_;
 
 	nlohmann::json config_;
 
@@ -76,28 +198,52 @@ private:
 	std::string url_;
 	int chain_id_;
 
-	TW::uint256_t nonce_;
 	TW::uint256_t gas_price_;
 	TW::uint256_t gas_limit_;
 
 	TW::uint256_t nearest_compounding_time_;
+	int shot_counter_;  // 10x1min modes
 
-	std::string prepared_tx_;
 	std::string last_tx_hash_;
 
+	// sent, waiting to be mined before gather_tx; used with ws_ only
+	std::string pending_tx_hash_;
+	int pending_delta_msec_;
+	TW::uint256_t pending_block_;  // 0 until the receipt is seen
+	bool cooling_down_;  // nearestCompoundingTime not moved yet after a shot
+	bool shot_armed_;  // main_timer_ waits for timer_cb, compound mode
+
+	// competitors seen in the mempool, "mempool_outbid" only
+	bool mempool_outbid_;
+	TW::uint256_t outbid_price_;  // highest gas price seen before the next shot
+	std::vector<std::string> replacement_raws_;  // every rung of the shot in flight, until gather_tx
+	std::size_t replacement_rung_;
+	TW::uint256_t replacement_nonce_;
+
 	std::string contract_hex_;
 	TW::Data contract_;
 
 	std::string wallet_hex_;
 	TW::Data wallet_;
 
-	TW::PrivateKey* private_key_;
+	TW::PrivateKey* private_key_;  // null with signer_, which keeps the only copy
+	std::vector<ExtraWallet*> extra_wallets_;
 
 	TW::Ethereum::ABI::Function *approve_func_;
 	TW::Ethereum::ABI::Function *compound_func_;
 	TW::Ethereum::ABI::Function *nearestCompoundingTime_func_;
+	TW::Ethereum::ABI::Function *prepared_func_;  // of the signed ladder
 
-	boost::asio::deadline_timer main_timer_;
+	PreciseTimer main_timer_;
 	boost::asio::deadline_timer gather_tx_timer_;
-	boost::posix_time::milliseconds delta_msec_;
+	boost::asio::system_timer warm_up_timer_;
+	boost::asio::system_timer clock_sync_timer_;
+	boost::asio::system_timer mempool_timer_;
+	std::chrono::milliseconds delta_msec_;
+	std::chrono::milliseconds fire_delta_msec_;  // delta of the currently scheduled shot
+	std::chrono::seconds warm_up_sec_;
+	std::chrono::milliseconds clock_sync_msec_;
+	std::chrono::milliseconds mempool_poll_msec_;
+	std::chrono::milliseconds mempool_fire_early_msec_;  // a competitor seen this close to our shot fires it at once
+	std::chrono::seconds nonce_stuck_sec_;
 };
@@ -0,0 +1,333 @@
+#include "Broadcaster.h"
+#include "Bot.h"
+#include "RawSender.h"
+#include "binacpp/AsioCURL.h"
+
+#include <easylogging++.h>
+#include <algorithm>
+
+const double LATENCY_EWMA_ALPHA = 0.3;
+const int DROP_MIN_SAMPLES = 5;
+const double DROP_LATENCY_FACTOR = 3.0;
+const int DROP_MAX_FAILURES = 3;
+const std::chrono::minutes DROP_COOLDOWN(10);
+
+struct Broadcaster::Round
+{
+	ResponseHandler handler_;
+	std::chrono::steady_clock::time_point start_;
+	std::size_t pending_ {0};
+	bool done_ {false};
+	nlohmann::json last_error_;
+};
+
+struct Broadcaster::Prepared
+{
+	std::vector<std::string> requests_;
+	std::size_t endpoint_count_ {0};
+	std::vector<std::unique_ptr<AsioCURL::Request>> http_;  // [request * endpoint_count_ + endpoint]
+	std::vector<std::string> raw_;  // the same, built for RawSender; empty without one
+	Round round_;  // of the last fire()
+
+	bool busy() const
+	{
+		if (round_.pending_ > 0)
+			return true;
+		for (auto& req : http_) {
+			if (req->in_flight_)
+				return true;
+		}
+		return false;
+	}
+};
+
+Broadcaster::Broadcaster(AsioCURL* http, boost::asio::io_service::strand& strand, const std::vector<std::string>& headers)
+: http_(http)
+, strand_(strand)
+, headers_(headers)
+{
+}
+
+Broadcaster::~Broadcaster()
+{
+}
+
+void Broadcaster::add_endpoint(const std::string& url)
+{
+	Endpoint ep;
+	ep.url_ = url;
+	endpoints_.push_back(ep);
+}
+
+void Broadcaster::enable_raw(int busy_poll_usec)
+{
+	for (std::size_t i = raw_.size(); i < endpoints_.size(); ++i) {
+		raw_.emplace_back(new RawSender(strand_, endpoints_[i].url_, busy_poll_usec, [this, i](HttpResponse& response) {
+			auto round = raw_rounds_[i];
+			raw_rounds_[i] = nullptr;
+			if (round)
+				on_response(*round, i, response);
+		}));
+		raw_rounds_.push_back(nullptr);
+		raw_.back()->start();
+	}
+}
+
+bool Broadcaster::is_known_error(const nlohmann::json& response)
+{
+	if (!response.contains("error") || !response["error"].contains("message") || !response["error"]["message"].is_string())
+		return false;
+	std::string message = response["error"]["message"];
+	std::transform(message.begin(), message.end(), message.begin(), ::tolower);
+	return message.find("known") != std::string::npos || message.find("already exists") != std::string::npos;
+}
+
+void Broadcaster::broadcast(const std::string& request, ResponseHandler handler)
+{
+	auto round = std::make_shared<Round>();
+	round->handler_ = handler;
+	round->start_ = std::chrono::steady_clock::now();
+
+	for (std::size_t i = 0; i < endpoints_.size(); ++i) {
+		if (!endpoints_[i].enabled_)
+			continue;
+		++round->pending_;
+		http_->request(endpoints_[i].url_, headers_, request, "POST", on_strand(strand_, [this, round, i](HttpResponse& response) {
+			on_response(*round, i, response);
+		}));
+	}
+
+	if (round->pending_ == 0) {
+		auto error = Bot::make_json_rpc_error("no enabled endpoints");
+		handler(error);
+	}
+}
+
+void Broadcaster::prepare(const std::vector<std::string>& requests, ResponseHandler handler)
+{
+	// a shot of the previous ladder may still be out, its handles live until it is answered
+	if (prepared_ && prepared_->busy())
+		retired_.push_back(std::move(prepared_));
+	retired_.erase(std::remove_if(retired_.begin(), retired_.end(), [](const std::unique_ptr<Prepared>& p) {
+		return !p->busy();
+	}), retired_.end());
+
+	prepared_.reset(new Prepared);
+	auto p = prepared_.get();
+	p->requests_ = requests;
+	p->endpoint_count_ = endpoints_.size();
+	p->round_.handler_ = handler;
+	for (auto& request : requests) {
+		for (std::size_t i = 0; i < endpoints_.size(); ++i) {
+			p->http_.push_back(http_->prepare(endpoints_[i].url_, headers_, request, on_strand(strand_, [this, p, i](HttpResponse& response) {
+				on_response(p->round_, i, response);
+			})));
+			p->raw_.push_back(i < raw_.size() ? raw_[i]->build(headers_, request) : std::string());
+		}
+	}
+}
+
+bool Broadcaster::fire(std::size_t index)
+{
+	if (!prepared_ || index >= prepared_->requests_.size())
+		return false;
+
+	auto& p = *prepared_;
+	auto& round = p.round_;
+	if (round.pending_ > 0) {
+		// the last shot of this ladder is not answered yet
+		LOG(ERROR) << "fire: previous shot still pending, sending a fresh request";
+		broadcast(p.requests_[index], round.handler_);
+		return true;
+	}
+
+	round.start_ = std::chrono::steady_clock::now();
+	round.done_ = false;
+	for (std::size_t i = 0; i < p.endpoint_count_; ++i) {
+		if (!endpoints_[i].enabled_)
+			continue;
+		auto k = index * p.endpoint_count_ + i;
+		if (!p.raw_[k].empty() && raw_[i]->ready()) {
+			raw_rounds_[i] = &round;
+			if (raw_[i]->send(p.raw_[k])) {
+				++round.pending_;
+				continue;
+			}
+			raw_rounds_[i] = nullptr;
+		}
+		if (http_->send(p.http_[k].get()))
+			++round.pending_;
+	}
+
+	if (round.pending_ == 0) {
+		auto error = Bot::make_json_rpc_error("no enabled endpoints");
+		round.handler_(error);
+	}
+	return true;
+}
+
+void Broadcaster::warm_up(const std::string& request)
+{
+	for (std::size_t i = 0; i < endpoints_.size(); ++i) {
+		if (!endpoints_[i].enabled_)
+			continue;
+		http_->request(endpoints_[i].url_, headers_, request, "POST", on_strand(strand_, [this, i](HttpResponse& response) {
+			auto& ep = endpoints_[i];
+			if (!response.error.empty()) {
+				LOG(ERROR) << "warm_up: " << ep.url_ << " failed: " << response.error;
+				return;
+			}
+			if (response.new_connects > 0) {
+				ep.handshake_usec_ = std::max(response.connect_usec, response.appconnect_usec);
+				LOG(DEBUG) << "warm_up: " << ep.url_ << " connected, dns " << response.namelookup_usec
+					<< " us, tcp " << response.connect_usec << " us, tls " << response.appconnect_usec << " us";
+			}
+			else {
+				LOG(DEBUG) << "warm_up: " << ep.url_ << " connection reused, total " << response.total_usec << " us";
+			}
+		}));
+	}
+}
+
+void Broadcaster::on_response(Round& round, std::size_t index, HttpResponse& response)
+{
+	auto& ep = endpoints_[index];
+	double msec = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - round.start_).count();
+	--round.pending_;
+
+	if (response.new_connects == 0)
+		LOG(DEBUG) << "broadcast: " << ep.url_ << " sent on a warm connection, connect time saved " << ep.handshake_usec_ << " us";
+	else
+		LOG(DEBUG) << "broadcast: " << ep.url_ << " had to connect: " << std::max(response.connect_usec, response.appconnect_usec) << " us";
+
+	const auto& error = response.error;
+	const auto http_code = response.http_code;
+	nlohmann::json result;
+	bool transport_ok = error.empty() && http_code < 400;
+	std::chrono::steady_clock::time_point parsed;
+	if (transport_ok) {
+		try {
+			result = Bot::parse_json(response.data);
+			parsed = std::chrono::steady_clock::now();
+		}
+		catch (std::exception& e) {
+			result = Bot::make_json_rpc_error(e.what());
+			transport_ok = false;
+		}
+	}
+	else {
+		result = Bot::make_json_rpc_error(error.empty() ? "HTTP " + std::to_string(http_code) : error);
+	}
+
+	if (transport_ok) {
+		ep.failures_ = 0;
+		update_latency(ep, msec);
+	}
+	else {
+		++ep.failures_;
+	}
+
+	if (result.contains("result") && result["result"].is_string()) {
+		if (!round.done_) {
+			round.done_ = true;
+			++ep.wins_;
+			LOG(DEBUG) << "broadcast: first success from " << ep.url_ << " in " << msec << " ms";
+			last_timings_.start_ = round.start_;
+			last_timings_.on_wire_ = round.start_ + std::chrono::microseconds(response.pretransfer_usec);
+			last_timings_.first_byte_ = round.start_ + std::chrono::microseconds(response.starttransfer_usec);
+			last_timings_.parsed_ = parsed;
+			round.handler_(result);
+		}
+		else {
+			LOG(DEBUG) << "broadcast: duplicate-known from " << ep.url_ << " in " << msec << " ms";
+		}
+	}
+	else if (is_known_error(result)) {
+		LOG(DEBUG) << "broadcast: duplicate-known from " << ep.url_ << " in " << msec << " ms: " << Bot::pretty_print(result["error"]);
+	}
+	else {
+		LOG(ERROR) << "broadcast: " << ep.url_ << " failed in " << msec << " ms: " << Bot::pretty_print(result);
+		round.last_error_ = result;
+	}
+
+	if (round.pending_ == 0) {
+		if (!round.done_) {
+			round.done_ = true;
+			if (round.last_error_.is_null())
+				round.last_error_ = Bot::make_json_rpc_error("transaction already known to all endpoints");
+			round.handler_(round.last_error_);
+		}
+		round.last_error_ = nullptr;  // here rather than in fire(): freeing a json object allocates
+		drop_slow();
+	}
+}
+
+void Broadcaster::update_latency(Endpoint& ep, double msec)
+{
+	if (ep.samples_ == 0)
+		ep.latency_msec_ = msec;
+	else
+		ep.latency_msec_ += LATENCY_EWMA_ALPHA * (msec - ep.latency_msec_);
+	++ep.samples_;
+}
+
+void Broadcaster::drop_slow()
+{
+	restore_dropped();
+
+	double best = 0;
+	std::size_t enabled = 0;
+	for (auto& ep : endpoints_) {
+		if (!ep.enabled_)
+			continue;
+		++enabled;
+		if (ep.samples_ >= DROP_MIN_SAMPLES && (best == 0 || ep.latency_msec_ < best))
+			best = ep.latency_msec_;
+	}
+
+	for (auto& ep : endpoints_) {
+		if (enabled <= 1)
+			break;
+		if (!ep.enabled_)
+			continue;
+		bool slow = best > 0 && ep.samples_ >= DROP_MIN_SAMPLES && ep.latency_msec_ > best * DROP_LATENCY_FACTOR;
+		bool failing = ep.failures_ >= DROP_MAX_FAILURES;
+		if (slow || failing) {
+			ep.enabled_ = false;
+			ep.dropped_at_ = std::chrono::steady_clock::now();
+			--enabled;
+			LOG(INFO) << "broadcast: dropping " << ep.url_ << (slow ? " (slow, " : " (failing, ") << ep.latency_msec_ << " ms avg, " << ep.failures_ << " failures)";
+		}
+	}
+	log_stats();
+}
+
+void Broadcaster::restore_dropped()
+{
+	// a transient outage or slow spell must not narrow the set for good
+	bool degraded = true;
+	for (auto& ep : endpoints_) {
+		if (ep.enabled_ && ep.failures_ < DROP_MAX_FAILURES)
+			degraded = false;
+	}
+
+	auto now = std::chrono::steady_clock::now();
+	for (auto& ep : endpoints_) {
+		if (ep.enabled_ || (!degraded && now - ep.dropped_at_ < DROP_COOLDOWN))
+			continue;
+		// measured again from scratch, dropped again if it has not recovered
+		ep.enabled_ = true;
+		ep.failures_ = 0;
+		ep.samples_ = 0;
+		LOG(INFO) << "broadcast: restoring " << ep.url_ << (degraded ? " (the endpoints left are failing)" : " after cool-down");
+	}
+}
+
+void Broadcaster::log_stats() const
+{
+	for (auto& ep : endpoints_) {
+		LOG(DEBUG) << "broadcast: " << ep.url_ << (ep.enabled_ ? "" : " [dropped]")
+			<< " latency " << ep.latency_msec_ << " ms, samples " << ep.samples_
+			<< ", failures " << ep.failures_ << ", wins " << ep.wins_;
+	}
+}
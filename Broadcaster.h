@@ -0,0 +1,92 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <memory>
+#include <functional>
+#include <nlohmann/json.hpp>
+#include <boost/asio.hpp>
+
+class AsioCURL;
+class RawSender;
+struct HttpResponse;
+
+// Sends the same JSON-RPC request to several endpoints at once.
+// The first successful response is handed to the caller, later ones are only logged.
+// Endpoints that are consistently slow or failing are dropped, and taken back
+// after a cool-down, or at once when all the endpoints left are failing.
+class Broadcaster
+{
+public:
+	typedef std::function<void(nlohmann::json&)> ResponseHandler;
+
+	struct Endpoint {
+		std::string url_;
+		double latency_msec_ {0};  // EWMA of successful round trips
+		int samples_ {0};
+		int failures_ {0};  // consecutive
+		int wins_ {0};
+		long long handshake_usec_ {0};  // cost of the last fresh connect (TCP + TLS)
+		bool enabled_ {true};
+		std::chrono::steady_clock::time_point dropped_at_;
+	};
+
+	struct Timings {
+		std::chrono::steady_clock::time_point start_;  // handed to curl
+		std::chrono::steady_clock::time_point on_wire_;
+		std::chrono::steady_clock::time_point first_byte_;
+		std::chrono::steady_clock::time_point parsed_;
+	};
+
+	// responses are handled on the given strand
+	Broadcaster(AsioCURL* http, boost::asio::io_service::strand& strand, const std::vector<std::string>& headers);
+	~Broadcaster();
+
+	void add_endpoint(const std::string& url);
+
+	// fire() writes to a RawSender connection kept open to every endpoint,
+	// curl stays the fallback while one is not connected; after add_endpoint
+	void enable_raw(int busy_poll_usec);
+	const std::vector<Endpoint>& endpoints() const { return endpoints_; }
+
+	// of the response last handed to a broadcast() handler as a success
+	const Timings& last_timings() const { return last_timings_; }
+
+	// handler is called once: with the first success, or with the last error if all endpoints failed
+	void broadcast(const std::string& request, ResponseHandler handler);
+
+	// The fire path: requests (one per ladder rung) get a curl handle for every
+	// endpoint here, when the transaction is signed; fire() hands the handles of
+	// one of them to curl as they are, without serializing or allocating.
+	// handler is called once per fire(), as with broadcast().
+	void prepare(const std::vector<std::string>& requests, ResponseHandler handler);
+	// false if nothing is prepared for index
+	bool fire(std::size_t index);
+
+	// opens (or refreshes) a keep-alive connection to every enabled endpoint
+	void warm_up(const std::string& request);
+
+	void log_stats() const;
+
+private:
+	struct Round;
+	struct Prepared;
+
+	void on_response(Round& round, std::size_t index, HttpResponse& response);
+	void update_latency(Endpoint& ep, double msec);
+	void drop_slow();
+	void restore_dropped();
+
+	static bool is_known_error(const nlohmann::json& response);
+
+	AsioCURL* http_;
+	boost::asio::io_service::strand& strand_;
+	std::vector<std::string> headers_;
+	std::vector<Endpoint> endpoints_;
+	Timings last_timings_;
+	std::vector<std::unique_ptr<RawSender>> raw_;  // by endpoint, empty unless enable_raw
+	std::vector<Round*> raw_rounds_;  // of the request in flight on raw_[i]
+	std::unique_ptr<Prepared> prepared_;
+	std::vector<std::unique_ptr<Prepared>> retired_;  // replaced while their requests were out
+};
@@ -0,0 +1,281 @@
+#include "ChainCache.h"
+
+#include <HexCoding.h>
+
+#include <easylogging++.h>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+const uint64_t CACHE_MAGIC = 0x3165686361436843;  // "ChCache1"
+const uint32_t CACHE_VERSION = 1;
+const std::size_t CACHE_WAYS = 4;
+
+struct ChainCache::Header
+{
+	uint64_t magic_;
+	uint32_t version_;
+	uint32_t max_block_txs_;
+	uint64_t block_sets_;
+	uint64_t receipt_sets_;
+	uint64_t clock_;  // advances on every use, for LRU
+};
+
+struct ChainCache::TxEntry
+{
+	uint8_t hash_[32];
+	uint8_t from_[20];
+	uint8_t to_[20];
+	uint64_t gas_;
+	uint64_t gas_price_;
+};
+
+struct ChainCache::BlockEntry
+{
+	uint64_t used_;  // clock of the last use, 0 if empty
+	uint64_t number_;
+	uint64_t timestamp_;
+	uint32_t sig_;
+	uint32_t tx_count_;
+	TxEntry txs_[MAX_BLOCK_TXS];
+};
+
+struct ChainCache::ReceiptEntry
+{
+	uint64_t used_;  // clock of the last use, 0 if empty
+	uint8_t hash_[32];
+	uint64_t gas_used_;
+	int32_t status_;
+	int32_t log_count_;
+};
+
+namespace {
+
+template <std::size_t N>
+void from_hex(const std::string& s, uint8_t (&output)[N])
+{
+	std::memset(output, 0, N);
+	auto data = TW::parse_hex(s);
+	std::memcpy(output, data.data(), std::min(data.size(), N));
+}
+
+template <std::size_t N>
+std::string to_hex(const uint8_t (&input)[N])
+{
+	return "0x" + TW::hex(TW::Data(input, input + N));
+}
+
+uint32_t sig_value(const std::string& sig)
+{
+	uint8_t bytes[4];
+	from_hex(sig, bytes);
+	return (uint32_t)bytes[0] << 24 | (uint32_t)bytes[1] << 16 | (uint32_t)bytes[2] << 8 | bytes[3];
+}
+
+}
+
+ChainCache::ChainCache(const std::string& file, std::size_t block_slots, std::size_t receipt_slots)
+: memory_(nullptr)
+, size_(0)
+, header_(nullptr)
+, blocks_(nullptr)
+, receipts_(nullptr)
+, block_sets_(std::max<std::size_t>((block_slots + CACHE_WAYS - 1) / CACHE_WAYS, 1))
+, receipt_sets_(std::max<std::size_t>((receipt_slots + CACHE_WAYS - 1) / CACHE_WAYS, 1))
+, hits_(0)
+, misses_(0)
+{
+	std::size_t size = sizeof(Header) + block_sets_ * CACHE_WAYS * sizeof(BlockEntry) + receipt_sets_ * CACHE_WAYS * sizeof(ReceiptEntry);
+	if (!map(file, size)) {
+		if (!file.empty())
+			LOG(ERROR) << "ChainCache: " << file << " cannot be mapped, the cache is not persisted";
+		if (!map(std::string(), size))
+			throw std::runtime_error("ChainCache: cannot allocate " + std::to_string(size) + " bytes");
+	}
+
+	header_ = static_cast<Header*>(memory_);
+	blocks_ = reinterpret_cast<BlockEntry*>(header_ + 1);
+	receipts_ = reinterpret_cast<ReceiptEntry*>(blocks_ + block_sets_ * CACHE_WAYS);
+
+	bool valid = header_->magic_ == CACHE_MAGIC && header_->version_ == CACHE_VERSION && header_->max_block_txs_ == MAX_BLOCK_TXS
+		&& header_->block_sets_ == block_sets_ && header_->receipt_sets_ == receipt_sets_;
+	if (!valid) {
+		std::memset(memory_, 0, size_);
+		header_->magic_ = CACHE_MAGIC;
+		header_->version_ = CACHE_VERSION;
+		header_->max_block_txs_ = MAX_BLOCK_TXS;
+		header_->block_sets_ = block_sets_;
+		header_->receipt_sets_ = receipt_sets_;
+		header_->clock_ = 1;
+		LOG(DEBUG) << "ChainCache: " << (file.empty() ? "in memory" : "new " + file) << ", " << size_ << " bytes";
+	}
+	else {
+		LOG(DEBUG) << "ChainCache: reusing " << file << ", clock " << header_->clock_;
+	}
+}
+
+ChainCache::~ChainCache()
+{
+	log_stats();
+	if (memory_)
+		munmap(memory_, size_);
+}
+
+bool ChainCache::map(const std::string& file, std::size_t size)
+{
+	if (file.empty()) {
+		memory_ = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	}
+	else {
+		int fd = open(file.c_str(), O_RDWR | O_CREAT, 0644);
+		if (fd < 0) {
+			LOG(ERROR) << "ChainCache: open " << file << ": " << strerror(errno);
+			return false;
+		}
+		struct stat st;
+		bool ok = fstat(fd, &st) == 0;
+		// a file of another size is from another layout: started over by the header check
+		if (ok && (std::size_t)st.st_size != size)
+			ok = ftruncate(fd, 0) == 0 && ftruncate(fd, size) == 0;
+		if (ok)
+			memory_ = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		else
+			LOG(ERROR) << "ChainCache: resize " << file << ": " << strerror(errno);
+		close(fd);
+		if (!ok)
+			return false;
+	}
+
+	if (memory_ == MAP_FAILED) {
+		LOG(ERROR) << "ChainCache: mmap: " << strerror(errno);
+		memory_ = nullptr;
+		return false;
+	}
+	size_ = size;
+	return true;
+}
+
+ChainCache::BlockEntry* ChainCache::find_block(uint64_t number, uint32_t sig, bool for_write)
+{
+	auto set = blocks_ + number % block_sets_ * CACHE_WAYS;
+	BlockEntry* oldest = set;
+	for (std::size_t i = 0; i < CACHE_WAYS; ++i) {
+		auto entry = set + i;
+		if (entry->used_ != 0 && entry->number_ == number && entry->sig_ == sig)
+			return entry;
+		if (entry->used_ < oldest->used_)
+			oldest = entry;
+	}
+	return for_write ? oldest : nullptr;
+}
+
+ChainCache::ReceiptEntry* ChainCache::find_receipt(const uint8_t* hash, bool for_write)
+{
+	uint64_t key;
+	std::memcpy(&key, hash, sizeof(key));  // hashes are uniform already
+	auto set = receipts_ + key % receipt_sets_ * CACHE_WAYS;
+	ReceiptEntry* oldest = set;
+	for (std::size_t i = 0; i < CACHE_WAYS; ++i) {
+		auto entry = set + i;
+		if (entry->used_ != 0 && std::memcmp(entry->hash_, hash, sizeof(entry->hash_)) == 0)
+			return entry;
+		if (entry->used_ < oldest->used_)
+			oldest = entry;
+	}
+	return for_write ? oldest : nullptr;
+}
+
+bool ChainCache::get_block(uint64_t number, const std::string& sig, Block& block)
+{
+	std::lock_guard<std::mutex> g(mutex_);
+	auto entry = find_block(number, sig_value(sig), false);
+	if (!entry) {
+		++misses_;
+		return false;
+	}
+	++hits_;
+	entry->used_ = ++header_->clock_;
+
+	block.timestamp_ = entry->timestamp_;
+	block.transactions_.clear();
+	for (uint32_t i = 0; i < entry->tx_count_ && i < MAX_BLOCK_TXS; ++i) {
+		auto& e = entry->txs_[i];
+		Tx tx;
+		tx.hash_ = to_hex(e.hash_);
+		tx.from_ = to_hex(e.from_);
+		tx.to_ = to_hex(e.to_);
+		tx.gas_ = e.gas_;
+		tx.gas_price_ = e.gas_price_;
+		block.transactions_.push_back(tx);
+	}
+	return true;
+}
+
+void ChainCache::put_block(uint64_t number, const std::string& sig, const Block& block)
+{
+	if (block.transactions_.size() > MAX_BLOCK_TXS)
+		return;
+
+	std::lock_guard<std::mutex> g(mutex_);
+	auto key = sig_value(sig);
+	auto entry = find_block(number, key, true);
+	entry->used_ = 0;  // a torn write is an empty entry
+	entry->number_ = number;
+	entry->sig_ = key;
+	entry->timestamp_ = block.timestamp_;
+	entry->tx_count_ = block.transactions_.size();
+	for (std::size_t i = 0; i < block.transactions_.size(); ++i) {
+		auto& tx = block.transactions_[i];
+		auto& e = entry->txs_[i];
+		from_hex(tx.hash_, e.hash_);
+		from_hex(tx.from_, e.from_);
+		from_hex(tx.to_, e.to_);
+		e.gas_ = tx.gas_;
+		e.gas_price_ = tx.gas_price_;
+	}
+	entry->used_ = ++header_->clock_;
+}
+
+bool ChainCache::get_receipt(const std::string& hash, Receipt& receipt)
+{
+	uint8_t key[32];
+	from_hex(hash, key);
+
+	std::lock_guard<std::mutex> g(mutex_);
+	auto entry = find_receipt(key, false);
+	if (!entry) {
+		++misses_;
+		return false;
+	}
+	++hits_;
+	entry->used_ = ++header_->clock_;
+	receipt.gas_used_ = entry->gas_used_;
+	receipt.status_ = entry->status_;
+	receipt.log_count_ = entry->log_count_;
+	return true;
+}
+
+void ChainCache::put_receipt(const std::string& hash, const Receipt& receipt)
+{
+	uint8_t key[32];
+	from_hex(hash, key);
+
+	std::lock_guard<std::mutex> g(mutex_);
+	auto entry = find_receipt(key, true);
+	entry->used_ = 0;
+	std::memcpy(entry->hash_, key, sizeof(key));
+	entry->gas_used_ = receipt.gas_used_;
+	entry->status_ = receipt.status_;
+	entry->log_count_ = receipt.log_count_;
+	entry->used_ = ++header_->clock_;
+}
+
+void ChainCache::log_stats() const
+{
+	LOG(DEBUG) << "ChainCache: " << hits_ << " hits, " << misses_ << " misses";
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <cstdint>
+
+// Compact records of the blocks and receipts gather_tx needs, shared by all bots
+// of the process so that a block or receipt is fetched from the node only once.
+// A block record keeps the timestamp and the transactions calling one method
+// (by signature) on any contract; each bot picks those to its own vault.
+// Records live in a memory-mapped file and survive restarts. Both tables are
+// 4-way set associative, the least recently used entry of a set is replaced.
+// Methods are thread-safe.
+class ChainCache
+{
+public:
+	struct Tx {
+		std::string hash_;  // "0x...", lower case as the node reports them
+		std::string from_;
+		std::string to_;
+		uint64_t gas_ {0};
+		uint64_t gas_price_ {0};
+	};
+
+	struct Block {
+		uint64_t timestamp_ {0};
+		std::vector<Tx> transactions_;
+	};
+
+	struct Receipt {
+		uint64_t gas_used_ {0};
+		int status_ {0};
+		int log_count_ {0};
+	};
+
+	// file empty: not persisted; sizes are rounded up to whole sets
+	ChainCache(const std::string& file, std::size_t block_slots = 4096, std::size_t receipt_slots = 65536);
+	~ChainCache();
+
+	// sig is "0x" + 8 hex digits
+	bool get_block(uint64_t number, const std::string& sig, Block& block);
+	void put_block(uint64_t number, const std::string& sig, const Block& block);  // not kept with more than MAX_BLOCK_TXS
+
+	bool get_receipt(const std::string& hash, Receipt& receipt);
+	void put_receipt(const std::string& hash, const Receipt& receipt);
+
+	void log_stats() const;
+
+	static const std::size_t MAX_BLOCK_TXS = 16;
+
+private:
+	struct TxEntry;
+	struct BlockEntry;
+	struct ReceiptEntry;
+	struct Header;
+
+	bool map(const std::string& file, std::size_t size);
+	BlockEntry* find_block(uint64_t number, uint32_t sig, bool for_write);
+	ReceiptEntry* find_receipt(const uint8_t* hash, bool for_write);
+
+	std::mutex mutex_;
+	void* memory_;
+	std::size_t size_;
+	Header* header_;
+	BlockEntry* blocks_;
+	ReceiptEntry* receipts_;
+	std::size_t block_sets_;
+	std::size_t receipt_sets_;
+
+	uint64_t hits_;
+	uint64_t misses_;
+};
@@ -0,0 +1,40 @@
+#include "ClockSync.h"
+
+ClockSync::ClockSync(std::size_t window)
+: window_(window)
+, last_block_(0)
+, offset_(0)
+, rtt_(0)
+{
+}
+
+void ClockSync::add_sample(uint64_t block_number, int64_t block_timestamp, clock::time_point sent, clock::time_point received)
+{
+	// only the first sighting of a block says anything about when it was produced
+	if (block_number <= last_block_)
+		return;
+	bool first = last_block_ == 0;
+	last_block_ = block_number;
+	if (first)
+		return;  // block may be arbitrarily old
+
+	auto rtt = std::chrono::duration_cast<std::chrono::microseconds>(received - sent);
+	auto mid = sent + rtt / 2;
+	auto lag = std::chrono::duration_cast<std::chrono::microseconds>(mid - clock::from_time_t((time_t)block_timestamp));
+
+	samples_.push_back(Sample{lag, rtt});
+	if (samples_.size() > window_)
+		samples_.pop_front();
+	update();
+}
+
+void ClockSync::update()
+{
+	auto best = samples_.begin();
+	for (auto it = samples_.begin(); it != samples_.end(); ++it) {
+		if (it->lag_ < best->lag_)
+			best = it;
+	}
+	offset_ = best->lag_;
+	rtt_ = best->rtt_;
+}
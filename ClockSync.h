@@ -0,0 +1,38 @@
+#pragma once
+
+#include <deque>
+#include <chrono>
+#include <cstdint>
+
+// Estimates the offset between the local clock and chain time.
+// Every first sighting of a new block gives lag = (send + rtt/2) - block.timestamp,
+// which is clock offset + propagation + polling delay. The lower envelope over a
+// sliding window of sightings is taken as the offset.
+class ClockSync
+{
+public:
+	typedef std::chrono::system_clock clock;
+
+	ClockSync(std::size_t window = 64);
+
+	void add_sample(uint64_t block_number, int64_t block_timestamp, clock::time_point sent, clock::time_point received);
+
+	bool ready() const { return !samples_.empty(); }
+	std::chrono::microseconds offset() const { return offset_; }  // local - chain
+	std::chrono::microseconds rtt() const { return rtt_; }  // of the sample that set offset()
+	std::size_t samples() const { return samples_.size(); }
+
+private:
+	struct Sample {
+		std::chrono::microseconds lag_;
+		std::chrono::microseconds rtt_;
+	};
+
+	void update();
+
+	const std::size_t window_;
+	uint64_t last_block_;
+	std::deque<Sample> samples_;
+	std::chrono::microseconds offset_;
+	std::chrono::microseconds rtt_;
+};
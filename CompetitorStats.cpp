@@ -0,0 +1,157 @@
+#include "CompetitorStats.h"
+#include "Transaction.h"
+
+#include <easylogging++.h>
+#include <algorithm>
+#include <map>
+
+namespace {
+
+template <typename T>
+T median(std::vector<T>& values)
+{
+	std::nth_element(values.begin(), values.begin() + values.size() / 2, values.end());
+	return values[values.size() / 2];
+}
+
+}
+
+CompetitorStats::CompetitorStats(std::size_t window)
+: window_(std::max<std::size_t>(window, 1))
+, self_(UINT32_MAX)
+, winning_gas_price_(0)
+, winning_position_(-1)
+{
+}
+
+uint32_t CompetitorStats::intern(const std::string& address)
+{
+	auto it = ids_.find(address);
+	if (it != ids_.end())
+		return it->second;
+	uint32_t id = addresses_.size();
+	ids_.emplace(address, id);
+	addresses_.push_back(address);
+	rounds_.push_back(0);
+	wins_.push_back(0);
+	return id;
+}
+
+void CompetitorStats::load_history(const std::vector<Transaction>& rows, const std::string& wallet)
+{
+	// group rows by bounty, keep the order of the bounties
+	std::map<TW::uint256_t, std::vector<Transaction>> rounds;
+	for (auto& t : rows)
+		rounds[t.timestamp_].push_back(t);
+
+	for (auto& r : rounds)
+		add_round(r.second, wallet);
+	LOG(DEBUG) << "CompetitorStats: " << rounds.size() << " rounds, " << sender_.size() << " transactions, " << addresses_.size() << " senders in history";
+	log_top(5);
+}
+
+void CompetitorStats::add_round(const std::vector<Transaction>& round, const std::string& wallet)
+{
+	if (round.empty())
+		return;
+	self_ = intern(wallet);
+
+	std::vector<const Transaction*> rows;
+	for (auto& t : round)
+		rows.push_back(&t);
+	std::stable_sort(rows.begin(), rows.end(), [](const Transaction* a, const Transaction* b) { return a->index_ < b->index_; });
+
+	const Transaction* winner = nullptr;
+	for (auto t : rows) {
+		if (t->status_ == 1 && t->log_count_ > 0) {
+			winner = t;
+			break;
+		}
+	}
+
+	round_start_.push_back(sender_.size());
+	std::vector<uint32_t> seen;
+	uint16_t position = 0;
+	for (std::size_t i = 0; i < rows.size(); ++i) {
+		auto t = rows[i];
+		position = i > 0 && t->block_number_ == rows[i - 1]->block_number_ ? position + 1 : 0;
+		auto id = intern(t->from_);
+		sender_.push_back(id);
+		gas_price_.push_back((uint64_t)t->gas_price_);
+		position_.push_back(position);
+		won_.push_back(t == winner);
+
+		if (std::find(seen.begin(), seen.end(), id) == seen.end()) {
+			seen.push_back(id);
+			++rounds_[id];
+		}
+		if (t == winner)
+			++wins_[id];
+	}
+	update();
+}
+
+void CompetitorStats::update()
+{
+	auto first = round_start_[round_start_.size() - std::min(window_, round_start_.size())];
+
+	std::vector<uint64_t> prices;
+	std::vector<int> positions;
+	for (auto i = first; i < sender_.size(); ++i) {
+		if (!won_[i])
+			continue;
+		positions.push_back(position_[i]);
+		if (sender_[i] != self_)
+			prices.push_back(gas_price_[i]);
+	}
+	winning_gas_price_ = prices.empty() ? 0 : median(prices);
+	winning_position_ = positions.empty() ? -1 : median(positions);
+}
+
+std::vector<CompetitorStats::Competitor> CompetitorStats::top(std::size_t count) const
+{
+	std::vector<uint32_t> ids;
+	for (uint32_t id = 0; id < addresses_.size(); ++id) {
+		if (id != self_ && rounds_[id] > 0)
+			ids.push_back(id);
+	}
+	std::stable_sort(ids.begin(), ids.end(), [this](uint32_t a, uint32_t b) { return wins_[a] > wins_[b]; });
+	if (ids.size() > count)
+		ids.resize(count);
+
+	std::vector<Competitor> result;
+	if (round_start_.empty())
+		return result;
+	auto first = round_start_[round_start_.size() - std::min(window_, round_start_.size())];
+	for (auto id : ids) {
+		std::vector<uint64_t> prices;
+		std::vector<int> positions;
+		for (auto i = first; i < sender_.size(); ++i) {
+			if (sender_[i] != id)
+				continue;
+			prices.push_back(gas_price_[i]);
+			if (won_[i])
+				positions.push_back(position_[i]);
+		}
+
+		Competitor c;
+		c.address_ = addresses_[id];
+		c.rounds_ = rounds_[id];
+		c.wins_ = wins_[id];
+		if (!prices.empty())
+			c.typical_gas_price_ = median(prices);
+		if (!positions.empty())
+			c.typical_position_ = median(positions);
+		result.push_back(c);
+	}
+	return result;
+}
+
+void CompetitorStats::log_top(std::size_t count) const
+{
+	for (auto& c : top(count)) {
+		LOG(DEBUG) << "CompetitorStats: " << c.address_ << " won " << c.wins_ << "/" << c.rounds_ << " (" << int(c.win_rate() * 100) << "%)"
+			<< ", gas price " << c.typical_gas_price_ << ", position " << c.typical_position_;
+	}
+	LOG(DEBUG) << "CompetitorStats: winners at gas price " << winning_gas_price_ << ", position " << winning_position_;
+}
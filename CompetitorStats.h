@@ -0,0 +1,72 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+struct Transaction;
+
+// Who competes for the bounties and how they win, from the rows of the
+// transaction table: loaded once from history, then one round at a time after
+// gather_tx. Rows are kept as columns of plain arrays, one element per
+// competing transaction; senders are interned to small ids.
+// The winner of a round is the first successful transaction that emitted logs,
+// as in DeltaTuner. The figures used to choose the gas price are recomputed
+// when a round comes in, reading them is O(1).
+class CompetitorStats
+{
+public:
+	struct Competitor {
+		std::string address_;
+		std::size_t rounds_ {0};
+		std::size_t wins_ {0};
+		uint64_t typical_gas_price_ {0};  // median over the window
+		int typical_position_ {-1};  // median position in the block of its wins over the window, -1 without wins
+
+		double win_rate() const { return rounds_ ? double(wins_) / rounds_ : 0; }
+	};
+
+	// window: number of recent rounds the medians are taken over
+	CompetitorStats(std::size_t window = 50);
+
+	// history: rows of many rounds, ours are recognized by the sender address
+	void load_history(const std::vector<Transaction>& rows, const std::string& wallet);
+	void add_round(const std::vector<Transaction>& round, const std::string& wallet);
+
+	std::size_t rounds() const { return round_start_.size(); }
+
+	// median gas price others won with in the window, 0 if they won nothing
+	uint64_t winning_gas_price() const { return winning_gas_price_; }
+	// median position in the block of the winners in the window, -1 if unknown
+	int winning_position() const { return winning_position_; }
+
+	// the count most frequent winners, by wins
+	std::vector<Competitor> top(std::size_t count) const;
+
+	void log_top(std::size_t count) const;
+
+private:
+	uint32_t intern(const std::string& address);
+	void update();
+
+	const std::size_t window_;
+	uint32_t self_;  // id of our wallet
+
+	// columns, one element per transaction
+	std::vector<uint32_t> sender_;
+	std::vector<uint64_t> gas_price_;
+	std::vector<uint16_t> position_;  // among the round's transactions of the same block
+	std::vector<uint8_t> won_;
+
+	std::vector<std::size_t> round_start_;  // first row of each round
+
+	// per sender id
+	std::unordered_map<std::string, uint32_t> ids_;
+	std::vector<std::string> addresses_;
+	std::vector<std::size_t> rounds_;
+	std::vector<std::size_t> wins_;
+
+	uint64_t winning_gas_price_;
+	int winning_position_;
+};
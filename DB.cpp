@@ -3,11 +3,28 @@
 
 #include <easylogging++.h>
 #include <mysql.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
 
-class Transaction;
+const int CONNECT_TIMEOUT_SEC = 5;
+const int READ_WRITE_TIMEOUT_SEC = 10;
+const int MAX_RETRIES = 3;
+const int MAX_RECONNECT_DELAY_MSEC = 60 * 1000;
 
 DB::DB()
-: mysql_(nullptr)
+: batch_size_(50)
+, flush_msec_(1000)
+, queue_size_(10000)
+, spill_file_("transaction.spill.sql")
+, mysql_(nullptr)
+, connected_(false)
+, reconnect_delay_msec_(0)
+, running_(false)
+, dropped_(0)
+, thread_(nullptr)
 {
 	if (mysql_library_init(0, NULL, NULL)) {
 		LOG(ERROR) << "Could not initialize MySQL client library";
@@ -17,42 +34,246 @@ DB::DB()
 
 DB::~DB()
 {
-	bool close_fail = mysql_stmt_close (insert_tx_stmt_);
-	if (close_fail) {
-		LOG(ERROR) << mysql_error(mysql_);
+	if (thread_) {
+		{
+			std::lock_guard<std::mutex> g(mutex_);
+			running_ = false;
+		}
+		cv_.notify_all();
+		thread_->join();
+		delete thread_;
 	}
 	if (mysql_)
 		mysql_close(mysql_);
 	mysql_library_end();
 }
 
+void DB::set_writer_options(std::size_t batch_size, int flush_msec, std::size_t queue_size, const std::string& spill_file)
+{
+	batch_size_ = std::max<std::size_t>(batch_size, 1);
+	flush_msec_ = std::max(flush_msec, 1);
+	queue_size_ = std::max<std::size_t>(queue_size, batch_size_);
+	spill_file_ = spill_file;
+}
+
 void DB::connect(const std::string& host, const std::string& user, const std::string& pass, const std::string& db)
 {
-	const char INSERT_TX_QUERY[] = "insert into transaction "
-		"(`timestamp`, `index`, `from`, `to`, `log_count`, `tx_fee`, `hash`, `block_number`, `gas_limit`, `gas_price`, `gas_used`, `status`, `bot_id`, `delta_msec`) "
-		"values (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)";
+	host_ = host;
+	user_ = user;
+	pass_ = pass;
+	db_ = db;
+
+	{
+		std::lock_guard<std::mutex> g(mysql_mutex_);
+		if (ensure_connected())
+			replay_spill();
+	}
+
+	running_ = true;
+	thread_ = new std::thread(&DB::run, this);
+}
+
+bool DB::ensure_connected()
+{
+	if (connected_)
+		return true;
 
+	if (mysql_)
+		mysql_close(mysql_);
 	mysql_ = mysql_init(nullptr);
-	if (mysql_real_connect(mysql_, host.c_str(), user.c_str(), pass.c_str(), db.c_str(), 0, NULL, 0)) {
+	unsigned int timeout = CONNECT_TIMEOUT_SEC;
+	mysql_options(mysql_, MYSQL_OPT_CONNECT_TIMEOUT, &timeout);
+	timeout = READ_WRITE_TIMEOUT_SEC;
+	mysql_options(mysql_, MYSQL_OPT_READ_TIMEOUT, &timeout);
+	mysql_options(mysql_, MYSQL_OPT_WRITE_TIMEOUT, &timeout);
+
+	if (mysql_real_connect(mysql_, host_.c_str(), user_.c_str(), pass_.c_str(), db_.c_str(), 0, NULL, 0)) {
 		LOG(DEBUG) << "DB connection OK";
+		connected_ = true;
+		reconnect_delay_msec_ = 0;
 	}
 	else {
 		LOG(ERROR) << "Cannot connect to DB: " << mysql_error(mysql_);
-		exit(1);
+		reconnect_delay_msec_ = std::min(MAX_RECONNECT_DELAY_MSEC, std::max(1000, reconnect_delay_msec_ * 2));
 	}
+	return connected_;
+}
 
-	insert_tx_stmt_ = mysql_stmt_init (mysql_);
-	if (NULL == insert_tx_stmt_)
-		exit (EXIT_FAILURE); /* OUT OF MEMORY */
+bool DB::execute(const std::string& query)
+{
+	if (!ensure_connected())
+		return false;
+	if (mysql_real_query(mysql_, query.c_str(), query.size()) == 0)
+		return true;
 
-	bool prepare_fail = mysql_stmt_prepare (insert_tx_stmt_, INSERT_TX_QUERY, strlen(INSERT_TX_QUERY));
-	if (prepare_fail) {
-		LOG(ERROR) << mysql_stmt_error(insert_tx_stmt_);
-		exit(1);
+	unsigned int err = mysql_errno(mysql_);
+	LOG(ERROR) << "DB error " << err << ": " << mysql_error(mysql_);
+	if (err >= 2000)  // client side errors (CR_*): connection lost, server gone...
+		connected_ = false;
+	return false;
+}
+
+void DB::store_tx(const Transaction& tr)
+{
+	{
+		std::lock_guard<std::mutex> g(mutex_);
+		if (queue_.size() >= queue_size_) {
+			++dropped_;
+			LOG(ERROR) << "store_tx: queue full, " << dropped_ << " transactions dropped: " << tr.hash_;
+			return;
+		}
+		queue_.push_back(tr);
+	}
+	cv_.notify_one();
+}
+
+std::string DB::quote(const std::string& s)
+{
+	std::string result = "'";
+	for (char c : s) {
+		switch (c) {
+		case '\0': result += "\\0"; break;
+		case '\n': result += "\\n"; break;
+		case '\r': result += "\\r"; break;
+		case '\x1a': result += "\\Z"; break;
+		case '\'': result += "\\'"; break;
+		case '\\': result += "\\\\"; break;
+		default: result += c;
+		}
+	}
+	return result + "'";
+}
+
+std::string DB::insert_query(const std::vector<Transaction>& batch)
+{
+	// "insert ignore" keeps retries and spill replays idempotent
+	std::ostringstream os;
+	os.precision(17);
+	os << "insert ignore into transaction "
+		"(`timestamp`, `index`, `from`, `to`, `log_count`, `tx_fee`, `hash`, `block_number`, `gas_limit`, `gas_price`, `gas_used`, `status`, `bot_id`, `delta_msec`, `comment`) "
+		"values ";
+	for (std::size_t i = 0; i < batch.size(); ++i) {
+		auto& t = batch[i];
+		if (i > 0)
+			os << ", ";
+		os << "(" << t.timestamp_ << ", " << t.index_ << ", " << quote(t.from_) << ", " << quote(t.to_) << ", "
+			<< t.log_count_ << ", " << t.tx_fee_ << ", " << quote(t.hash_) << ", " << t.block_number_ << ", "
+			<< t.gas_limit_ << ", " << t.gas_price_ << ", " << t.gas_used_ << ", " << t.status_ << ", "
+			<< t.bot_id_ << ", " << t.delta_msec_ << ", " << quote(t.comment_) << ")";
+	}
+	return os.str();
+}
+
+void DB::run()
+{
+	mysql_thread_init();
+	LOG(DEBUG) << "DB writer started";
+
+	std::vector<Transaction> batch;
+	bool stopping = false;
+	while (!stopping) {
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			// wait for the first row, then give the batch flush_msec to fill up
+			cv_.wait(lock, [this] { return !queue_.empty() || !running_; });
+			cv_.wait_for(lock, std::chrono::milliseconds(flush_msec_), [this] { return queue_.size() >= batch_size_ || !running_; });
+			stopping = !running_;
+
+			auto count = std::min(queue_.size(), batch_size_);
+			batch.assign(queue_.begin(), queue_.begin() + count);
+			queue_.erase(queue_.begin(), queue_.begin() + count);
+		}
+		if (!batch.empty())
+			write_batch(batch);
+
+		if (stopping) {
+			// flush the rest, spilling if the database is still away
+			std::unique_lock<std::mutex> lock(mutex_);
+			while (!queue_.empty()) {
+				auto count = std::min(queue_.size(), batch_size_);
+				batch.assign(queue_.begin(), queue_.begin() + count);
+				queue_.erase(queue_.begin(), queue_.begin() + count);
+				lock.unlock();
+				write_batch(batch);
+				lock.lock();
+			}
+		}
 	}
+
+	LOG(DEBUG) << "DB writer finished";
+	mysql_thread_end();
+}
+
+void DB::write_batch(std::vector<Transaction>& batch)
+{
+	auto query = insert_query(batch);
+
+	std::lock_guard<std::mutex> g(mysql_mutex_);
+	bool was_connected = connected_;
+	for (int attempt = 0; attempt < MAX_RETRIES; ++attempt) {
+		if (execute(query)) {
+			// "insert ignore" skips rows whose key is taken, e.g. by another bot's row of the same bounty
+			auto stored = mysql_affected_rows(mysql_);
+			if (stored == batch.size())
+				LOG(DEBUG) << "DB: " << batch.size() << " transactions stored";
+			else
+				LOG(ERROR) << "DB: " << stored << " of " << batch.size() << " transactions stored, the others are duplicates";
+			if (!was_connected)
+				replay_spill();
+			batch.clear();
+			return;
+		}
+		if (connected_)
+			break;  // the query itself failed, retrying won't help
+		if (attempt + 1 < MAX_RETRIES) {
+			// mysql_mutex_ is held, but only the writer thread and startup use it
+			std::this_thread::sleep_for(std::chrono::milliseconds(reconnect_delay_msec_));
+		}
+	}
+
+	spill(query);
+	batch.clear();
+}
+
+void DB::spill(const std::string& query)
+{
+	std::ofstream out(spill_file_, std::ios::app);
+	if (!out) {
+		LOG(ERROR) << "DB: cannot open spill file " << spill_file_ << ", lost: " << query;
+		return;
+	}
+	out << query << ";\n";
+	LOG(ERROR) << "DB: batch spilled to " << spill_file_;
 }
 
-enum DB_insert_params
+void DB::replay_spill()
+{
+	std::ifstream in(spill_file_);
+	if (!in)
+		return;
+
+	std::vector<std::string> failed;
+	std::string line;
+	std::size_t count = 0;
+	while (std::getline(in, line)) {
+		if (line.empty())
+			continue;
+		if (line.back() == ';')
+			line.pop_back();
+		if (execute(line))
+			++count;
+		else
+			failed.push_back(line);
+	}
+	in.close();
+
+	std::remove(spill_file_.c_str());
+	for (auto& q : failed)
+		spill(q);
+	LOG(DEBUG) << "DB: replayed " << count << " spilled batches, " << failed.size() << " failed";
+}
+
+enum DB_select_columns
 {
 	param_timestamp,
 	param_index,
@@ -71,72 +292,48 @@ enum DB_insert_params
 	param_max
 };
 
-void DB::store_tx(const Transaction& tr)
+std::vector<Transaction> DB::load_history(int bot_id, int limit)
 {
-	MYSQL_BIND bind[param_max] = {0};
+	std::lock_guard<std::mutex> g(mysql_mutex_);
+	std::vector<Transaction> result;
 
-	memset(bind, 0, sizeof(bind));
+	std::string query = "select `timestamp`, `index`, `from`, `to`, `log_count`, `tx_fee`, `hash`, `block_number`, "
+		"`gas_limit`, `gas_price`, `gas_used`, `status`, `bot_id`, `delta_msec` from transaction "
+		"where `bot_id` = " + std::to_string(bot_id) + " order by `timestamp` desc, `index` limit " + std::to_string(limit);
 
-	bind[param_timestamp].buffer_type = MYSQL_TYPE_LONG;
-	bind[param_timestamp].buffer = (char*)&tr.timestamp_;
-
-	bind[param_index].buffer_type = MYSQL_TYPE_LONG;
-	bind[param_index].buffer = (char*)&tr.index_;
-
-	unsigned long from_len = tr.from_.size() + 1;
-	bind[param_from].buffer_type = MYSQL_TYPE_STRING;
-	bind[param_from].buffer = (char*)tr.from_.c_str();
-	bind[param_from].buffer_length = from_len;
-	bind[param_from].length = &from_len;
-
-	unsigned long to_len = tr.to_.size() + 1;
-	bind[param_to].buffer_type = MYSQL_TYPE_STRING;
-	bind[param_to].buffer = (char*)tr.to_.c_str();
-	bind[param_to].buffer_length = to_len;
-	bind[param_to].length = &to_len;
-
-	bind[param_log_count].buffer_type = MYSQL_TYPE_LONG;
-	bind[param_log_count].buffer = (char*)&tr.log_count_;
-
-	bind[param_tx_fee].buffer_type = MYSQL_TYPE_DOUBLE;
-	bind[param_tx_fee].buffer = (char*)&tr.tx_fee_;
-
-	unsigned long hash_len = tr.hash_.size() + 1;
-	bind[param_hash].buffer_type = MYSQL_TYPE_STRING;
-	bind[param_hash].buffer = (char*)tr.hash_.c_str();
-	bind[param_hash].buffer_length = hash_len;
-	bind[param_hash].length = &hash_len;
-
-	bind[param_block_number].buffer_type = MYSQL_TYPE_LONGLONG;
-	bind[param_block_number].buffer = (char*)&tr.block_number_;
-
-	bind[param_gas_limit].buffer_type = MYSQL_TYPE_LONGLONG;
-	bind[param_gas_limit].buffer = (char*)&tr.gas_limit_;
-
-	bind[param_gas_price].buffer_type = MYSQL_TYPE_LONGLONG;
-	bind[param_gas_price].buffer = (char*)&tr.gas_price_;
-
-	bind[param_gas_used].buffer_type = MYSQL_TYPE_LONGLONG;
-	bind[param_gas_used].buffer = (char*)&tr.gas_used_;
-
-	bind[param_status].buffer_type = MYSQL_TYPE_LONG;
-	bind[param_status].buffer = (char*)&tr.status_;
-
-	bind[param_bot_id].buffer_type = MYSQL_TYPE_LONG;
-	bind[param_bot_id].buffer = (char*)&tr.bot_id_;
-
-	bind[param_delta_msec].buffer_type = MYSQL_TYPE_LONG;
-	bind[param_delta_msec].buffer = (char*)&tr.delta_msec_;
+	if (!execute(query)) {
+		LOG(ERROR) << "load_history: no history for bot " << bot_id;
+		return result;
+	}
 
-	bool bind_failed = mysql_stmt_bind_param(insert_tx_stmt_, bind);
-	if (bind_failed) {
-		LOG(ERROR) << mysql_stmt_error(insert_tx_stmt_);
-		exit(1);
+	MYSQL_RES* res = mysql_store_result(mysql_);
+	if (!res) {
+		LOG(ERROR) << "load_history: " << mysql_error(mysql_);
+		return result;
 	}
 
-	bool execute_fail = mysql_stmt_execute(insert_tx_stmt_);
-	if (execute_fail) {
-		LOG(ERROR) << mysql_stmt_error(insert_tx_stmt_);
-		exit(1);
+	MYSQL_ROW row;
+	while ((row = mysql_fetch_row(res))) {
+		Transaction t;
+		t.timestamp_ = strtoull(row[param_timestamp], nullptr, 10);
+		t.index_ = atoi(row[param_index]);
+		t.from_ = row[param_from];
+		t.to_ = row[param_to];
+		t.log_count_ = atoi(row[param_log_count]);
+		t.tx_fee_ = atof(row[param_tx_fee]);
+		t.hash_ = row[param_hash];
+		t.block_number_ = strtoull(row[param_block_number], nullptr, 10);
+		t.gas_limit_ = strtoull(row[param_gas_limit], nullptr, 10);
+		t.gas_price_ = strtoull(row[param_gas_price], nullptr, 10);
+		t.gas_used_ = strtoull(row[param_gas_used], nullptr, 10);
+		t.status_ = atoi(row[param_status]);
+		t.bot_id_ = atoi(row[param_bot_id]);
+		t.delta_msec_ = atoi(row[param_delta_msec]);
+		result.push_back(t);
 	}
+	mysql_free_result(res);
+
+	// oldest first
+	std::reverse(result.begin(), result.end());
+	return result;
 }
@@ -1,21 +1,66 @@
 #pragma once
 
 #include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
 
-class Transaction;
+struct Transaction;
 struct MYSQL;
-struct MYSQL_STMT;
 
+// Transactions are written by a background thread: store_tx only queues them.
+// Rows are sent as multi-row INSERTs when batch_size rows are queued or every
+// flush_msec. Lost connections are re-established, batches that cannot be
+// written go to a spill file of SQL statements which is replayed on the next
+// successful connect. Nothing here blocks the caller for long or exits the
+// process.
+// Shared by all bots of the process, methods are thread-safe.
 class DB
 {
 public:
 	DB();
 	~DB();
 
+	void set_writer_options(std::size_t batch_size, int flush_msec, std::size_t queue_size, const std::string& spill_file);
+
 	void connect(const std::string& host, const std::string& user, const std::string& pass, const std::string& db);
 	void store_tx(const Transaction& tr);
+	std::vector<Transaction> load_history(int bot_id, int limit);
+
+	// the statement write_batch sends
+	static std::string insert_query(const std::vector<Transaction>& batch);
 
 private:
+	void run();
+	bool ensure_connected();  // mysql_mutex_ held
+	bool execute(const std::string& query);  // mysql_mutex_ held
+	void write_batch(std::vector<Transaction>& batch);
+	void spill(const std::string& query);
+	void replay_spill();  // mysql_mutex_ held
+
+	static std::string quote(const std::string& s);
+
+	std::string host_;
+	std::string user_;
+	std::string pass_;
+	std::string db_;
+
+	std::size_t batch_size_;
+	int flush_msec_;
+	std::size_t queue_size_;
+	std::string spill_file_;
+
+	std::mutex mysql_mutex_;
 	MYSQL* mysql_;
-	MYSQL_STMT* insert_tx_stmt_;
+	bool connected_;
+	int reconnect_delay_msec_;
+
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	std::deque<Transaction> queue_;  // guarded by mutex_
+	bool running_;
+	std::size_t dropped_;
+	std::thread* thread_;
 };
@@ -0,0 +1,123 @@
+#include "DeltaTuner.h"
+#include "ClockSync.h"
+#include "Transaction.h"
+
+#include <easylogging++.h>
+#include <algorithm>
+#include <map>
+
+const std::size_t MIN_WINS_FOR_MEDIAN = 3;
+
+DeltaTuner::DeltaTuner(int delta_msec, int step_msec, int min_msec, int max_msec)
+: step_msec_(step_msec)
+, min_msec_(min_msec)
+, max_msec_(max_msec)
+, learned_msec_(delta_msec)
+, have_reference_(false)
+, reference_offset_(0)
+{
+	learned_msec_ = clamp(learned_msec_);
+}
+
+int DeltaTuner::clamp(int delta) const
+{
+	return std::max(min_msec_, std::min(max_msec_, delta));
+}
+
+int DeltaTuner::adjust(int delta, Outcome outcome) const
+{
+	switch (outcome) {
+	case outcome_early: return delta + step_msec_;
+	case outcome_late_same_block: return delta - step_msec_ / 2;
+	case outcome_late: return delta - step_msec_;
+	default: return delta;
+	}
+}
+
+const char* DeltaTuner::to_string(Outcome outcome)
+{
+	switch (outcome) {
+	case outcome_unknown: return "unknown";
+	case outcome_won: return "won";
+	case outcome_early: return "early";
+	case outcome_late_same_block: return "late (same block)";
+	case outcome_late: return "late";
+	}
+	return "";
+}
+
+DeltaTuner::Outcome DeltaTuner::classify(const std::vector<Transaction>& round, const Transaction& mine)
+{
+	const Transaction* winner = nullptr;
+	for (auto& t : round) {
+		if (t.status_ == 1 && t.log_count_ > 0 && (!winner || t.index_ < winner->index_))
+			winner = &t;
+	}
+	if (!winner)
+		return outcome_unknown;
+	if (winner->hash_ == mine.hash_)
+		return outcome_won;
+	if (mine.block_number_ < winner->block_number_)
+		return outcome_early;
+	if (mine.block_number_ == winner->block_number_)
+		return outcome_late_same_block;
+	return outcome_late;
+}
+
+void DeltaTuner::load_history(const std::vector<Transaction>& rows, const std::string& wallet)
+{
+	// group rows by bounty, keep the order of the bounties
+	std::map<TW::uint256_t, std::vector<Transaction>> rounds;
+	for (auto& t : rows)
+		rounds[t.timestamp_].push_back(t);
+
+	std::vector<int> winning;
+	int last_delta = learned_msec_;
+	Outcome last_outcome = outcome_unknown;
+	for (auto& r : rounds) {
+		for (auto& t : r.second) {
+			if (t.from_ != wallet)
+				continue;
+			last_outcome = classify(r.second, t);
+			last_delta = t.delta_msec_;
+			if (last_outcome == outcome_won)
+				winning.push_back(t.delta_msec_);
+		}
+	}
+
+	if (winning.size() >= MIN_WINS_FOR_MEDIAN) {
+		std::nth_element(winning.begin(), winning.begin() + winning.size() / 2, winning.end());
+		learned_msec_ = clamp(winning[winning.size() / 2]);
+		LOG(DEBUG) << "DeltaTuner: median of " << winning.size() << " winning deltas: " << learned_msec_ << " ms";
+	}
+	else if (last_outcome != outcome_unknown) {
+		learned_msec_ = clamp(adjust(last_delta, last_outcome));
+		LOG(DEBUG) << "DeltaTuner: last round " << to_string(last_outcome) << " at " << last_delta << " ms, next " << learned_msec_ << " ms";
+	}
+	LOG(DEBUG) << "DeltaTuner: " << rounds.size() << " rounds in history";
+}
+
+DeltaTuner::Outcome DeltaTuner::add_round(const std::vector<Transaction>& round, const std::string& my_hash, int delta_used)
+{
+	auto mine = std::find_if(round.begin(), round.end(), [&my_hash](const Transaction& t) { return t.hash_ == my_hash; });
+	if (mine == round.end())
+		return outcome_unknown;
+
+	auto outcome = classify(round, *mine);
+	// delta_used includes drift correction, the learned value does not
+	learned_msec_ = clamp(learned_msec_ + adjust(delta_used, outcome) - delta_used);
+	LOG(DEBUG) << "DeltaTuner: " << to_string(outcome) << " at " << delta_used << " ms, learned " << learned_msec_ << " ms";
+	return outcome;
+}
+
+int DeltaTuner::delta_msec(const ClockSync& sync)
+{
+	if (!sync.ready())
+		return learned_msec_;
+	if (!have_reference_) {
+		have_reference_ = true;
+		reference_offset_ = sync.offset();
+	}
+	auto drift = std::chrono::duration_cast<std::chrono::milliseconds>(sync.offset() - reference_offset_);
+	return clamp(learned_msec_ + (int)drift.count());
+}
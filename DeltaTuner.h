@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <chrono>
+
+struct Transaction;
+class ClockSync;
+
+// Learns the fire offset (delta_msec) from the outcome of previous bounties.
+// A round is all competing compound transactions of one bounty in index order:
+// the winner is the first successful one that emitted logs.
+// Landing in an earlier block than the winner moves delta later, landing
+// behind it moves delta earlier. Clock drift measured by ClockSync since the
+// first estimate is added on top.
+class DeltaTuner
+{
+public:
+	enum Outcome {
+		outcome_unknown,
+		outcome_won,
+		outcome_early,
+		outcome_late_same_block,
+		outcome_late
+	};
+
+	DeltaTuner(int delta_msec, int step_msec, int min_msec, int max_msec);
+
+	// history: rows of many rounds, ours are recognized by the sender address
+	void load_history(const std::vector<Transaction>& rows, const std::string& wallet);
+	Outcome add_round(const std::vector<Transaction>& round, const std::string& my_hash, int delta_used);
+
+	// learned delta corrected for clock drift
+	int delta_msec(const ClockSync& sync);
+
+	static Outcome classify(const std::vector<Transaction>& round, const Transaction& mine);
+	static const char* to_string(Outcome outcome);
+
+private:
+	int clamp(int delta) const;
+	int adjust(int delta, Outcome outcome) const;
+
+	const int step_msec_;
+	const int min_msec_;
+	const int max_msec_;
+	int learned_msec_;
+	bool have_reference_;
+	std::chrono::microseconds reference_offset_;
+};
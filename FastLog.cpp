@@ -0,0 +1,223 @@
+#include "FastLog.h"
+
+#include <easylogging++.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <ctime>
+
+const std::size_t FAST_LOG_MAX_RINGS = 64;
+const std::chrono::milliseconds FAST_LOG_IDLE(1);
+
+// written by its thread only, read by the writer thread only
+class FastLog::Ring
+{
+public:
+	Ring(std::size_t size)
+	: records_(size)
+	, mask_(size - 1)
+	, head_(0)
+	, tail_(0)
+	{
+	}
+
+	// spare() when full
+	Record* claim()
+	{
+		auto head = head_.load(std::memory_order_relaxed);
+		if (head - tail_.load(std::memory_order_acquire) > mask_)
+			return &spare_;
+		return &records_[head & mask_];
+	}
+
+	void publish(Record* record)
+	{
+		if (record != &spare_)
+			head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	const Record* spare() const { return &spare_; }
+
+	// appends the published records to output
+	std::size_t drain(std::vector<Record>& output)
+	{
+		auto tail = tail_.load(std::memory_order_relaxed);
+		auto head = head_.load(std::memory_order_acquire);
+		for (auto i = tail; i != head; ++i)
+			output.push_back(records_[i & mask_]);
+		tail_.store(head, std::memory_order_release);
+		return head - tail;
+	}
+
+private:
+	std::vector<Record> records_;
+	Record spare_;  // filled and forgotten
+	const std::size_t mask_;
+	alignas(64) std::atomic<std::size_t> head_;
+	alignas(64) std::atomic<std::size_t> tail_;
+};
+
+namespace {
+
+std::atomic<bool> running(false);
+std::size_t ring_size = 0;
+std::mutex rings_mutex;  // attach() and start()/stop()
+std::unique_ptr<FastLog::Ring> rings[FAST_LOG_MAX_RINGS];
+std::atomic<std::size_t> ring_count(0);
+std::atomic<uint64_t> drops(0);
+std::thread writer;
+
+thread_local FastLog::Ring* ring = nullptr;
+
+}
+
+void FastLog::start(std::size_t size)
+{
+	std::lock_guard<std::mutex> g(rings_mutex);
+	if (running)
+		return;
+	ring_size = 1;
+	while (ring_size < size)
+		ring_size *= 2;
+	running = true;
+	writer = std::thread(&FastLog::run);
+}
+
+void FastLog::stop()
+{
+	{
+		std::lock_guard<std::mutex> g(rings_mutex);
+		if (!running)
+			return;
+		running = false;
+	}
+	writer.join();
+	if (drops)
+		LOG(ERROR) << "FastLog: " << drops.load() << " records dropped";
+}
+
+void FastLog::attach()
+{
+	if (ring)
+		return;
+	std::lock_guard<std::mutex> g(rings_mutex);
+	if (!running)
+		return;
+	auto count = ring_count.load();
+	if (count == FAST_LOG_MAX_RINGS) {
+		LOG(ERROR) << "FastLog: no ring for this thread, its records are written at once";
+		return;
+	}
+	rings[count].reset(new Ring(ring_size));
+	ring = rings[count].get();
+	ring_count = count + 1;
+}
+
+uint64_t FastLog::dropped()
+{
+	return drops;
+}
+
+FastLog::Record* FastLog::claim()
+{
+	if (!ring || !running.load(std::memory_order_relaxed))
+		return nullptr;
+	auto record = ring->claim();
+	if (record == ring->spare())
+		drops.fetch_add(1, std::memory_order_relaxed);
+	return record;
+}
+
+void FastLog::publish(Record* record)
+{
+	ring->publish(record);
+}
+
+void FastLog::run()
+{
+	std::vector<Record> records;
+	for (;;) {
+		bool last = !running;  // one more pass after stop()
+		records.clear();
+		auto count = ring_count.load();
+		for (std::size_t i = 0; i < count; ++i)
+			rings[i]->drain(records);
+
+		// threads are merged in time order
+		std::stable_sort(records.begin(), records.end(), [](const Record& a, const Record& b) { return a.time_ < b.time_; });
+		for (auto& record : records)
+			emit((Level)record.level_, format(record));
+
+		if (last)
+			break;
+		if (records.empty())
+			std::this_thread::sleep_for(FAST_LOG_IDLE);
+	}
+}
+
+std::string FastLog::format(const Record& record)
+{
+	// the time of the call, the logger's own is that of this thread
+	std::string output = time_string(record.time_) + " | ";
+	const char* format = record.format_;
+	for (std::size_t i = 0; i < record.argc_; ++i) {
+		const char* next = std::strstr(format, "{}");
+		if (!next)
+			break;
+		output.append(format, next);
+		format = next + 2;
+
+		auto& v = record.values_[i];
+		switch (record.types_[i]) {
+		case Int:
+			output += std::to_string(v.i_);
+			break;
+		case UInt:
+			output += std::to_string(v.u_);
+			break;
+		case Double: {
+			std::ostringstream s;
+			s << v.d_;
+			output += s.str();
+			break;
+		}
+		case Text:
+			output.append(record.text_ + v.text_.offset_, v.text_.length_);
+			break;
+		case Time:
+			output += time_string(clock::time_point(clock::duration(v.time_)));
+			break;
+		}
+	}
+	output += format;
+	return output;
+}
+
+std::string FastLog::time_string(clock::time_point tp)
+{
+	auto usec = std::chrono::duration_cast<std::chrono::microseconds>(tp.time_since_epoch()).count();
+	std::time_t sec = usec / 1000000;
+	std::tm tm;
+	gmtime_r(&sec, &tm);
+	char buffer[32];
+	std::size_t length = std::strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &tm);
+	std::snprintf(buffer + length, sizeof(buffer) - length, ".%06d", (int)(usec % 1000000));
+	return buffer;
+}
+
+void FastLog::emit(Level level, const std::string& message)
+{
+	switch (level) {
+	case Debug:
+		LOG(DEBUG) << message;
+		break;
+	case Info:
+		LOG(INFO) << message;
+		break;
+	case Error:
+		LOG(ERROR) << message;
+		break;
+	}
+}
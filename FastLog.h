@@ -0,0 +1,163 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <algorithm>
+#include <sstream>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+// Logging for the fire path. FAST_LOG(Debug, "nonce {} at {}", n, t) fills a
+// fixed-size binary record in a single-producer ring of the calling thread;
+// a background thread formats the records and hands them to easylogging++.
+// Writing a record neither allocates nor does I/O; with a full ring the record
+// is dropped and counted. Strings are copied into the record and cut at
+// TEXT_SIZE bytes in all. Until start(), and on threads without attach(),
+// records are formatted and logged at once, whole.
+// Calls below FAST_LOG_MIN_LEVEL are not compiled in: Info in release builds.
+class FastLog
+{
+public:
+	enum Level { Debug, Info, Error };
+
+	typedef std::chrono::system_clock clock;
+
+	static const std::size_t MAX_ARGS = 6;
+	static const std::size_t TEXT_SIZE = 184;
+
+	// ring_size records per attached thread, rounded up to a power of 2
+	static void start(std::size_t ring_size = 4096);
+	static void stop();  // what is in the rings is written first
+
+	// a ring for the calling thread, before it logs; to be called once per thread
+	static void attach();
+
+	static uint64_t dropped();
+
+	class Ring;  // of one thread, in FastLog.cpp
+
+	template <typename... Args>
+	static void write(Level level, const char* format, const Args&... args)
+	{
+		static_assert(sizeof...(Args) <= MAX_ARGS, "FastLog: too many arguments");
+		Record* record = claim();
+		if (!record) {
+			std::string message;
+			format_now(message, format, args...);
+			emit(level, message);
+			return;
+		}
+		record->time_ = clock::now();
+		record->format_ = format;
+		record->level_ = level;
+		record->argc_ = 0;
+		record->text_length_ = 0;
+		(record->add(args), ...);
+		publish(record);
+	}
+
+private:
+	enum Type : uint8_t { Int, UInt, Double, Text, Time };
+
+	struct Record {
+		clock::time_point time_;
+		const char* format_;  // a literal, only the pointer is kept
+		uint8_t level_;
+		uint8_t argc_;
+		uint8_t text_length_;
+		Type types_[MAX_ARGS];
+		union {
+			int64_t i_;
+			uint64_t u_;
+			double d_;
+			struct { uint8_t offset_; uint8_t length_; } text_;
+			clock::rep time_;
+		} values_[MAX_ARGS];
+		char text_[TEXT_SIZE];
+
+		template <typename T>
+		void add(const T& val)
+		{
+			auto& v = values_[argc_];
+			if constexpr (std::is_floating_point<T>::value) {
+				types_[argc_] = Double;
+				v.d_ = val;
+			}
+			else if constexpr (std::is_integral<T>::value && std::is_signed<T>::value) {
+				types_[argc_] = Int;
+				v.i_ = val;
+			}
+			else if constexpr (std::is_integral<T>::value || std::is_enum<T>::value) {
+				types_[argc_] = UInt;
+				v.u_ = (uint64_t)val;
+			}
+			else if constexpr (std::is_same<T, clock::time_point>::value) {
+				types_[argc_] = Time;
+				v.time_ = val.time_since_epoch().count();
+			}
+			else {
+				add_text(std::string_view(val));
+			}
+			++argc_;
+		}
+
+		void add_text(std::string_view s)
+		{
+			auto length = std::min(s.size(), TEXT_SIZE - text_length_);
+			std::memcpy(text_ + text_length_, s.data(), length);
+			types_[argc_] = Text;
+			values_[argc_].text_.offset_ = text_length_;
+			values_[argc_].text_.length_ = length;
+			text_length_ += length;
+		}
+	};
+
+	static Record* claim();  // null when not started or not attached
+	static void publish(Record* record);
+
+	static void run();
+	static std::string format(const Record& record);
+	static std::string time_string(clock::time_point tp);
+	static void emit(Level level, const std::string& message);
+
+	static void format_now(std::string& output, const char* format)
+	{
+		output += format;
+	}
+
+	template <typename T, typename... Rest>
+	static void format_now(std::string& output, const char* format, const T& val, const Rest&... rest)
+	{
+		const char* next = std::strstr(format, "{}");
+		if (!next) {
+			output += format;
+			return;
+		}
+		output.append(format, next);
+		if constexpr (std::is_same<T, clock::time_point>::value) {
+			output += time_string(val);
+		}
+		else {
+			std::ostringstream s;
+			s << val;
+			output += s.str();
+		}
+		format_now(output, next + 2, rest...);
+	}
+};
+
+#ifndef FAST_LOG_MIN_LEVEL
+#ifdef NDEBUG
+#define FAST_LOG_MIN_LEVEL 1
+#else
+#define FAST_LOG_MIN_LEVEL 0
+#endif
+#endif
+
+// level is Debug, Info or Error; format is a literal with a {} per argument
+#define FAST_LOG(level, ...) do { \
+		if constexpr (FastLog::level >= FAST_LOG_MIN_LEVEL) \
+			FastLog::write(FastLog::level, __VA_ARGS__); \
+	} while (false)
@@ -0,0 +1,92 @@
+#include "HexCodec.h"
+
+#include <cstdint>
+
+namespace {
+
+const int8_t INVALID = -1;
+
+struct DigitTable {
+	int8_t values_[256];
+
+	DigitTable()
+	{
+		for (auto& v : values_)
+			v = INVALID;
+		for (int c = '0'; c <= '9'; ++c)
+			values_[c] = c - '0';
+		for (int c = 'a'; c <= 'f'; ++c)
+			values_[c] = c - 'a' + 10;
+		for (int c = 'A'; c <= 'F'; ++c)
+			values_[c] = c - 'A' + 10;
+	}
+};
+
+const DigitTable digits;
+const char HEX_DIGITS[] = "0123456789abcdef";
+
+}
+
+bool HexCodec::parse(std::string_view s, TW::uint256_t& output)
+{
+	if (s.size() >= 2 && s[0] == '0' && (s[1] == 'x' || s[1] == 'X'))
+		s.remove_prefix(2);
+	if (s.empty())
+		return false;
+	while (s.size() > 1 && s[0] == '0')
+		s.remove_prefix(1);
+	if (s.size() > 64)
+		return false;
+
+	// least significant limb first, 16 digits per limb
+	uint64_t limbs[4] = {0, 0, 0, 0};
+	std::size_t pos = 0;
+	for (auto it = s.rbegin(); it != s.rend(); ++it, ++pos) {
+		auto v = digits.values_[(unsigned char)*it];
+		if (v == INVALID)
+			return false;
+		limbs[pos / 16] |= (uint64_t)v << (pos % 16 * 4);
+	}
+
+	if (s.size() <= 16) {
+		output = limbs[0];
+		return true;
+	}
+	output = 0;
+	boost::multiprecision::import_bits(output, limbs, limbs + (s.size() + 15) / 16, 64, false);
+	return true;
+}
+
+std::size_t HexCodec::format(const TW::uint256_t& val, char* output)
+{
+	output[0] = '0';
+	output[1] = 'x';
+	if (val == 0) {
+		output[2] = '0';
+		return 3;
+	}
+
+	uint64_t limbs[4] = {0, 0, 0, 0};
+	auto end = boost::multiprecision::export_bits(val, limbs, 64, false);
+	std::size_t count = end - limbs;
+
+	// digits of the top limb without leading zeros, full 16 for the rest
+	std::size_t len = 2;
+	uint64_t top = limbs[count - 1];
+	int shift = 60;
+	while ((top >> shift) == 0)
+		shift -= 4;
+	for (; shift >= 0; shift -= 4)
+		output[len++] = HEX_DIGITS[(top >> shift) & 0xf];
+	for (std::size_t i = count - 1; i-- > 0;) {
+		for (shift = 60; shift >= 0; shift -= 4)
+			output[len++] = HEX_DIGITS[(limbs[i] >> shift) & 0xf];
+	}
+	return len;
+}
+
+std::string HexCodec::to_hex(const TW::uint256_t& val)
+{
+	char buffer[MAX_CHARS];
+	return std::string(buffer, format(val, buffer));
+}
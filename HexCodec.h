@@ -0,0 +1,22 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+#include <uint256.h>
+
+// JSON-RPC quantities ("0x1b4", no leading zeros) to and from uint256.
+// Digits are mapped by table straight into the 64-bit limbs, nothing is
+// copied or allocated on the way; only to_hex returns a new string.
+class HexCodec
+{
+public:
+	// "0x" prefix optional, upper or lower case; false on an empty, non-hex or over 64 digit quantity
+	static bool parse(std::string_view s, TW::uint256_t& output);
+
+	// "0x" and at least one digit, at most MAX_CHARS characters, not terminated; returns the length
+	static const std::size_t MAX_CHARS = 66;
+	static std::size_t format(const TW::uint256_t& val, char* output);
+
+	static std::string to_hex(const TW::uint256_t& val);
+};
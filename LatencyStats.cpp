@@ -0,0 +1,138 @@
+#include "LatencyStats.h"
+
+#include <easylogging++.h>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+
+LatencyHistogram::LatencyHistogram()
+: count_(0)
+, sum_(0)
+, max_(0)
+{
+	for (auto& b : buckets_)
+		b.store(0, std::memory_order_relaxed);
+}
+
+int LatencyHistogram::bucket(uint64_t value)
+{
+	if (value < SUB_BUCKETS)
+		return (int)value;
+	int magnitude = 63 - __builtin_clzll(value) - SUB_BITS + 1;  // value >> magnitude is in [SUB_BUCKETS/2, SUB_BUCKETS)
+	int index = magnitude * SUB_BUCKETS / 2 + (int)(value >> magnitude);
+	return std::min(index, BUCKETS - 1);
+}
+
+uint64_t LatencyHistogram::upper_bound(int bucket)
+{
+	if (bucket < SUB_BUCKETS)
+		return bucket;
+	int magnitude = (bucket - SUB_BUCKETS / 2) / (SUB_BUCKETS / 2);
+	uint64_t sub = bucket - magnitude * SUB_BUCKETS / 2;
+	return ((sub + 1) << magnitude) - 1;
+}
+
+void LatencyHistogram::record(uint64_t usec)
+{
+	buckets_[bucket(usec)].fetch_add(1, std::memory_order_relaxed);
+	count_.fetch_add(1, std::memory_order_relaxed);
+	sum_.fetch_add(usec, std::memory_order_relaxed);
+	auto prev = max_.load(std::memory_order_relaxed);
+	while (usec > prev && !max_.compare_exchange_weak(prev, usec, std::memory_order_relaxed))
+		;
+}
+
+uint64_t LatencyHistogram::quantile(double q) const
+{
+	auto total = count();
+	if (total == 0)
+		return 0;
+	uint64_t rank = (uint64_t)(q * (total - 1)) + 1;
+	uint64_t seen = 0;
+	for (int i = 0; i < BUCKETS; ++i) {
+		seen += buckets_[i].load(std::memory_order_relaxed);
+		if (seen >= rank)
+			return std::min(upper_bound(i), max());
+	}
+	return max();
+}
+
+const char* LatencyStats::to_string(Stage stage)
+{
+	switch (stage) {
+	case stage_entered: return "entered";
+	case stage_serialized: return "serialized";
+	case stage_on_wire: return "on_wire";
+	case stage_first_byte: return "first_byte";
+	case stage_parsed: return "parsed";
+	case stage_max: break;
+	}
+	return "";
+}
+
+void LatencyStats::register_bot(int bot_id)
+{
+	auto& stages = bots_[bot_id];
+	if (!stages)
+		stages.reset(new Stages);
+}
+
+void LatencyStats::add_shot(int bot_id, const Shot& shot)
+{
+	auto it = bots_.find(bot_id);
+	if (it == bots_.end())
+		return;
+	for (int i = 0; i < stage_max; ++i) {
+		if (shot.stages_[i] == clock::time_point())
+			continue;  // not reached, e.g. all endpoints failed
+		auto usec = std::chrono::duration_cast<std::chrono::microseconds>(shot.stages_[i] - shot.due_).count();
+		it->second->histograms_[i].record(usec > 0 ? usec : 0);
+	}
+}
+
+std::string LatencyStats::describe(const Shot& shot)
+{
+	static const char* short_names[stage_max] = { "cb", "ser", "wire", "ttfb", "parsed" };
+	std::ostringstream os;
+	os << "fire usec:";
+	for (int i = 0; i < stage_max; ++i) {
+		if (shot.stages_[i] == clock::time_point())
+			continue;
+		os << " " << short_names[i] << " " << std::chrono::duration_cast<std::chrono::microseconds>(shot.stages_[i] - shot.due_).count();
+	}
+	return os.str();
+}
+
+void LatencyStats::write(std::ostream& os) const
+{
+	static const double quantiles[] = { 0.5, 0.9, 0.99, 1.0 };
+
+	os << "# HELP compounding_bot_fire_usec Fire path stage time since the timer was due, microseconds\n";
+	os << "# TYPE compounding_bot_fire_usec summary\n";
+	for (auto& bot : bots_) {
+		for (int i = 0; i < stage_max; ++i) {
+			auto& h = bot.second->histograms_[i];
+			std::string labels = "bot=\"" + std::to_string(bot.first) + "\",stage=\"" + to_string((Stage)i) + "\"";
+			for (auto q : quantiles)
+				os << "compounding_bot_fire_usec{" << labels << ",quantile=\"" << q << "\"} " << h.quantile(q) << "\n";
+			os << "compounding_bot_fire_usec_sum{" << labels << "} " << h.sum() << "\n";
+			os << "compounding_bot_fire_usec_count{" << labels << "} " << h.count() << "\n";
+		}
+	}
+}
+
+void LatencyStats::write(const std::string& file_name) const
+{
+	std::lock_guard<std::mutex> g(file_mutex_);
+	std::string tmp = file_name + ".tmp";
+	{
+		std::ofstream out(tmp);
+		if (!out) {
+			LOG(ERROR) << "LatencyStats: cannot write " << tmp;
+			return;
+		}
+		write(out);
+	}
+	if (std::rename(tmp.c_str(), file_name.c_str()))
+		LOG(ERROR) << "LatencyStats: cannot rename " << tmp << " to " << file_name;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <string>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <ostream>
+
+// Log-linear ("HDR style") histogram of microsecond values: every power of two
+// is split into SUB_BUCKETS linear buckets, so the relative error stays below
+// 1/SUB_BUCKETS at any magnitude. Recording is lock-free.
+class LatencyHistogram
+{
+public:
+	static const int SUB_BITS = 4;
+	static const int SUB_BUCKETS = 1 << SUB_BITS;
+	static const int MAGNITUDES = 40;
+	static const int BUCKETS = MAGNITUDES * SUB_BUCKETS;
+
+	LatencyHistogram();
+
+	void record(uint64_t usec);
+
+	uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+	uint64_t sum() const { return sum_.load(std::memory_order_relaxed); }
+	uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+	uint64_t quantile(double q) const;  // upper bound of the bucket holding q
+
+private:
+	static int bucket(uint64_t value);
+	static uint64_t upper_bound(int bucket);
+
+	std::atomic<uint64_t> buckets_[BUCKETS];
+	std::atomic<uint64_t> count_;
+	std::atomic<uint64_t> sum_;
+	std::atomic<uint64_t> max_;
+};
+
+// Fire path stage timings of every shot, per bot. Each stage is measured on the
+// steady clock from the moment the timer was due. Shared by all bots of the
+// process: bots are registered before the io threads start, recording is lock-free.
+class LatencyStats
+{
+public:
+	typedef std::chrono::steady_clock clock;
+
+	enum Stage {
+		stage_entered,  // timer_cb called
+		stage_serialized,  // JSON-RPC request string ready; unset for prepared requests, serialized before the timer
+		stage_on_wire,  // request sent (curl pretransfer)
+		stage_first_byte,  // first response byte (curl starttransfer)
+		stage_parsed,  // winning response parsed
+		stage_max
+	};
+
+	struct Shot {
+		clock::time_point due_;
+		clock::time_point stages_[stage_max];
+	};
+
+	static const char* to_string(Stage stage);
+
+	void register_bot(int bot_id);
+	void add_shot(int bot_id, const Shot& shot);
+
+	// compact "stage +usec" list, fits the `comment` column of the transaction table
+	static std::string describe(const Shot& shot);
+
+	// Prometheus text format: one summary per bot and stage
+	void write(std::ostream& os) const;
+	// atomically replaces the file, e.g. for the node_exporter textfile collector
+	void write(const std::string& file_name) const;
+
+private:
+	struct Stages {
+		LatencyHistogram histograms_[stage_max];
+	};
+
+	std::map<int, std::unique_ptr<Stages>> bots_;
+	mutable std::mutex file_mutex_;
+};
@@ -0,0 +1,98 @@
+#include "MempoolWatcher.h"
+#include "HexCodec.h"
+
+#include <algorithm>
+
+namespace {
+
+std::string lower(std::string s)
+{
+	std::transform(s.begin(), s.end(), s.begin(), ::tolower);
+	return s;
+}
+
+// 0 if the field is missing
+uint64_t quantity(const nlohmann::json& tx, const char* key)
+{
+	TW::uint256_t output = 0;
+	auto it = tx.find(key);
+	if (it != tx.end() && it->is_string())
+		HexCodec::parse(it->get_ref<const std::string&>(), output);
+	return (uint64_t)output;
+}
+
+}
+
+MempoolWatcher::MempoolWatcher(const std::string& contract, const std::string& sig, const std::vector<std::string>& ours, Handler handler,
+	clock::duration max_age)
+: contract_(lower(contract))
+, sig_(lower(sig))
+, handler_(handler)
+, max_age_(max_age)
+{
+	for (auto& address : ours)
+		ours_.push_back(lower(address));
+}
+
+bool MempoolWatcher::add(const nlohmann::json& tx)
+{
+	if (!tx.is_object() || !tx.contains("to") || !tx["to"].is_string() || !tx.contains("input") || !tx["input"].is_string()
+		|| !tx.contains("hash") || !tx["hash"].is_string() || !tx.contains("from") || !tx["from"].is_string())
+		return false;
+	if (lower(tx["to"]) != contract_ || lower(tx["input"].get_ref<const std::string&>().substr(0, 10)) != sig_)
+		return false;
+
+	auto now = clock::now();
+	auto from = lower(tx["from"]);
+	if (std::find(ours_.begin(), ours_.end(), from) != ours_.end())
+		return true;
+
+	const std::string& hash = tx["hash"];
+	if (seen_.count(hash))
+		return true;
+
+	Seen& seen = seen_[hash];
+	seen.hash_ = hash;
+	seen.from_ = from;
+	seen.nonce_ = quantity(tx, "nonce");
+	// typed transactions may come with the fee cap only
+	seen.gas_price_ = quantity(tx, "gasPrice");
+	if (seen.gas_price_ == 0)
+		seen.gas_price_ = quantity(tx, "maxFeePerGas");
+	seen.first_seen_ = now;
+	handler_(seen);
+
+	if (now >= next_expiry_)
+		expire(now);
+	return true;
+}
+
+void MempoolWatcher::add_txpool(const nlohmann::json& content)
+{
+	// "queued" transactions wait for an earlier nonce, they cannot be mined yet
+	if (!content.is_object() || !content.contains("pending") || !content["pending"].is_object())
+		return;
+	for (auto& sender : content["pending"]) {
+		if (!sender.is_object())
+			continue;
+		for (auto& tx : sender)
+			add(tx);
+	}
+}
+
+const MempoolWatcher::Seen* MempoolWatcher::find(const std::string& hash) const
+{
+	auto it = seen_.find(hash);
+	return it == seen_.end() ? nullptr : &it->second;
+}
+
+void MempoolWatcher::expire(clock::time_point now)
+{
+	for (auto it = seen_.begin(); it != seen_.end(); ) {
+		if (now - it->second.first_seen_ > max_age_)
+			it = seen_.erase(it);
+		else
+			++it;
+	}
+	next_expiry_ = now + max_age_ / 10;
+}
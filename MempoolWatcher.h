@@ -0,0 +1,55 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <chrono>
+#include <functional>
+#include <cstdint>
+#include <nlohmann/json.hpp>
+
+// Picks the competitors' compound calls out of pending transactions, as they
+// come from newPendingTransactions notifications, eth_getTransactionByHash or
+// a txpool_content poll. Every transaction is reported once, with the time it
+// was first seen here; ours (by sender) are left out. Transport is up to the
+// caller, nothing here does I/O. Transactions are forgotten after max_age.
+class MempoolWatcher
+{
+public:
+	typedef std::chrono::system_clock clock;
+
+	struct Seen {
+		std::string hash_;
+		std::string from_;
+		uint64_t nonce_ {0};
+		uint64_t gas_price_ {0};
+		clock::time_point first_seen_;
+	};
+
+	typedef std::function<void(const Seen&)> Handler;
+
+	// contract is "0x..." as the node reports "to", sig is "0x" + 8 hex digits,
+	// ours are senders in the same form
+	MempoolWatcher(const std::string& contract, const std::string& sig, const std::vector<std::string>& ours, Handler handler,
+		clock::duration max_age = std::chrono::minutes(10));
+
+	// one transaction object; false if it is not a compound call
+	bool add(const nlohmann::json& tx);
+	// the result of txpool_content: {"pending": {sender: {nonce: tx}}, "queued": ...}; queued ones are skipped
+	void add_txpool(const nlohmann::json& content);
+
+	// null if the hash was not seen
+	const Seen* find(const std::string& hash) const;
+	std::size_t size() const { return seen_.size(); }
+
+private:
+	void expire(clock::time_point now);
+
+	std::string contract_;
+	std::string sig_;
+	std::vector<std::string> ours_;
+	Handler handler_;
+	const clock::duration max_age_;
+	std::unordered_map<std::string, Seen> seen_;  // by hash
+	clock::time_point next_expiry_;
+};
@@ -0,0 +1,135 @@
+#include "NonceManager.h"
+
+#include <easylogging++.h>
+#include <stdexcept>
+
+NonceManager::NonceManager(clock::duration grace)
+: grace_(grace)
+, next_(0)
+{
+}
+
+std::size_t NonceManager::add_holder(Listener listener)
+{
+	std::lock_guard<std::mutex> g(mutex_);
+	holders_.emplace_back();
+	holders_.back().listener_ = listener;
+	return holders_.size() - 1;
+}
+
+void NonceManager::init(const TW::uint256_t& pending)
+{
+	std::lock_guard<std::mutex> g(mutex_);
+	if (next_ < pending)
+		next_ = pending;
+}
+
+TW::uint256_t NonceManager::next(std::size_t holder)
+{
+	std::lock_guard<std::mutex> g(mutex_);
+	auto& h = holders_.at(holder);
+	h.reserved_ = next_;
+	h.has_reserved_ = true;
+	return h.reserved_;
+}
+
+bool NonceManager::reserved(std::size_t holder, TW::uint256_t& nonce) const
+{
+	std::lock_guard<std::mutex> g(mutex_);
+	auto& h = holders_.at(holder);
+	if (!h.has_reserved_)
+		return false;
+	nonce = h.reserved_;
+	return true;
+}
+
+void NonceManager::sent(std::size_t holder, const TW::uint256_t& nonce, const std::string& hash, const TW::uint256_t& gas_price)
+{
+	std::vector<Listener> taken;
+	{
+		std::lock_guard<std::mutex> g(mutex_);
+		auto& tx = in_flight_[nonce];
+		tx.hash_ = hash;
+		tx.gas_price_ = gas_price;
+		tx.sent_ = clock::now();
+		if (next_ <= nonce)
+			next_ = nonce + 1;
+
+		// the other holders of this nonce sign again with the next one
+		for (std::size_t i = 0; i < holders_.size(); ++i) {
+			auto& h = holders_[i];
+			if (!h.has_reserved_ || h.reserved_ != nonce)
+				continue;
+			if (i == holder) {
+				h.reserved_ = next_;
+				continue;
+			}
+			h.has_reserved_ = false;
+			taken.push_back(h.listener_);
+		}
+	}
+	notify(taken);
+}
+
+void NonceManager::resync(const TW::uint256_t& latest, const TW::uint256_t& pending)
+{
+	std::vector<Listener> moved;
+	{
+		std::lock_guard<std::mutex> g(mutex_);
+		if (latest > 0)
+			in_flight_.erase(in_flight_.begin(), in_flight_.upper_bound(latest - 1));
+
+		// the node may not have seen a fresh send yet, older ones missing from its pool are gone
+		auto now = clock::now();
+		TW::uint256_t expected = std::max(latest, pending);
+		for (auto it = in_flight_.lower_bound(expected); it != in_flight_.end(); ) {
+			if (now - it->second.sent_ < grace_) {
+				expected = it->first + 1;
+				++it;
+			}
+			else {
+				LOG(ERROR) << "NonceManager: nonce " << it->first << " dropped: " << it->second.hash_;
+				it = in_flight_.erase(it);
+			}
+		}
+
+		if (next_ != expected)
+			LOG(ERROR) << "NonceManager: next nonce " << next_ << " -> " << expected << " (latest " << latest << ", pending " << pending << ")";
+		next_ = expected;
+
+		for (auto& h : holders_) {
+			if (h.has_reserved_ && h.reserved_ != expected) {
+				h.has_reserved_ = false;
+				moved.push_back(h.listener_);
+			}
+		}
+	}
+	notify(moved);
+}
+
+bool NonceManager::stuck(clock::duration max_age, TW::uint256_t& nonce, InFlight& tx) const
+{
+	std::lock_guard<std::mutex> g(mutex_);
+	if (in_flight_.empty())
+		return false;
+	auto& oldest = *in_flight_.begin();
+	if (clock::now() - oldest.second.sent_ < max_age)
+		return false;
+	nonce = oldest.first;
+	tx = oldest.second;
+	return true;
+}
+
+std::size_t NonceManager::in_flight() const
+{
+	std::lock_guard<std::mutex> g(mutex_);
+	return in_flight_.size();
+}
+
+void NonceManager::notify(const std::vector<Listener>& listeners)
+{
+	for (auto& listener : listeners) {
+		if (listener)
+			listener();
+	}
+}
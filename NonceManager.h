@@ -0,0 +1,78 @@
+#pragma once
+
+#include <string>
+#include <map>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <functional>
+
+#include <uint256.h>
+
+// Local view of the wallet nonce, so that no RPC is needed to sign the next shot.
+// Sent transactions are tracked by nonce until mined. After send errors, receipts
+// and before every shot the view is corrected against the node's latest (mined)
+// and pending (mined + mempool) transaction counts: nonces the node never got
+// are reused, nonces taken by someone else are skipped. A transaction that stays
+// unmined for too long is reported by stuck() so that it can be replaced.
+// One per address for the whole process: every bot and extra wallet signing with
+// it is a holder. Holders reserve the same next nonce, the first to send it takes
+// it and the listeners of the others are called to sign again. Thread-safe.
+class NonceManager
+{
+public:
+	typedef std::chrono::steady_clock clock;
+	typedef std::function<void()> Listener;
+
+	struct InFlight {
+		std::string hash_;
+		TW::uint256_t gas_price_;
+		clock::time_point sent_;
+	};
+
+	// sent transactions not seen by the node after grace are considered dropped
+	NonceManager(clock::duration grace = std::chrono::seconds(30));
+
+	// listener runs on the thread that took or moved the holder's reserved nonce; it is
+	// called without the lock held, and is expected to post to the holder's strand
+	std::size_t add_holder(Listener listener);
+
+	// the node's pending count at a holder's startup; the highest one is kept
+	void init(const TW::uint256_t& pending);
+
+	// reserves the next nonce for a transaction about to be signed
+	TW::uint256_t next(std::size_t holder);
+	// false if holder has nothing reserved, or its nonce has been taken since
+	bool reserved(std::size_t holder, TW::uint256_t& nonce) const;
+
+	// a reservation of holder at nonce moves to the next one, for the holder to sign
+	// again itself; the other holders of nonce are told to
+	void sent(std::size_t holder, const TW::uint256_t& nonce, const std::string& hash, const TW::uint256_t& gas_price);
+
+	// holders whose reserved nonce is no longer valid are told to sign again
+	void resync(const TW::uint256_t& latest, const TW::uint256_t& pending);
+
+	// lowest unmined nonce, if it was sent more than max_age ago
+	bool stuck(clock::duration max_age, TW::uint256_t& nonce, InFlight& tx) const;
+
+	std::size_t in_flight() const;
+
+private:
+	struct Holder {
+		TW::uint256_t reserved_;
+		bool has_reserved_ {false};
+		Listener listener_;
+	};
+
+	static void notify(const std::vector<Listener>& listeners);
+
+	const clock::duration grace_;
+	mutable std::mutex mutex_;
+	TW::uint256_t next_;  // lowest nonce not sent
+	std::vector<Holder> holders_;
+	std::map<TW::uint256_t, InFlight> in_flight_;
+};
+
+// by lower case "0x" address; built before the io threads start
+typedef std::map<std::string, std::unique_ptr<NonceManager>> NonceManagers;
@@ -0,0 +1,70 @@
+#include "PreciseTimer.h"
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <pthread.h>
+#include <sched.h>
+
+static inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	asm volatile("yield");
+#endif
+}
+
+PreciseTimer::PreciseTimer(boost::asio::io_service::strand& strand)
+: strand_(strand)
+, timer_(strand.context())
+, spin_(300)
+, last_offset_(0)
+{
+}
+
+void PreciseTimer::expires_at(clock::time_point target)
+{
+	target_ = target;
+	timer_.expires_at(target - spin_);
+}
+
+void PreciseTimer::async_wait(Handler handler)
+{
+	timer_.async_wait(strand_.wrap(std::bind(&PreciseTimer::on_coarse, this, handler, std::placeholders::_1)));
+}
+
+void PreciseTimer::cancel()
+{
+	timer_.cancel();
+}
+
+void PreciseTimer::on_coarse(Handler handler, const boost::system::error_code& e)
+{
+	if (!e) {
+		auto now = clock::now();
+		while (now < target_) {
+			cpu_relax();
+			now = clock::now();
+		}
+		last_offset_ = now - target_;
+	}
+	handler(e);
+}
+
+bool PreciseTimer::pin_thread(int cpu)
+{
+#ifdef __linux__
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+	return false;
+#endif
+}
+
+std::string PreciseTimer::to_string(clock::time_point tp)
+{
+	auto usec = std::chrono::duration_cast<std::chrono::microseconds>(tp.time_since_epoch()).count();
+	auto pt = boost::posix_time::from_time_t(usec / 1000000) + boost::posix_time::microseconds(usec % 1000000);
+	return boost::posix_time::to_simple_string(pt);
+}
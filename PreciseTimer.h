@@ -0,0 +1,44 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <functional>
+#include <boost/asio.hpp>
+#include <boost/asio/system_timer.hpp>
+
+// Wall-clock timer with sub-millisecond accuracy: an asio system_timer wakes up
+// spin_usec before the target, the remaining time is spent busy-waiting on the
+// io thread. The actual-vs-target offset of every expiry is kept in last_offset().
+// The wait and the handler run on the given strand.
+class PreciseTimer
+{
+public:
+	typedef std::chrono::system_clock clock;
+	typedef std::function<void(const boost::system::error_code&)> Handler;
+
+	PreciseTimer(boost::asio::io_service::strand& strand);
+
+	void set_spin(std::chrono::microseconds spin) { spin_ = spin; }
+
+	void expires_at(clock::time_point target);
+	clock::time_point expires_at() const { return target_; }
+	void async_wait(Handler handler);
+	void cancel();
+
+	// actual - target of the last expiry, never negative
+	std::chrono::nanoseconds last_offset() const { return last_offset_; }
+
+	// pins the calling thread to the given CPU, returns false on failure
+	static bool pin_thread(int cpu);
+
+	static std::string to_string(clock::time_point tp);
+
+private:
+	void on_coarse(Handler handler, const boost::system::error_code& e);
+
+	boost::asio::io_service::strand& strand_;
+	boost::asio::system_timer timer_;
+	clock::time_point target_;
+	std::chrono::microseconds spin_;
+	std::chrono::nanoseconds last_offset_;
+};
@@ -0,0 +1,327 @@
+#include "RawSender.h"
+
+#include <easylogging++.h>
+#include <boost/asio/ssl/host_name_verification.hpp>
+#include <sys/socket.h>
+#include <cstring>
+#include <cerrno>
+
+namespace http = boost::beast::http;
+
+const std::chrono::seconds RAW_CONNECT_TIMEOUT(10);
+const std::chrono::milliseconds RAW_MIN_RECONNECT_DELAY(1000);
+const std::chrono::milliseconds RAW_MAX_RECONNECT_DELAY(30000);
+const std::chrono::seconds RAW_QUICK_CLOSE(1);
+
+RawSender::RawSender(boost::asio::io_service::strand& strand, const std::string& url, int busy_poll_usec, Callback cb)
+: strand_(strand)
+, url_(url)
+, tls_(false)
+, busy_poll_usec_(busy_poll_usec)
+, cb_(cb)
+, resolver_(strand.context())
+, ssl_ctx_(boost::asio::ssl::context::tlsv12_client)
+, reconnect_timer_(strand.context())
+, reconnect_delay_(RAW_MIN_RECONNECT_DELAY)
+, first_byte_(false)
+, answered_(false)
+, quick_closes_(0)
+, gen_(0)
+, running_(false)
+, connected_(false)
+, in_flight_(false)
+{
+	std::string rest;
+	if (url.compare(0, 8, "https://") == 0) {
+		tls_ = true;
+		rest = url.substr(8);
+	}
+	else if (url.compare(0, 7, "http://") == 0) {
+		rest = url.substr(7);
+	}
+	else {
+		throw std::invalid_argument("RawSender: unsupported url " + url);
+	}
+
+	auto slash = rest.find('/');
+	target_ = slash == std::string::npos ? "/" : rest.substr(slash);
+	host_ = rest.substr(0, slash);
+	auto colon = host_.find(':');
+	if (colon != std::string::npos) {
+		port_ = host_.substr(colon + 1);
+		host_ = host_.substr(0, colon);
+	}
+	else {
+		port_ = tls_ ? "443" : "80";
+	}
+
+	ssl_ctx_.set_default_verify_paths();
+	ssl_ctx_.set_verify_mode(boost::asio::ssl::verify_peer);
+}
+
+RawSender::~RawSender()
+{
+	stop();
+}
+
+std::string RawSender::build(const std::vector<std::string>& headers, const std::string& body) const
+{
+	std::string host = host_;
+	if (port_ != (tls_ ? "443" : "80"))
+		host += ":" + port_;
+
+	std::string request = "POST " + target_ + " HTTP/1.1\r\nHost: " + host + "\r\n";
+	for (auto& h : headers)
+		request += h + "\r\n";
+	request += "Content-Length: " + std::to_string(body.size()) + "\r\nConnection: keep-alive\r\n\r\n";
+	return request + body;
+}
+
+void RawSender::start()
+{
+	strand_.post([this]() {
+		running_ = true;
+		connect();
+	});
+}
+
+void RawSender::stop()
+{
+	running_ = false;
+	++gen_;
+	reconnect_timer_.cancel();
+	resolver_.cancel();
+	close();
+}
+
+void RawSender::connect()
+{
+	unsigned gen = ++gen_;
+	connected_ = false;
+	buffer_.clear();
+
+	if (tls_)
+		ssl_.reset(new TlsStream(strand_.context(), ssl_ctx_));
+	else
+		tcp_.reset(new Socket(strand_.context()));
+
+	resolver_.async_resolve(host_, port_, boost::asio::bind_executor(strand_,
+		[this, gen](const boost::system::error_code& e, boost::asio::ip::tcp::resolver::results_type results) {
+			on_resolve(gen, e, results);
+		}));
+}
+
+void RawSender::on_resolve(unsigned gen, const boost::system::error_code& e, boost::asio::ip::tcp::resolver::results_type results)
+{
+	if (gen != gen_)
+		return;
+	if (e)
+		return fail(gen, "resolve", e);
+
+	// no timeout of its own: a stuck connect is cut by the reconnect timer
+	reconnect_timer_.expires_after(RAW_CONNECT_TIMEOUT);
+	reconnect_timer_.async_wait(boost::asio::bind_executor(strand_, [this, gen](const boost::system::error_code& e) {
+		if (!e && gen == gen_ && !connected_)
+			fail(gen, "connect", boost::asio::error::timed_out);
+	}));
+	boost::asio::async_connect(socket(), results, boost::asio::bind_executor(strand_,
+		[this, gen](const boost::system::error_code& e, const boost::asio::ip::tcp::endpoint&) {
+			on_connect(gen, e);
+		}));
+}
+
+void RawSender::on_connect(unsigned gen, const boost::system::error_code& e)
+{
+	if (gen != gen_)
+		return;
+	if (e)
+		return fail(gen, "connect", e);
+
+	boost::system::error_code ignored;
+	socket().set_option(boost::asio::ip::tcp::no_delay(true), ignored);
+	if (busy_poll_usec_ > 0) {
+		int usec = busy_poll_usec_;
+		if (setsockopt(socket().native_handle(), SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)) != 0)
+			LOG(ERROR) << "RawSender: SO_BUSY_POLL " << usec << " failed on " << url_ << ": " << strerror(errno);
+	}
+
+	if (!tls_)
+		return on_ready(gen);
+
+	if (!SSL_set_tlsext_host_name(ssl_->native_handle(), host_.c_str()))
+		return fail(gen, "SNI", boost::system::error_code(static_cast<int>(::ERR_get_error()), boost::asio::error::get_ssl_category()));
+	ssl_->set_verify_callback(boost::asio::ssl::host_name_verification(host_));
+	ssl_->async_handshake(boost::asio::ssl::stream_base::client, boost::asio::bind_executor(strand_,
+		[this, gen](const boost::system::error_code& e) {
+			if (gen != gen_)
+				return;
+			if (e)
+				return fail(gen, "TLS handshake", e);
+			on_ready(gen);
+		}));
+}
+
+void RawSender::on_ready(unsigned gen)
+{
+	connected_ = true;
+	connected_at_ = std::chrono::steady_clock::now();
+	answered_ = false;
+	reconnect_timer_.cancel();
+	LOG(DEBUG) << "RawSender: connected to " << url_;
+	read(gen);
+}
+
+void RawSender::read(unsigned gen)
+{
+	parser_.reset(new Parser());
+	parser_->eager(true);
+	first_byte_ = false;
+	with_stream([this, gen](auto& stream) {
+		http::async_read_some(stream, buffer_, *parser_, boost::asio::bind_executor(strand_, [this, gen](const boost::system::error_code& e, std::size_t) {
+			on_read(gen, e);
+		}));
+	});
+}
+
+bool RawSender::send(const std::string& request)
+{
+	if (!ready())
+		return false;
+
+	sent_ = std::chrono::steady_clock::now();
+	response_.http_code = 0;
+	response_.error.clear();
+	response_.data.clear();
+	response_.new_connects = 0;
+
+	if (tls_) {
+		// the pending read may hold the TLS engine, a blocking SSL_write could
+		// need it for a post-handshake message
+		in_flight_ = true;
+		request_.assign(request);
+		unsigned gen = gen_;
+		boost::asio::async_write(*ssl_, boost::asio::buffer(request_), boost::asio::bind_executor(strand_,
+			[this, gen](const boost::system::error_code& e, std::size_t) {
+				if (gen == gen_)
+					on_written(e);
+			}));
+		return true;
+	}
+
+	boost::system::error_code e;
+	boost::asio::write(*tcp_, boost::asio::buffer(request), e);
+	if (e) {
+		// the caller falls back to another path
+		fail(gen_, "write", e);
+		return false;
+	}
+
+	in_flight_ = true;
+	on_written(e);
+	return true;
+}
+
+void RawSender::on_written(const boost::system::error_code& e)
+{
+	if (e)
+		return fail(gen_, "write", e);  // the callback gets the error
+	response_.pretransfer_usec = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - sent_).count();
+}
+
+void RawSender::on_read(unsigned gen, const boost::system::error_code& e)
+{
+	if (gen != gen_)
+		return;
+	if (e) {
+		if (in_flight_)
+			complete(e.message());
+		else if (e == http::error::end_of_stream || e == boost::asio::error::eof)
+			LOG(DEBUG) << "RawSender: idle connection closed by " << url_;
+		return fail(gen, "read", e);
+	}
+
+	if (!in_flight_)
+		return fail(gen, "read", boost::asio::error::invalid_argument);  // nothing was asked
+
+	if (!first_byte_) {
+		first_byte_ = true;
+		response_.starttransfer_usec = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - sent_).count();
+	}
+
+	if (!parser_->is_done()) {
+		with_stream([this, gen](auto& stream) {
+			http::async_read_some(stream, buffer_, *parser_, boost::asio::bind_executor(strand_, [this, gen](const boost::system::error_code& e, std::size_t) {
+				on_read(gen, e);
+			}));
+		});
+		return;
+	}
+
+	answered_ = true;
+	auto message = parser_->release();
+	response_.http_code = message.result_int();
+	response_.data = std::move(message.body());
+	bool keep_alive = message.keep_alive();
+	complete(std::string());
+
+	if (gen != gen_)
+		return;  // stopped from the callback
+	if (keep_alive)
+		read(gen);
+	else
+		fail(gen, "keep-alive", boost::asio::error::eof);
+}
+
+void RawSender::complete(const std::string& error)
+{
+	in_flight_ = false;
+	response_.error = error;
+	response_.total_usec = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - sent_).count();
+	cb_(response_);
+}
+
+void RawSender::fail(unsigned gen, const std::string& what, const boost::system::error_code& e)
+{
+	if (gen != gen_ || !running_)
+		return;
+	++gen_;  // pending callbacks of this connection are ignored from now on
+	bool was_connected = connected_;
+	connected_ = false;
+	if (in_flight_)
+		complete(what + ": " + e.message());
+	close();
+
+	// a server closing an idle connection is routine: reconnect at once, unless
+	// it keeps closing them right after the connect
+	bool quick = was_connected && !answered_ && std::chrono::steady_clock::now() - connected_at_ < RAW_QUICK_CLOSE;
+	if (was_connected && !quick) {
+		quick_closes_ = 0;
+		reconnect_delay_ = RAW_MIN_RECONNECT_DELAY;
+	}
+	else if (quick) {
+		++quick_closes_;
+	}
+
+	auto delay = std::chrono::milliseconds(0);
+	if (!was_connected || quick_closes_ > 1) {
+		delay = reconnect_delay_;
+		LOG(ERROR) << "RawSender: " << what << " failed on " << url_ << ": " << e.message() << (quick ? " right after the connect" : "")
+			<< ", reconnecting in " << delay.count() << " ms";
+		reconnect_delay_ = std::min(reconnect_delay_ * 2, RAW_MAX_RECONNECT_DELAY);
+	}
+
+	reconnect_timer_.expires_after(delay);
+	reconnect_timer_.async_wait(boost::asio::bind_executor(strand_, [this](const boost::system::error_code& e) {
+		if (!e && running_)
+			connect();
+	}));
+}
+
+void RawSender::close()
+{
+	if (tls_ ? !ssl_ : !tcp_)
+		return;
+	// abrupt close: pending operations complete with operation_aborted
+	boost::system::error_code ignored;
+	socket().close(ignored);
+}
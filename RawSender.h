@@ -0,0 +1,107 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/beast/core/flat_buffer.hpp>
+#include <boost/beast/http.hpp>
+
+#include "binacpp/HttpResponse.h"
+
+// Keep-alive HTTP/1.1 connection to one JSON-RPC endpoint, for the shot only.
+// Requests are built in advance by build(); send() writes one on a connection
+// opened long before, without curl's per-request setup: with a single send()
+// for http, with async_write for https, as SSL_write may have to read while the
+// pending read shares the TLS engine. A read is always pending, so a connection
+// closed by the server is noticed and opened again before the next shot; one
+// closed again and again right after the connect is retried with a backoff.
+// Everything runs on the given strand, the callback too.
+class RawSender
+{
+public:
+	typedef HttpCallback Callback;
+
+	// busy_poll_usec > 0 sets SO_BUSY_POLL on the socket
+	RawSender(boost::asio::io_service::strand& strand, const std::string& url, int busy_poll_usec, Callback cb);
+	~RawSender();
+
+	const std::string& url() const { return url_; }
+
+	// the complete request: request line, headers, Content-Length and body
+	std::string build(const std::vector<std::string>& headers, const std::string& body) const;
+
+	void start();
+	void stop();
+
+	// connected and no request in flight
+	bool ready() const { return connected_ && !in_flight_; }
+
+	// request as returned by build(); false if not ready, or if the write fails
+	// on http. The callback gets the response, or the error of a failed write on
+	// https; timings are counted from this call.
+	bool send(const std::string& request);
+
+private:
+	typedef boost::asio::ip::tcp::socket Socket;
+	typedef boost::asio::ssl::stream<Socket> TlsStream;
+	typedef boost::beast::http::response_parser<boost::beast::http::string_body> Parser;
+
+	void connect();
+	void on_resolve(unsigned gen, const boost::system::error_code& e, boost::asio::ip::tcp::resolver::results_type results);
+	void on_connect(unsigned gen, const boost::system::error_code& e);
+	void on_ready(unsigned gen);
+	void on_written(const boost::system::error_code& e);
+	void read(unsigned gen);
+	void on_read(unsigned gen, const boost::system::error_code& e);
+	void fail(unsigned gen, const std::string& what, const boost::system::error_code& e);
+	void close();
+	void complete(const std::string& error);
+
+	Socket& socket() { return tls_ ? ssl_->next_layer() : *tcp_; }
+
+	template <typename F>
+	void with_stream(F f)
+	{
+		if (tls_)
+			f(*ssl_);
+		else
+			f(*tcp_);
+	}
+
+	boost::asio::io_service::strand& strand_;
+	std::string url_;
+	bool tls_;
+	std::string host_;
+	std::string port_;
+	std::string target_;
+	const int busy_poll_usec_;
+	Callback cb_;
+
+	boost::asio::ip::tcp::resolver resolver_;
+	boost::asio::ssl::context ssl_ctx_;
+	std::unique_ptr<Socket> tcp_;
+	std::unique_ptr<TlsStream> ssl_;
+	boost::beast::flat_buffer buffer_;
+	std::unique_ptr<Parser> parser_;
+
+	boost::asio::steady_timer reconnect_timer_;
+	std::chrono::milliseconds reconnect_delay_;
+
+	HttpResponse response_;
+	std::string request_;  // kept for async_write on https
+	std::chrono::steady_clock::time_point sent_;
+	bool first_byte_;
+
+	std::chrono::steady_clock::time_point connected_at_;
+	bool answered_;  // a response came on this connection
+	unsigned quick_closes_;  // connections closed in a row before any response, soon after the connect
+
+	unsigned gen_;  // connection generation, callbacks of older connections are ignored
+	bool running_;
+	bool connected_;
+	bool in_flight_;
+};
@@ -0,0 +1,156 @@
+#include "SignPool.h"
+
+#include <PrivateKey.h>
+#include <HexCoding.h>
+#include <Ethereum/Transaction.h>
+#include <Ethereum/Signer.h>
+
+#include <easylogging++.h>
+#include <openssl/crypto.h>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/mman.h>
+
+struct SignPool::Batch
+{
+	std::size_t key_ {0};
+	TW::uint256_t chain_id_;
+	std::vector<Spec> specs_;
+	std::vector<std::string> raws_;
+	std::atomic<std::size_t> remaining_ {0};
+	Handler handler_;
+};
+
+SignPool::SignPool(std::size_t threads, std::size_t max_keys)
+: keys_(nullptr)
+, keys_size_(0)
+, max_keys_(std::max<std::size_t>(max_keys, 1))
+, key_count_(0)
+, running_(true)
+{
+	auto page = (std::size_t)sysconf(_SC_PAGESIZE);
+	keys_size_ = (max_keys_ * KEY_SIZE + page - 1) / page * page;
+	void* memory = mmap(nullptr, keys_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (memory == MAP_FAILED)
+		throw std::runtime_error("SignPool: cannot allocate " + std::to_string(keys_size_) + " bytes");
+	keys_ = (unsigned char*)memory;
+	// kept out of swap and core dumps
+	if (mlock(keys_, keys_size_) != 0)
+		LOG(ERROR) << "SignPool: mlock: " << strerror(errno) << ", keys may be swapped out";
+	madvise(keys_, keys_size_, MADV_DONTDUMP);
+
+	for (std::size_t i = 0; i < threads; ++i)
+		threads_.push_back(new std::thread(&SignPool::run, this));
+	LOG(DEBUG) << "SignPool: " << threads << " threads";
+}
+
+SignPool::~SignPool()
+{
+	{
+		std::lock_guard<std::mutex> g(mutex_);
+		running_ = false;
+		queue_.clear();  // batches not started are dropped, their handlers never run
+	}
+	cv_.notify_all();
+	for (auto t : threads_) {
+		t->join();
+		delete t;
+	}
+	OPENSSL_cleanse(keys_, keys_size_);
+	munlock(keys_, keys_size_);
+	munmap(keys_, keys_size_);
+}
+
+std::size_t SignPool::add_key(const TW::Data& secret)
+{
+	if (secret.size() != KEY_SIZE)
+		throw std::invalid_argument("SignPool: " + std::to_string(KEY_SIZE) + " byte key expected");
+
+	std::lock_guard<std::mutex> g(mutex_);
+	if (key_count_ == max_keys_)
+		throw std::length_error("SignPool: more than " + std::to_string(max_keys_) + " keys");
+	std::memcpy(keys_ + key_count_ * KEY_SIZE, secret.data(), KEY_SIZE);
+	return key_count_++;
+}
+
+void SignPool::sign(std::size_t key, const TW::uint256_t& chain_id, std::vector<Spec> specs, Handler handler)
+{
+	{
+		std::lock_guard<std::mutex> g(mutex_);
+		if (key >= key_count_)
+			throw std::out_of_range("SignPool: unknown key " + std::to_string(key));
+	}
+
+	auto batch = std::make_shared<Batch>();
+	batch->key_ = key;
+	batch->chain_id_ = chain_id;
+	batch->specs_ = std::move(specs);
+	batch->raws_.resize(batch->specs_.size());
+	batch->remaining_ = batch->specs_.size();
+	batch->handler_ = handler;
+
+	if (threads_.empty() || batch->specs_.empty()) {
+		for (std::size_t i = 0; i < batch->specs_.size(); ++i)
+			sign_one(*batch, i);
+		finish(*batch);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> g(mutex_);
+		for (std::size_t i = 0; i < batch->specs_.size(); ++i)
+			queue_.push_back(Job{batch, i});
+	}
+	cv_.notify_all();
+}
+
+void SignPool::run()
+{
+	while (true) {
+		Job job;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			cv_.wait(lock, [this] { return !queue_.empty() || !running_; });
+			if (!running_)
+				return;
+			job = std::move(queue_.front());
+			queue_.pop_front();
+		}
+		sign_one(*job.batch_, job.index_);
+		if (--job.batch_->remaining_ == 0)
+			finish(*job.batch_);
+	}
+}
+
+void SignPool::sign_one(Batch& batch, std::size_t index)
+{
+	auto& spec = batch.specs_[index];
+	// the key leaves the locked page only for the time of one signature
+	TW::Data secret(keys_ + batch.key_ * KEY_SIZE, keys_ + (batch.key_ + 1) * KEY_SIZE);
+	try {
+		TW::PrivateKey key(secret);
+		OPENSSL_cleanse(secret.data(), secret.size());
+
+		auto transaction = std::make_shared<TW::Ethereum::TransactionNonTyped>(spec.nonce_, spec.gas_price_, spec.gas_limit_, spec.to_, spec.amount_, spec.payload_);
+		auto signature = TW::Ethereum::Signer::sign(key, batch.chain_id_, transaction);
+		OPENSSL_cleanse(key.bytes.data(), key.bytes.size());
+		batch.raws_[index] = TW::hex(transaction->encoded(signature, batch.chain_id_));
+	}
+	catch (std::exception& e) {
+		OPENSSL_cleanse(secret.data(), secret.size());
+		LOG(ERROR) << "SignPool: nonce " << spec.nonce_ << ", gas price " << spec.gas_price_ << ": " << e.what();
+	}
+}
+
+void SignPool::finish(Batch& batch)
+{
+	for (auto& raw : batch.raws_) {
+		if (raw.empty()) {
+			batch.raws_.clear();
+			break;
+		}
+	}
+	batch.handler_(batch.raws_);
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <condition_variable>
+
+#include <uint256.h>
+
+// Signs transactions on threads of its own, so that pre-signing the gas ladders
+// of many wallets and bots does not hold up the io threads. Private keys are
+// copied once into a locked page that is left out of core dumps and wiped when
+// the pool goes; jobs refer to a key by its index. A batch is spread over the
+// threads, its handler runs on the thread that signs its last transaction.
+// With 0 threads sign() signs on the caller's thread before returning.
+// Shared by all bots of the process, methods are thread-safe.
+class SignPool
+{
+public:
+	// a TransactionNonTyped
+	struct Spec {
+		TW::uint256_t nonce_;
+		TW::uint256_t gas_price_;
+		TW::uint256_t gas_limit_;
+		TW::Data to_;
+		TW::uint256_t amount_;
+		TW::Data payload_;
+	};
+
+	// hex encoded raw transactions in the order of the specs; empty if one could not be signed
+	typedef std::function<void(std::vector<std::string>&)> Handler;
+
+	SignPool(std::size_t threads, std::size_t max_keys = 64);
+	~SignPool();
+
+	// the index to sign with, throws if max_keys are taken
+	std::size_t add_key(const TW::Data& secret);
+
+	void sign(std::size_t key, const TW::uint256_t& chain_id, std::vector<Spec> specs, Handler handler);
+
+	std::size_t threads() const { return threads_.size(); }
+
+private:
+	struct Batch;
+	struct Job {
+		std::shared_ptr<Batch> batch_;
+		std::size_t index_;
+	};
+
+	void run();
+	void sign_one(Batch& batch, std::size_t index);
+	static void finish(Batch& batch);
+
+	static const std::size_t KEY_SIZE = 32;
+
+	unsigned char* keys_;  // max_keys_ * KEY_SIZE, locked
+	std::size_t keys_size_;  // bytes mapped
+	const std::size_t max_keys_;
+	std::size_t key_count_;  // guarded by mutex_
+
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	std::deque<Job> queue_;  // guarded by mutex_
+	bool running_;
+	std::vector<std::thread*> threads_;
+};
@@ -19,5 +19,6 @@ struct Transaction
 	int status_;
 	int bot_id_;
 	int delta_msec_;
+	std::string comment_;  // fire path timings of our own shot
 };
  
\ No newline at end of file
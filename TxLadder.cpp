@@ -0,0 +1,77 @@
+#include "TxLadder.h"
+#include "Transaction.h"
+
+#include <easylogging++.h>
+#include <algorithm>
+#include <map>
+
+TxLadder::TxLadder(std::vector<TW::uint256_t> gas_prices, std::size_t window)
+: gas_prices_(gas_prices)
+, window_(std::max<std::size_t>(window, 1))
+, raws_(gas_prices_.size())
+, floor_(0)
+, selected_(0)
+{
+	if (gas_prices_.empty())
+		throw std::invalid_argument("TxLadder: no gas prices");
+	std::sort(gas_prices_.begin(), gas_prices_.end());
+}
+
+void TxLadder::load_history(const std::vector<Transaction>& rows, const std::string& wallet)
+{
+	// group rows by bounty, keep the order of the bounties
+	std::map<TW::uint256_t, std::vector<Transaction>> rounds;
+	for (auto& t : rows)
+		rounds[t.timestamp_].push_back(t);
+
+	for (auto& r : rounds)
+		add_round(r.second, wallet);
+	LOG(DEBUG) << "TxLadder: " << rounds.size() << " rounds in history";
+}
+
+void TxLadder::add_round(const std::vector<Transaction>& round, const std::string& wallet)
+{
+	TW::uint256_t top = 0;
+	for (auto& t : round) {
+		if (t.from_ != wallet && t.gas_price_ > top)
+			top = t.gas_price_;
+	}
+	if (top == 0)
+		return;
+
+	top_prices_.push_back(top);
+	if (top_prices_.size() > window_)
+		top_prices_.pop_front();
+	select();
+}
+
+void TxLadder::set_floor(const TW::uint256_t& price)
+{
+	if (price == floor_)
+		return;
+	floor_ = price;
+	select();
+}
+
+std::size_t TxLadder::above(const TW::uint256_t& price) const
+{
+	auto it = std::upper_bound(gas_prices_.begin(), gas_prices_.end(), price);
+	return it == gas_prices_.end() ? gas_prices_.size() - 1 : it - gas_prices_.begin();
+}
+
+void TxLadder::select()
+{
+	TW::uint256_t target = floor_;
+	if (!top_prices_.empty()) {
+		std::vector<TW::uint256_t> prices(top_prices_.begin(), top_prices_.end());
+		std::nth_element(prices.begin(), prices.begin() + prices.size() / 2, prices.end());
+		target = std::max(target, prices[prices.size() / 2]);
+	}
+	if (target == 0)
+		return;
+
+	auto selected = above(target);
+	if (selected != selected_)
+		LOG(DEBUG) << "TxLadder: competitors at " << target << ", gas price " << gas_prices_[selected_] << " -> " << gas_prices_[selected];
+	selected_ = selected;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+
+#include <uint256.h>
+
+struct Transaction;
+
+// Pre-signed variants of the next transaction, one per gas price ("rung").
+// All rungs share one nonce, so a higher rung replaces a lower one already sent.
+// The rung to fire is chosen when rounds come in, not at fire time: the lowest
+// gas price above the median of the highest competitor price of recent rounds,
+// and above the floor when one is set.
+class TxLadder
+{
+public:
+	// gas_prices are sorted ascending; window is the number of rounds remembered
+	TxLadder(std::vector<TW::uint256_t> gas_prices, std::size_t window = 10);
+
+	std::size_t size() const { return gas_prices_.size(); }
+	const TW::uint256_t& gas_price(std::size_t index) const { return gas_prices_[index]; }
+
+	void set_raw(std::size_t index, const std::string& raw) { raws_[index] = raw; }
+	const std::string& raw(std::size_t index) const { return raws_[index]; }
+
+	// the pre-selected rung, O(1)
+	std::size_t selected() const { return selected_; }
+	const std::string& fire() const { return raws_[selected_]; }
+	// the lowest rung priced over price, the top one if none is
+	std::size_t above(const TW::uint256_t& price) const;
+
+	// history: rows of many rounds, ours are recognized by the sender address
+	void load_history(const std::vector<Transaction>& rows, const std::string& wallet);
+	void add_round(const std::vector<Transaction>& round, const std::string& wallet);
+
+	// e.g. the price others win with (CompetitorStats), 0 for none
+	void set_floor(const TW::uint256_t& price);
+
+private:
+	void select();
+
+	std::vector<TW::uint256_t> gas_prices_;
+	const std::size_t window_;
+	std::vector<std::string> raws_;
+	std::deque<TW::uint256_t> top_prices_;  // highest competitor gas price of each recent round
+	TW::uint256_t floor_;
+	std::size_t selected_;
+};
@@ -0,0 +1,290 @@
+#include "WsClient.h"
+
+#include <easylogging++.h>
+#include <boost/asio/ssl/host_name_verification.hpp>
+
+namespace beast = boost::beast;
+namespace websocket = boost::beast::websocket;
+
+const std::chrono::seconds WS_CONNECT_TIMEOUT(10);
+const std::chrono::milliseconds WS_MIN_RECONNECT_DELAY(1000);
+const std::chrono::milliseconds WS_MAX_RECONNECT_DELAY(30000);
+
+WsClient::WsClient(boost::asio::io_service::strand& strand, const std::string& url)
+: strand_(strand)
+, url_(url)
+, tls_(false)
+, resolver_(strand.context())
+, ssl_ctx_(boost::asio::ssl::context::tlsv12_client)
+, writing_(false)
+, reconnect_timer_(strand.context())
+, reconnect_delay_(WS_MIN_RECONNECT_DELAY)
+, gen_(0)
+, running_(false)
+, ready_(false)
+{
+	std::string rest;
+	if (url.compare(0, 6, "wss://") == 0) {
+		tls_ = true;
+		rest = url.substr(6);
+	}
+	else if (url.compare(0, 5, "ws://") == 0) {
+		rest = url.substr(5);
+	}
+	else {
+		throw std::invalid_argument("WsClient: unsupported url " + url);
+	}
+
+	auto slash = rest.find('/');
+	target_ = slash == std::string::npos ? "/" : rest.substr(slash);
+	host_ = rest.substr(0, slash);
+	auto colon = host_.find(':');
+	if (colon != std::string::npos) {
+		port_ = host_.substr(colon + 1);
+		host_ = host_.substr(0, colon);
+	}
+	else {
+		port_ = tls_ ? "443" : "80";
+	}
+
+	ssl_ctx_.set_default_verify_paths();
+	ssl_ctx_.set_verify_mode(boost::asio::ssl::verify_peer);
+}
+
+void WsClient::subscribe(const nlohmann::json& params, Handler handler)
+{
+	Subscription s;
+	s.params_ = params;
+	s.handler_ = handler;
+	subscriptions_.push_back(s);
+}
+
+void WsClient::start()
+{
+	strand_.post([this, self = shared_from_this()]() {
+		running_ = true;
+		connect();
+	});
+}
+
+void WsClient::stop()
+{
+	running_ = false;
+	ready_ = false;
+	++gen_;
+	reconnect_timer_.cancel();
+	resolver_.cancel();
+	close();
+}
+
+void WsClient::connect()
+{
+	unsigned gen = ++gen_;
+	ready_ = false;
+	active_.clear();
+	outbox_.clear();
+	writing_ = false;
+	buffer_.clear();
+
+	if (tls_)
+		wss_.reset(new TlsStream(strand_.context(), ssl_ctx_));
+	else
+		ws_.reset(new PlainStream(strand_.context()));
+
+	LOG(DEBUG) << "WsClient: connecting to " << url_;
+	resolver_.async_resolve(host_, port_, boost::asio::bind_executor(strand_,
+		[this, self = shared_from_this(), gen](const boost::system::error_code& e, boost::asio::ip::tcp::resolver::results_type results) {
+			on_resolve(gen, e, results);
+		}));
+}
+
+void WsClient::on_resolve(unsigned gen, const boost::system::error_code& e, boost::asio::ip::tcp::resolver::results_type results)
+{
+	if (gen != gen_)
+		return;
+	if (e)
+		return fail(gen, "resolve", e);
+
+	with_stream([this, gen, &results](auto& ws) {
+		auto& tcp = beast::get_lowest_layer(ws);
+		tcp.expires_after(WS_CONNECT_TIMEOUT);
+		tcp.async_connect(results, boost::asio::bind_executor(strand_,
+			[this, self = shared_from_this(), gen](const boost::system::error_code& e, const boost::asio::ip::tcp::endpoint&) {
+				on_connect(gen, e);
+			}));
+	});
+}
+
+void WsClient::on_connect(unsigned gen, const boost::system::error_code& e)
+{
+	if (gen != gen_)
+		return;
+	if (e)
+		return fail(gen, "connect", e);
+
+	auto ws_handshake = [this, gen]() {
+		with_stream([this, gen](auto& ws) {
+			// the websocket keeps its own ping/idle timeouts from here on
+			beast::get_lowest_layer(ws).expires_never();
+			ws.set_option(websocket::stream_base::timeout::suggested(beast::role_type::client));
+			ws.text(true);
+			ws.async_handshake(host_, target_, boost::asio::bind_executor(strand_, [this, self = shared_from_this(), gen](const boost::system::error_code& e) {
+				on_handshake(gen, e);
+			}));
+		});
+	};
+
+	if (!tls_) {
+		ws_handshake();
+		return;
+	}
+
+	auto& ssl = wss_->next_layer();
+	if (!SSL_set_tlsext_host_name(ssl.native_handle(), host_.c_str()))
+		return fail(gen, "SNI", boost::system::error_code(static_cast<int>(::ERR_get_error()), boost::asio::error::get_ssl_category()));
+	ssl.set_verify_callback(boost::asio::ssl::host_name_verification(host_));
+	beast::get_lowest_layer(*wss_).expires_after(WS_CONNECT_TIMEOUT);
+	ssl.async_handshake(boost::asio::ssl::stream_base::client, boost::asio::bind_executor(strand_,
+		[this, self = shared_from_this(), gen, ws_handshake](const boost::system::error_code& e) {
+			if (gen != gen_)
+				return;
+			if (e)
+				return fail(gen, "TLS handshake", e);
+			ws_handshake();
+		}));
+}
+
+void WsClient::on_handshake(unsigned gen, const boost::system::error_code& e)
+{
+	if (gen != gen_)
+		return;
+	if (e)
+		return fail(gen, "handshake", e);
+
+	LOG(DEBUG) << "WsClient: connected to " << url_;
+	for (std::size_t i = 0; i < subscriptions_.size(); ++i) {
+		nlohmann::json doc;
+		doc["method"] = "eth_subscribe";
+		doc["id"] = i;
+		doc["jsonrpc"] = "2.0";
+		doc["params"] = subscriptions_[i].params_;
+		send(doc.dump());
+	}
+	read(gen);
+}
+
+void WsClient::read(unsigned gen)
+{
+	with_stream([this, gen](auto& ws) {
+		ws.async_read(buffer_, boost::asio::bind_executor(strand_, [this, self = shared_from_this(), gen](const boost::system::error_code& e, std::size_t) {
+			on_read(gen, e);
+		}));
+	});
+}
+
+void WsClient::on_read(unsigned gen, const boost::system::error_code& e)
+{
+	if (gen != gen_)
+		return;
+	if (e)
+		return fail(gen, "read", e);
+
+	auto message = beast::buffers_to_string(buffer_.data());
+	buffer_.consume(buffer_.size());
+	on_message(message);
+	if (gen == gen_)
+		read(gen);
+}
+
+void WsClient::on_message(const std::string& message)
+{
+	nlohmann::json doc;
+	try {
+		doc = nlohmann::json::parse(message);
+	}
+	catch (std::exception& e) {
+		LOG(ERROR) << "WsClient: " << e.what();
+		return;
+	}
+
+	if (doc["method"] == "eth_subscription") {
+		auto& params = doc["params"];
+		if (!params["subscription"].is_string())
+			return;
+		auto it = active_.find(params["subscription"]);
+		if (it != active_.end())
+			subscriptions_[it->second].handler_(params["result"]);
+		return;
+	}
+
+	if (!doc["id"].is_number_unsigned())
+		return;
+	std::size_t index = doc["id"];
+	if (index >= subscriptions_.size())
+		return;
+	if (!doc["result"].is_string()) {
+		LOG(ERROR) << "WsClient: eth_subscribe " << subscriptions_[index].params_.dump() << " failed: " << doc.dump();
+		return;
+	}
+	active_[doc["result"]] = index;
+	if (active_.size() == subscriptions_.size()) {
+		ready_ = true;
+		reconnect_delay_ = WS_MIN_RECONNECT_DELAY;
+		LOG(DEBUG) << "WsClient: " << active_.size() << " subscriptions active on " << url_;
+	}
+}
+
+void WsClient::send(const std::string& message)
+{
+	outbox_.push_back(message);
+	if (!writing_)
+		write_next();
+}
+
+void WsClient::write_next()
+{
+	if (outbox_.empty()) {
+		writing_ = false;
+		return;
+	}
+	writing_ = true;
+	unsigned gen = gen_;
+	with_stream([this, gen](auto& ws) {
+		ws.async_write(boost::asio::buffer(outbox_.front()), boost::asio::bind_executor(strand_, [this, self = shared_from_this(), gen](const boost::system::error_code& e, std::size_t) {
+			if (gen != gen_)
+				return;
+			if (e)
+				return fail(gen, "write", e);
+			outbox_.pop_front();
+			write_next();
+		}));
+	});
+}
+
+void WsClient::fail(unsigned gen, const std::string& what, const boost::system::error_code& e)
+{
+	if (gen != gen_ || !running_)
+		return;
+	++gen_;  // pending callbacks of this connection are ignored from now on
+	ready_ = false;
+	LOG(ERROR) << "WsClient: " << what << " failed on " << url_ << ": " << e.message() << ", reconnecting in " << reconnect_delay_.count() << " ms";
+	close();
+
+	reconnect_timer_.expires_after(reconnect_delay_);
+	reconnect_timer_.async_wait(boost::asio::bind_executor(strand_, [this, self = shared_from_this()](const boost::system::error_code& e) {
+		if (!e && running_)
+			connect();
+	}));
+	reconnect_delay_ = std::min(reconnect_delay_ * 2, WS_MAX_RECONNECT_DELAY);
+}
+
+void WsClient::close()
+{
+	if (tls_ ? !wss_ : !ws_)
+		return;
+	with_stream([](auto& ws) {
+		// abrupt close: pending operations complete with operation_aborted
+		boost::system::error_code ignored;
+		beast::get_lowest_layer(ws).socket().close(ignored);
+	});
+}
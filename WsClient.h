@@ -0,0 +1,93 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <deque>
+#include <functional>
+#include <nlohmann/json.hpp>
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/ssl.hpp>
+#include <boost/beast/websocket.hpp>
+#include <boost/beast/websocket/ssl.hpp>
+
+// JSON-RPC pub/sub (eth_subscribe) over a ws:// or wss:// connection.
+// Subscriptions are registered before start() and renewed after every reconnect;
+// the connection is re-established with a growing backoff whenever it fails.
+// Notifications are handled on the given strand. Owned by a shared_ptr: pending
+// handlers keep the client and its stream alive after stop(), and are ignored.
+class WsClient : public std::enable_shared_from_this<WsClient>
+{
+public:
+	typedef std::function<void(nlohmann::json&)> Handler;
+
+	WsClient(boost::asio::io_service::strand& strand, const std::string& url);
+
+	// params of eth_subscribe, e.g. ["newHeads"]; handler gets the "result" of each notification
+	void subscribe(const nlohmann::json& params, Handler handler);
+
+	void start();
+	void stop();  // handlers are not called afterwards
+
+	// all subscriptions are confirmed by the node
+	bool ready() const { return ready_; }
+
+private:
+	typedef boost::beast::websocket::stream<boost::beast::tcp_stream> PlainStream;
+	typedef boost::beast::websocket::stream<boost::beast::ssl_stream<boost::beast::tcp_stream>> TlsStream;
+
+	struct Subscription {
+		nlohmann::json params_;
+		Handler handler_;
+	};
+
+	void connect();
+	void on_resolve(unsigned gen, const boost::system::error_code& e, boost::asio::ip::tcp::resolver::results_type results);
+	void on_connect(unsigned gen, const boost::system::error_code& e);
+	void on_handshake(unsigned gen, const boost::system::error_code& e);
+	void read(unsigned gen);
+	void on_read(unsigned gen, const boost::system::error_code& e);
+	void on_message(const std::string& message);
+
+	void send(const std::string& message);
+	void write_next();
+	void fail(unsigned gen, const std::string& what, const boost::system::error_code& e);
+	void close();
+
+	template <typename F>
+	void with_stream(F f)
+	{
+		if (tls_)
+			f(*wss_);
+		else
+			f(*ws_);
+	}
+
+	boost::asio::io_service::strand& strand_;
+	std::string url_;
+	bool tls_;
+	std::string host_;
+	std::string port_;
+	std::string target_;
+
+	boost::asio::ip::tcp::resolver resolver_;
+	boost::asio::ssl::context ssl_ctx_;
+	std::unique_ptr<PlainStream> ws_;
+	std::unique_ptr<TlsStream> wss_;
+	boost::beast::flat_buffer buffer_;
+	std::deque<std::string> outbox_;
+	bool writing_;
+
+	boost::asio::steady_timer reconnect_timer_;
+	std::chrono::milliseconds reconnect_delay_;
+
+	std::vector<Subscription> subscriptions_;
+	std::map<std::string, std::size_t> active_;  // subscription id -> index in subscriptions_
+	unsigned gen_;  // connection generation, callbacks of older connections are ignored
+	bool running_;
+	bool ready_;
+};
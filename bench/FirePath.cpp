@@ -0,0 +1,96 @@
+#include "FirePath.h"
+#include "Bot.h"
+
+#include <cstdlib>
+#include <new>
+#include <chrono>
+
+thread_local bool counting = false;
+thread_local std::size_t allocations = 0;
+
+void* operator new(std::size_t size)
+{
+	if (counting)
+		++allocations;
+	void* p = std::malloc(size ? size : 1);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+FirePath::FirePath(bool raw, unsigned short port)
+: mock_work_(new boost::asio::io_service::work(mock_io_))
+, chain_(mock_io_, nlohmann::json::object())
+, server_(mock_io_, chain_, port)
+, work_(io_)
+, http_(io_)
+, strand_(io_)
+, broadcaster_(&http_, strand_, { "Content-Type: application/json" })
+, answered_(false)
+{
+	server_.start();
+	mock_thread_ = std::thread([this]() {
+		mock_io_.run();
+	});
+
+	broadcaster_.add_endpoint("http://127.0.0.1:" + std::to_string(port) + "/");
+	if (raw) {
+		broadcaster_.enable_raw(0);
+		io_.run_for(std::chrono::milliseconds(200));  // connected
+	}
+
+	auto doc = Bot::make_json_rpc("eth_sendRawTransaction");
+	doc["params"] = nlohmann::json::array({ "0x" + std::string(220, 'f') });
+	broadcaster_.prepare({ Bot::pretty_print(doc) }, [this](nlohmann::json&) {
+		answered_ = true;
+	});
+
+	// connects and warms asio's recycled handler memory, as Bot::warm_up_cb does
+	fire(false);
+}
+
+FirePath::~FirePath()
+{
+	mock_work_.reset();
+	mock_io_.stop();
+	mock_thread_.join();
+}
+
+std::size_t FirePath::fire(bool count)
+{
+	answered_ = false;
+	auto added = http_.handles_added();
+	std::size_t before = 0;
+	bool fired = false;
+	strand_.post([this, count, &before, &fired]() {
+		auto in_flight = http_.in_flight();
+		before = allocations;
+		counting = count;
+		broadcaster_.fire(0);
+		if (http_.in_flight() == in_flight)
+			counting = false;  // written by RawSender
+		fired = true;
+	});
+	while (!fired)
+		io_.run_one();
+
+	// start_request runs later, on AsioCURL's strand
+	while (counting && !answered_ && http_.handles_added() == added)
+		io_.run_one();
+	counting = false;
+	std::size_t result = count ? allocations - before : 0;
+
+	while (!answered_)
+		io_.run_one();
+	return result;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <thread>
+#include <memory>
+#include <boost/asio.hpp>
+
+#include "Broadcaster.h"
+#include "binacpp/AsioCURL.h"
+#include "mock/MockChain.h"
+#include "mock/MockServer.h"
+
+// operator new calls of this thread while counting is set; defined with the
+// replaced operator new in FirePath.cpp
+extern thread_local bool counting;
+extern thread_local std::size_t allocations;
+
+// Bot::fire's send path: a prepared eth_sendRawTransaction through Broadcaster
+// to a mock node, over AsioCURL or RawSender, fired on a strand inside io.run()
+// as timer_cb is. The mock node runs on a thread of its own, its allocations are
+// not counted. Shared by BM_fire and fire-path-check.
+class FirePath
+{
+public:
+	FirePath(bool raw, unsigned short port);
+	~FirePath();
+
+	// one shot, until its response is handled. With count, the operator new calls
+	// from Broadcaster::fire until the request is written (RawSender) or its handle
+	// added to curl_multi (AsioCURL), asio handlers run meanwhile included; curl's
+	// own malloc() calls and the response path are not.
+	std::size_t fire(bool count);
+
+private:
+	boost::asio::io_service mock_io_;
+	std::unique_ptr<boost::asio::io_service::work> mock_work_;
+	MockChain chain_;
+	MockServer server_;
+	std::thread mock_thread_;
+
+	boost::asio::io_service io_;
+	boost::asio::io_service::work work_;  // run_one() stops io_ once it runs out of work
+	AsioCURL http_;
+	boost::asio::io_service::strand strand_;
+	Broadcaster broadcaster_;
+	bool answered_;
+};
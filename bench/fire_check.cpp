@@ -0,0 +1,45 @@
+// Fails if sending a prepared transaction allocates on the heap, over AsioCURL
+// and over RawSender to a local mock node. BM_fire measures the same path when
+// Google Benchmark is installed; this one is always built and run by ctest.
+
+#include "bench/FirePath.h"
+
+#include <easylogging++.h>
+#include <iostream>
+
+INITIALIZE_EASYLOGGINGPP
+
+namespace {
+
+const unsigned short MOCK_PORT = 18546;
+const int SHOTS = 100;
+
+}
+
+int main()
+{
+	el::Configurations conf;
+	conf.setToDefault();
+	conf.setGlobally(el::ConfigurationType::Enabled, "false");
+	el::Loggers::reconfigureLogger("default", conf);
+
+	int failed = 0;
+	for (int raw = 0; raw < 2; ++raw) {
+		const char* name = raw ? "RawSender" : "AsioCURL";
+		try {
+			FirePath path(raw, MOCK_PORT);
+			std::size_t fire_allocations = 0;
+			for (int i = 0; i < SHOTS; ++i)
+				fire_allocations += path.fire(true);
+
+			std::cout << name << ": " << fire_allocations << " allocations in " << SHOTS << " shots" << std::endl;
+			if (fire_allocations > 0)
+				++failed;
+		}
+		catch (std::exception& e) {
+			std::cout << name << ": " << e.what() << std::endl;
+			++failed;
+		}
+	}
+	return failed ? 1 : 0;
+}
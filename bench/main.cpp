@@ -0,0 +1,359 @@
+// Microbenchmarks of the fire path and of the per-round bookkeeping.
+// Results are machine-readable with the usual Google Benchmark flags, e.g.
+//   ./compounding-bot-bench --benchmark_out=bench.json --benchmark_out_format=json
+// "--blocks=<file>" replaces the generated eth_getBlockByNumber batch with a recorded one.
+// BM_fire fails if sending a prepared transaction allocates on the heap,
+// BM_FastLog_write if a fire path log record does.
+
+#include "Bot.h"
+#include "DB.h"
+#include "CompetitorStats.h"
+#include "Transaction.h"
+#include "BlockScanner.h"
+#include "HexCodec.h"
+#include "FastLog.h"
+#include "SignPool.h"
+#include "bench/FirePath.h"
+
+#include <HexCoding.h>
+#include <PrivateKey.h>
+
+#include <Ethereum/Transaction.h>
+#include <Ethereum/ABI/Function.h>
+#include <Ethereum/Signer.h>
+
+#include <benchmark/benchmark.h>
+#include <easylogging++.h>
+
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <future>
+
+INITIALIZE_EASYLOGGINGPP
+
+namespace {
+
+// throwaway key and addresses, nothing is sent anywhere
+const char SECRET[] = "4646464646464646464646464646464646464646464646464646464646464646";
+const char CONTRACT[] = "0xa2a5ff7a8b1ee0c3a4fa5e3b7c4d2a1e6f9b8c7d";
+const char WALLET[] = "0x9d8a62f656a8d1615c1294fd71e9cfb3e4855a4f";
+const char COMPOUND_SIG[] = "0xf69e2046";
+const int CHAIN_ID = 56;
+const unsigned short MOCK_PORT = 18545;
+
+std::string blocks_payload;
+std::size_t blocks_count = 0;
+
+// a batch of full blocks like the one gather_blocks gets, one compound() per block
+void make_blocks_payload(std::size_t blocks, std::size_t txs_per_block)
+{
+	std::vector<nlohmann::json> docs;
+	for (std::size_t b = 0; b < blocks; ++b) {
+		auto txs = nlohmann::json::array();
+		for (std::size_t i = 0; i < txs_per_block; ++i) {
+			char hash[67];
+			std::snprintf(hash, sizeof(hash), "0x%016zx%016zx%016zx%016zx", b, i, b * i, b + i);
+			nlohmann::json tx;
+			tx["blockNumber"] = Bot::UInt256ToHex(20000000 + b);
+			tx["hash"] = hash;
+			tx["from"] = WALLET;
+			tx["gas"] = "0x30d40";
+			tx["gasPrice"] = "0x12a05f200";
+			tx["nonce"] = Bot::UInt256ToHex(i);
+			tx["transactionIndex"] = Bot::UInt256ToHex(i);
+			tx["value"] = "0x0";
+			tx["v"] = "0x94";
+			tx["r"] = hash;
+			tx["s"] = hash;
+			if (i == txs_per_block / 2) {
+				tx["to"] = CONTRACT;
+				tx["input"] = COMPOUND_SIG;
+			}
+			else {
+				tx["to"] = "0x10ed43c718714eb63d5aa57b78b54704e256024e";
+				tx["input"] = "0x38ed1739" + std::string(320, 'a');
+			}
+			txs.push_back(tx);
+		}
+		nlohmann::json response;
+		response["jsonrpc"] = "2.0";
+		response["id"] = b;
+		response["result"]["number"] = Bot::UInt256ToHex(20000000 + b);
+		response["result"]["timestamp"] = Bot::UInt256ToHex(1650000000 + 3 * b);
+		response["result"]["transactions"] = txs;
+		docs.push_back(response);
+	}
+	blocks_payload = Bot::pretty_print(nlohmann::json(docs));
+	blocks_count = blocks;
+}
+
+bool load_blocks_payload(const std::string& file)
+{
+	std::ifstream in(file);
+	if (!in)
+		return false;
+	std::stringstream buffer;
+	buffer << in.rdbuf();
+	blocks_payload = buffer.str();
+	auto doc = Bot::parse_json(blocks_payload);
+	blocks_count = doc.is_array() ? doc.size() : 1;
+	return true;
+}
+
+Transaction make_transaction(int i)
+{
+	Transaction tr;
+	tr.timestamp_ = 1650000000 + i;
+	tr.index_ = i % 200;
+	tr.from_ = WALLET;
+	tr.to_ = CONTRACT;
+	tr.log_count_ = 1;
+	tr.tx_fee_ = 0.00123456789;
+	tr.hash_ = "0x5c504ed432cb51138bcf09aa5e8a410dd4a1e204ef84bfed1be16dfba1b22060";
+	tr.block_number_ = 20000000 + i;
+	tr.gas_limit_ = 200000;
+	tr.gas_price_ = 5000000000;
+	tr.gas_used_ = 85000;
+	tr.status_ = 1;
+	tr.bot_id_ = 1;
+	tr.delta_msec_ = -250;
+	tr.comment_ = "ser=12 wire=180 fb=2400 parse=30";
+	return tr;
+}
+
+} // namespace
+
+// what Bot::prepare_transaction does for every rung of the ladder
+static void BM_prepare_transaction(benchmark::State& state)
+{
+	TW::PrivateKey key(TW::parse_hex(SECRET));
+	TW::Ethereum::ABI::Function func("compound");
+	auto contract = TW::parse_hex(CONTRACT);
+	const std::size_t rungs = state.range(0);
+	std::vector<std::string> raw(rungs);
+	TW::uint256_t nonce = 1234;
+
+	for (auto _ : state) {
+		TW::Data payload;
+		func.encode(payload);
+		for (std::size_t i = 0; i < rungs; ++i) {
+			TW::uint256_t gas_price = 5000000000 + 1000000000 * i;
+			auto transaction = std::make_shared<TW::Ethereum::TransactionNonTyped>(nonce, gas_price, 200000, contract, 0, payload);
+			auto signature = TW::Ethereum::Signer::sign(key, CHAIN_ID, transaction);
+			auto encoded = transaction->encoded(signature, CHAIN_ID);
+			raw[i] = TW::hex(encoded);
+		}
+		benchmark::DoNotOptimize(raw.data());
+		++nonce;
+	}
+	state.SetItemsProcessed(state.iterations() * rungs);
+}
+BENCHMARK(BM_prepare_transaction)->Arg(1)->Arg(5);
+
+// ladders of 4 bots with 5 rungs each, one batch on the given number of sign threads
+static void BM_SignPool_sign(benchmark::State& state)
+{
+	SignPool pool(state.range(0));
+	auto key = pool.add_key(TW::parse_hex(SECRET));
+	TW::Ethereum::ABI::Function func("compound");
+	TW::Data payload;
+	func.encode(payload);
+	auto contract = TW::parse_hex(CONTRACT);
+	TW::uint256_t nonce = 1234;
+
+	for (auto _ : state) {
+		std::vector<SignPool::Spec> specs;
+		for (std::size_t i = 0; i < 20; ++i)
+			specs.push_back(SignPool::Spec{nonce, 5000000000 + 1000000000 * (i % 5), 200000, contract, 0, payload});
+		std::promise<std::size_t> signed_count;
+		pool.sign(key, CHAIN_ID, std::move(specs), [&signed_count](std::vector<std::string>& raws) {
+			signed_count.set_value(raws.size());
+		});
+		benchmark::DoNotOptimize(signed_count.get_future().get());
+		++nonce;
+	}
+	state.SetItemsProcessed(state.iterations() * 20);
+}
+BENCHMARK(BM_SignPool_sign)->Arg(0)->Arg(2)->Arg(4)->UseRealTime();
+
+// a gas price, and a full 64 digit word
+static void BM_hexToUInt256(benchmark::State& state)
+{
+	const std::string s = state.range(0) ? "0x" + std::string(64, 'e') : "0x12a05f200";
+	for (auto _ : state)
+		benchmark::DoNotOptimize(Bot::hexToUInt256(s));
+}
+BENCHMARK(BM_hexToUInt256)->Arg(0)->Arg(1);
+
+static void BM_UInt256ToHex(benchmark::State& state)
+{
+	const TW::uint256_t val = state.range(0) ? ~TW::uint256_t(0) : TW::uint256_t(5000000000);
+	for (auto _ : state)
+		benchmark::DoNotOptimize(Bot::UInt256ToHex(val));
+}
+BENCHMARK(BM_UInt256ToHex)->Arg(0)->Arg(1);
+
+// the codec itself, no std::string
+static void BM_HexCodec_format(benchmark::State& state)
+{
+	const TW::uint256_t val = 5000000000;
+	char buffer[HexCodec::MAX_CHARS];
+	for (auto _ : state)
+		benchmark::DoNotOptimize(HexCodec::format(val, buffer));
+}
+BENCHMARK(BM_HexCodec_format);
+
+// the eth_sendRawTransaction body as built by Bot::eth_sendRawTransaction and fire_request
+static void BM_sendRawTransaction_request(benchmark::State& state)
+{
+	// a signed legacy compound() is about 110 bytes
+	const std::string data(220, 'f');
+	for (auto _ : state) {
+		auto doc = Bot::make_json_rpc("eth_sendRawTransaction");
+		auto arr = nlohmann::json::array();
+		arr.push_back("0x" + data);
+		doc["params"] = arr;
+		benchmark::DoNotOptimize(Bot::pretty_print(doc));
+	}
+}
+BENCHMARK(BM_sendRawTransaction_request);
+
+// Bot::fire over AsioCURL (0) or RawSender (1), see FirePath; fire-path-check
+// runs the same check without Google Benchmark
+static void BM_fire(benchmark::State& state)
+{
+	FirePath path(state.range(0), MOCK_PORT);
+
+	std::size_t fire_allocations = 0;
+	for (auto _ : state)
+		fire_allocations += path.fire(true);
+
+	state.counters["allocs_per_fire"] = benchmark::Counter(fire_allocations, benchmark::Counter::kAvgIterations);
+	if (fire_allocations > 0)
+		state.SkipWithError("Broadcaster::fire allocates");
+}
+BENCHMARK(BM_fire)->Arg(0)->Arg(1)->Unit(benchmark::kMicrosecond);
+
+// a timer_cb record: formatted and written by FastLog's thread
+static void BM_FastLog_write(benchmark::State& state)
+{
+	FastLog::start(1 << 16);
+	FastLog::attach();
+	const std::string hash = "0x" + std::string(64, 'a');
+
+	auto before = allocations;
+	counting = true;
+	for (auto _ : state)
+		FastLog::write(FastLog::Debug, "timer_cb fire offset {} us, {} at {}", (int64_t)42, hash, FastLog::clock::now());
+	counting = false;
+	auto log_allocations = allocations - before;
+	FastLog::stop();
+
+	state.counters["allocs_per_record"] = benchmark::Counter(log_allocations, benchmark::Counter::kAvgIterations);
+	if (log_allocations > 0)
+		state.SkipWithError("FastLog::write allocates");
+}
+BENCHMARK(BM_FastLog_write);
+
+static void BM_parse_json_blocks(benchmark::State& state)
+{
+	for (auto _ : state)
+		benchmark::DoNotOptimize(Bot::parse_json(blocks_payload));
+	state.SetBytesProcessed(state.iterations() * blocks_payload.size());
+}
+BENCHMARK(BM_parse_json_blocks);
+
+// the SAX path used by Bot::process_blocks
+static void BM_scan_blocks(benchmark::State& state)
+{
+	BlockScanner scanner(CONTRACT, COMPOUND_SIG);
+	for (auto _ : state)
+		benchmark::DoNotOptimize(scanner.scan(blocks_payload, blocks_count));
+	state.SetBytesProcessed(state.iterations() * blocks_payload.size());
+}
+BENCHMARK(BM_scan_blocks);
+
+// the caller's share: a copy into the writer queue
+static void BM_store_tx(benchmark::State& state)
+{
+	// not connected: the writer thread never runs and the queue only grows
+	DB db;
+	db.set_writer_options(50, 1000, state.max_iterations, "");
+	auto tr = make_transaction(1);
+	for (auto _ : state)
+		db.store_tx(tr);
+}
+BENCHMARK(BM_store_tx)->Iterations(100000);
+
+// the writer's share: one multi-row statement per batch
+static void BM_insert_query(benchmark::State& state)
+{
+	std::vector<Transaction> batch;
+	for (int i = 0; i < state.range(0); ++i)
+		batch.push_back(make_transaction(i));
+	for (auto _ : state)
+		benchmark::DoNotOptimize(DB::insert_query(batch));
+	state.SetItemsProcessed(state.iterations() * batch.size());
+}
+BENCHMARK(BM_insert_query)->Arg(1)->Arg(50);
+
+// a gathered round of 10 senders on top of the history Bot::init loads
+static void BM_CompetitorStats_add_round(benchmark::State& state)
+{
+	auto make_round = [](int round) {
+		std::vector<Transaction> rows;
+		for (int i = 0; i < 10; ++i) {
+			auto tr = make_transaction(i);
+			tr.timestamp_ = 1650000000 + round;
+			tr.from_ = "0x" + std::string(39, '0') + std::to_string(i);
+			tr.block_number_ = 20000000 + round * 3 + i / 4;
+			tr.gas_price_ = 5000000000 + (uint64_t)i * 100000000;
+			tr.status_ = i == 3;
+			rows.push_back(tr);
+		}
+		return rows;
+	};
+
+	CompetitorStats stats;
+	std::vector<Transaction> history;
+	for (int r = 0; r < 500; ++r) {
+		auto rows = make_round(r);
+		history.insert(history.end(), rows.begin(), rows.end());
+	}
+	stats.load_history(history, WALLET);
+
+	auto round = make_round(500);
+	for (auto _ : state) {
+		stats.add_round(round, WALLET);
+		benchmark::DoNotOptimize(stats.winning_gas_price());
+	}
+}
+BENCHMARK(BM_CompetitorStats_add_round);
+
+int main(int argc, char* argv[])
+{
+	el::Configurations conf;
+	conf.setToDefault();
+	conf.setGlobally(el::ConfigurationType::Enabled, "false");
+	el::Loggers::reconfigureLogger("default", conf);
+
+	benchmark::Initialize(&argc, argv);
+
+	std::string blocks_file;
+	for (int i = 1; i < argc; ++i) {
+		if (std::strncmp(argv[i], "--blocks=", 9) == 0)
+			blocks_file = argv[i] + 9;
+	}
+	if (blocks_file.empty()) {
+		make_blocks_payload(3, 150);
+	}
+	else if (!load_blocks_payload(blocks_file)) {
+		std::cerr << "Cannot open " << blocks_file << std::endl;
+		return 1;
+	}
+
+	benchmark::RunSpecifiedBenchmarks();
+	benchmark::Shutdown();
+	return 0;
+}
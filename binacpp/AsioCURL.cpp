@@ -0,0 +1,288 @@
+#include "AsioCURL.h"
+#include <curl/curl.h>
+#include <easylogging++.h>
+
+const long REQUEST_TIMEOUT_SEC = 30;
+
+AsioCURL::Request::Request(Callback cb)
+: easy_(curl_easy_init())
+, headers_(nullptr)
+, cb_(cb)
+, prepared_(false)
+, in_flight_(false)
+{
+}
+
+AsioCURL::Request::~Request()
+{
+	curl_slist_free_all(headers_);
+	curl_easy_cleanup(easy_);
+}
+
+AsioCURL::Socket::Socket(boost::asio::io_service& io, int fd)
+: desc_(io, fd)
+, action_(CURL_POLL_NONE)
+, reading_(false)
+, writing_(false)
+, released_(false)
+{
+}
+
+AsioCURL::HandlerMemory::HandlerMemory()
+{
+	for (auto& used : used_)
+		used = false;
+}
+
+void* AsioCURL::HandlerMemory::allocate(std::size_t size)
+{
+	if (size <= SLOT_SIZE) {
+		for (std::size_t i = 0; i < SLOTS; ++i) {
+			if (!used_[i].exchange(true))
+				return &slots_[i];
+		}
+	}
+	return ::operator new(size);
+}
+
+void AsioCURL::HandlerMemory::deallocate(void* p)
+{
+	for (std::size_t i = 0; i < SLOTS; ++i) {
+		if (p == &slots_[i]) {
+			used_[i] = false;
+			return;
+		}
+	}
+	::operator delete(p);
+}
+
+AsioCURL::AsioCURL(boost::asio::io_service& io)
+: io_(io)
+, strand_(io)
+, timer_(io)
+, still_running_(0)
+, requests_(0)
+, handles_added_(0)
+{
+	multi_ = curl_multi_init();
+	if (multi_ == NULL) {
+		LOG(ERROR) << "AsioCURL: curl_multi_init returned NULL";
+		throw std::runtime_error("curl_multi_init failed");
+	}
+	curl_multi_setopt(multi_, CURLMOPT_SOCKETFUNCTION, socket_cb);
+	curl_multi_setopt(multi_, CURLMOPT_SOCKETDATA, this);
+	curl_multi_setopt(multi_, CURLMOPT_TIMERFUNCTION, multi_timer_cb);
+	curl_multi_setopt(multi_, CURLMOPT_TIMERDATA, this);
+}
+
+AsioCURL::~AsioCURL()
+{
+	timer_.cancel();
+	for (auto& s : sockets_) {
+		s.second->released_ = true;
+		s.second->desc_.release();  // fd is owned by curl
+	}
+	sockets_.clear();
+	curl_multi_cleanup(multi_);
+}
+
+std::size_t AsioCURL::write_cb(char *content, std::size_t size, std::size_t nmemb, void *buffer)
+{
+	auto tgt = static_cast<std::string*>(buffer);
+	tgt->append(content, size * nmemb);
+	return size * nmemb;
+}
+
+void AsioCURL::setup(Request* req, const std::string& url, const std::vector<std::string>& extra_http_headers, const std::string& post_data, const std::string& action)
+{
+	CURL* eh = req->easy_;
+
+	curl_easy_setopt(eh, CURLOPT_URL, url.c_str());
+	curl_easy_setopt(eh, CURLOPT_PRIVATE, req);
+	curl_easy_setopt(eh, CURLOPT_WRITEFUNCTION, write_cb);
+	curl_easy_setopt(eh, CURLOPT_WRITEDATA, &req->response_.data);
+	curl_easy_setopt(eh, CURLOPT_FAILONERROR, 0);
+	curl_easy_setopt(eh, CURLOPT_SSL_VERIFYPEER, false);
+	curl_easy_setopt(eh, CURLOPT_ENCODING, "gzip");
+	curl_easy_setopt(eh, CURLOPT_FOLLOWLOCATION, 1);
+	curl_easy_setopt(eh, CURLOPT_TCP_NODELAY, 1);
+	curl_easy_setopt(eh, CURLOPT_NOSIGNAL, 1);
+	curl_easy_setopt(eh, CURLOPT_TIMEOUT, REQUEST_TIMEOUT_SEC);
+
+	for (auto& h : extra_http_headers)
+		req->headers_ = curl_slist_append(req->headers_, h.c_str());
+	if (req->headers_)
+		curl_easy_setopt(eh, CURLOPT_HTTPHEADER, req->headers_);
+
+	curl_easy_setopt(eh, CURLOPT_CUSTOMREQUEST, action.c_str());
+	if (post_data.size() > 0) {
+		req->post_data_ = post_data;
+		curl_easy_setopt(eh, CURLOPT_POSTFIELDS, req->post_data_.c_str());
+		curl_easy_setopt(eh, CURLOPT_POSTFIELDSIZE, (long)req->post_data_.size());
+	}
+}
+
+void AsioCURL::request(const std::string& url, const std::vector<std::string>& extra_http_headers, const std::string& post_data, const std::string& action, Callback cb)
+{
+	auto req = new Request(cb);
+	setup(req, url, extra_http_headers, post_data, action);
+
+	++requests_;
+	strand_.dispatch(std::bind(&AsioCURL::start_request, this, req));
+}
+
+std::unique_ptr<AsioCURL::Request> AsioCURL::prepare(const std::string& url, const std::vector<std::string>& extra_http_headers, const std::string& post_data, Callback cb)
+{
+	std::unique_ptr<Request> req(new Request(cb));
+	req->prepared_ = true;
+	setup(req.get(), url, extra_http_headers, post_data, "POST");
+	return req;
+}
+
+bool AsioCURL::send(Request* req)
+{
+	if (req->in_flight_.exchange(true))
+		return false;
+	// a moved-from response left by on_strand, or the fields of the last send
+	req->response_.http_code = 0;
+	req->response_.error.clear();
+	req->response_.data.clear();
+
+	++requests_;
+	// the handler fits asio's recycled handler memory, no allocation once warm
+	strand_.dispatch([this, req]() {
+		start_request(req);
+	});
+	return true;
+}
+
+void AsioCURL::start_request(Request* req)
+{
+	CURLMcode rc = curl_multi_add_handle(multi_, req->easy_);
+	if (rc != CURLM_OK) {
+		--requests_;
+		req->response_.error = curl_multi_strerror(rc);
+		// report asynchronously, the caller may not expect a reentrant callback
+		strand_.post([this, req]() {
+			finish(req);
+		});
+		return;
+	}
+	++handles_added_;
+}
+
+int AsioCURL::socket_cb(CURL* /*easy*/, int fd, int what, void* userp, void* /*socketp*/)
+{
+	auto self = static_cast<AsioCURL*>(userp);
+	auto it = self->sockets_.find(fd);
+
+	if (what == CURL_POLL_REMOVE) {
+		if (it != self->sockets_.end()) {
+			it->second->released_ = true;
+			it->second->desc_.release();  // curl closes the fd itself
+			self->sockets_.erase(it);
+		}
+		return 0;
+	}
+
+	std::shared_ptr<Socket> so;
+	if (it == self->sockets_.end()) {
+		so = std::make_shared<Socket>(self->io_, fd);
+		self->sockets_[fd] = so;
+	}
+	else {
+		so = it->second;
+	}
+	so->action_ = what;
+	self->arm(so, fd);
+	return 0;
+}
+
+int AsioCURL::multi_timer_cb(CURLM* /*multi*/, long timeout_ms, void* userp)
+{
+	auto self = static_cast<AsioCURL*>(userp);
+	self->timer_.cancel();
+	if (timeout_ms >= 0) {
+		// timeout_ms == 0 still goes through the timer: socket_action must not be called from here
+		self->timer_.expires_after(std::chrono::milliseconds(timeout_ms));
+		self->timer_.async_wait(alloc_handler(self->timer_memory_, self->strand_.wrap(std::bind(&AsioCURL::on_timeout, self, std::placeholders::_1))));
+	}
+	return 0;
+}
+
+void AsioCURL::arm(const std::shared_ptr<Socket>& so, int fd)
+{
+	if ((so->action_ & CURL_POLL_IN) && !so->reading_) {
+		so->reading_ = true;
+		so->desc_.async_wait(boost::asio::posix::stream_descriptor::wait_read,
+			strand_.wrap(std::bind(&AsioCURL::on_event, this, so, fd, CURL_CSELECT_IN, std::placeholders::_1)));
+	}
+	if ((so->action_ & CURL_POLL_OUT) && !so->writing_) {
+		so->writing_ = true;
+		so->desc_.async_wait(boost::asio::posix::stream_descriptor::wait_write,
+			strand_.wrap(std::bind(&AsioCURL::on_event, this, so, fd, CURL_CSELECT_OUT, std::placeholders::_1)));
+	}
+}
+
+void AsioCURL::on_event(const std::shared_ptr<Socket>& so, int fd, int ev_bitmask, const boost::system::error_code& ec)
+{
+	if (ev_bitmask == CURL_CSELECT_IN)
+		so->reading_ = false;
+	else
+		so->writing_ = false;
+
+	if (so->released_ || ec == boost::asio::error::operation_aborted)
+		return;
+	if (ec)
+		ev_bitmask = CURL_CSELECT_ERR;
+
+	curl_multi_socket_action(multi_, fd, ev_bitmask, &still_running_);
+	check_multi_info();
+
+	if (!so->released_)
+		arm(so, fd);
+	if (still_running_ <= 0)
+		timer_.cancel();
+}
+
+void AsioCURL::on_timeout(const boost::system::error_code& ec)
+{
+	if (ec)
+		return;
+	curl_multi_socket_action(multi_, CURL_SOCKET_TIMEOUT, 0, &still_running_);
+	check_multi_info();
+}
+
+void AsioCURL::check_multi_info()
+{
+	CURLMsg* msg;
+	int msgs_left = 0;
+	while ((msg = curl_multi_info_read(multi_, &msgs_left))) {
+		if (msg->msg != CURLMSG_DONE)
+			continue;
+
+		CURL* eh = msg->easy_handle;
+		Request* req = nullptr;
+		curl_easy_getinfo(eh, CURLINFO_PRIVATE, &req);
+		curl_easy_getinfo(eh, CURLINFO_RESPONSE_CODE, &req->response_.http_code);
+		get_timings(eh, req->response_);
+		if (msg->data.result != CURLE_OK)
+			req->response_.error = curl_easy_strerror(msg->data.result);
+		else if (req->response_.http_code >= 400)
+			LOG(DEBUG) << "AsioCURL: response code " << req->response_.http_code;
+		curl_multi_remove_handle(multi_, eh);
+		--requests_;
+		finish(req);
+	}
+}
+
+void AsioCURL::finish(Request* req)
+{
+	if (!req->prepared_) {
+		std::unique_ptr<Request> guard(req);
+		req->cb_(req->response_);
+		return;
+	}
+	req->cb_(req->response_);
+	req->in_flight_ = false;
+}
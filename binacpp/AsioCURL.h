@@ -0,0 +1,134 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <functional>
+#include <atomic>
+#include <type_traits>
+#include <boost/asio.hpp>
+
+#include "HttpResponse.h"
+
+typedef void CURL;
+typedef void CURLM;
+struct curl_slist;
+
+// curl_multi driven by the sockets and timer of a boost::asio::io_service:
+// requests never block the threads running io.run(). All curl work is
+// serialized on an internal strand, completion callbacks are invoked there.
+class AsioCURL {
+public:
+	typedef HttpResponse Response;
+	typedef HttpCallback Callback;
+
+	struct Request {
+		Request(Callback cb);
+		~Request();
+		CURL* easy_;
+		curl_slist* headers_;
+		std::string post_data_;
+		Response response_;
+		Callback cb_;
+		bool prepared_;  // owned by the caller and sent again, see prepare()
+		std::atomic<bool> in_flight_;
+	};
+
+	AsioCURL(boost::asio::io_service& io);
+	virtual ~AsioCURL();
+
+	// thread-safe
+	void request(const std::string& url, const std::vector<std::string>& extra_http_headers, const std::string& post_data, const std::string& action, Callback cb);
+
+	// A POST set up once and sent any number of times, one send at a time:
+	// the easy handle, header list and body are built here, send() only hands
+	// the handle to the multi stack and allocates nothing itself.
+	// The caller owns the request and keeps it until it is no longer in flight.
+	std::unique_ptr<Request> prepare(const std::string& url, const std::vector<std::string>& extra_http_headers, const std::string& post_data, Callback cb);
+	// thread-safe; false if the previous send has not completed yet
+	bool send(Request* req);
+
+	std::size_t in_flight() const { return requests_; }
+	// handles given to curl_multi so far; a send() is on its way once this moved
+	std::size_t handles_added() const { return handles_added_; }
+
+private:
+	// Memory for the wait handlers of timer_: curl re-arms the timer on every
+	// curl_multi_add_handle, so without it a prepared send would still allocate.
+	// Falls back to the heap when all slots are taken.
+	class HandlerMemory {
+	public:
+		HandlerMemory();
+		void* allocate(std::size_t size);
+		void deallocate(void* p);
+
+	private:
+		static const std::size_t SLOTS = 4;  // a cancelled wait lives until its completion runs
+		static const std::size_t SLOT_SIZE = 256;
+		typename std::aligned_storage<SLOT_SIZE>::type slots_[SLOTS];
+		std::atomic<bool> used_[SLOTS];
+	};
+
+	template <typename T>
+	struct HandlerAllocator {
+		typedef T value_type;
+		explicit HandlerAllocator(HandlerMemory& memory) : memory_(&memory) {}
+		template <typename U>
+		HandlerAllocator(const HandlerAllocator<U>& other) : memory_(other.memory_) {}
+		T* allocate(std::size_t n) { return static_cast<T*>(memory_->allocate(sizeof(T) * n)); }
+		void deallocate(T* p, std::size_t) { memory_->deallocate(p); }
+		template <typename U>
+		bool operator==(const HandlerAllocator<U>& other) const { return memory_ == other.memory_; }
+		template <typename U>
+		bool operator!=(const HandlerAllocator<U>& other) const { return memory_ != other.memory_; }
+		HandlerMemory* memory_;
+	};
+
+	// a handler whose operation is allocated from memory
+	template <typename Handler>
+	struct AllocHandler {
+		typedef HandlerAllocator<Handler> allocator_type;
+		AllocHandler(HandlerMemory& memory, Handler handler) : memory_(memory), handler_(handler) {}
+		allocator_type get_allocator() const noexcept { return allocator_type(memory_); }
+		template <typename... Args>
+		void operator()(Args&&... args) { handler_(std::forward<Args>(args)...); }
+		HandlerMemory& memory_;
+		Handler handler_;
+	};
+
+	template <typename Handler>
+	static AllocHandler<Handler> alloc_handler(HandlerMemory& memory, Handler handler) { return AllocHandler<Handler>(memory, handler); }
+
+	struct Socket {
+		Socket(boost::asio::io_service& io, int fd);
+		boost::asio::posix::stream_descriptor desc_;
+		int action_;
+		bool reading_;
+		bool writing_;
+		bool released_;
+	};
+
+	void setup(Request* req, const std::string& url, const std::vector<std::string>& extra_http_headers, const std::string& post_data, const std::string& action);
+	void start_request(Request* req);
+	void finish(Request* req);  // on strand_, after the handle left the multi stack
+
+	static std::size_t write_cb(char *content, std::size_t size, std::size_t nmemb, void *buffer);
+	static int socket_cb(CURL* easy, int fd, int what, void* userp, void* socketp);
+	static int multi_timer_cb(CURLM* multi, long timeout_ms, void* userp);
+
+	void arm(const std::shared_ptr<Socket>& so, int fd);
+	void on_event(const std::shared_ptr<Socket>& so, int fd, int ev_bitmask, const boost::system::error_code& ec);
+	void on_timeout(const boost::system::error_code& ec);
+	void check_multi_info();
+
+	boost::asio::io_service& io_;
+	boost::asio::io_service::strand strand_;
+	boost::asio::steady_timer timer_;
+	HandlerMemory timer_memory_;
+	CURLM* multi_ {nullptr};
+	int still_running_;
+	std::atomic<std::size_t> requests_;
+	std::atomic<std::size_t> handles_added_;
+	std::map<int, std::shared_ptr<Socket>> sockets_;
+};
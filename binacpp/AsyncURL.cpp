@@ -1,140 +1,246 @@
-/***************************************************************************
-*
+/***************************************************************************
+*
 *			Copyright (c) 2010-2020  Argo SE, Inc. All rights reserved.
-*
-* The following source code, and the ideas, expressions and concepts
-* incorporated therein, as well as the ideas, expressions and concepts of
-* any other material (whether tangible or intangible) disclosed in
-* conjunction with this source code, are the exclusive and proprietary
-* property, and constitutes confidential information, of Argo SE, Inc.
-* Accordingly, the user of this source code
-* agrees that it shall continue to be bound by the terms and conditions of
-* any and all confidentiality agreements executed with Argo SE, Inc.
-* concerning the disclosure of the source code and any other materials in
-* conjunction therewith.
-*
-*/
+*
+* The following source code, and the ideas, expressions and concepts
+* incorporated therein, as well as the ideas, expressions and concepts of
+* any other material (whether tangible or intangible) disclosed in
+* conjunction with this source code, are the exclusive and proprietary
+* property, and constitutes confidential information, of Argo SE, Inc.
+* Accordingly, the user of this source code
+* agrees that it shall continue to be bound by the terms and conditions of
+* any and all confidentiality agreements executed with Argo SE, Inc.
+* concerning the disclosure of the source code and any other materials in
+* conjunction therewith.
+*
+*/
 
 #include "AsyncURL.h"
 #include <curl/curl.h>
-#include <json/json.h>
-#include <loglib/OpenLog.h>
-using namespace loglib;
-
-bool AsyncURL::inited_ = false;
-
-int run_thread(void* arg)
-{
-	MDP_TRC(enAdmin, enTraceDebug, "%D | %s\n", __FUNCTION__);
-	auto au = (AsyncURL*)arg;
-	auto cm = au->curl_multi();
-
-	CURLMsg *msg;
-	int msgs_left = -1;
-	int still_alive = 1;
-	long return_http_code = 0;
-
-	do {
-		curl_multi_perform(cm, &still_alive);
-
-		while (msg = curl_multi_info_read(cm, &msgs_left)) {
-			if (msg->msg == CURLMSG_DONE) {
-				AsyncURL::Callback* cb;
-				CURL *eh = msg->easy_handle;
-				curl_easy_getinfo(eh, CURLINFO_PRIVATE, &cb);
-				curl_easy_getinfo(eh, CURLINFO_RESPONSE_CODE, &return_http_code);
-				cb->handler_->response_cb(return_http_code, cb->data_);
-				delete cb;
-				curl_multi_remove_handle(cm, eh);
-				curl_easy_cleanup(eh);
-			}
-			else {
-				fprintf(stderr, "E: CURLMsg (%d)\n", msg->msg);
-			}
-		}
-		if (still_alive)
-			curl_multi_wait(cm, NULL, 0, 1000, NULL);
-
-	} while (still_alive);
-
-	MDP_TRC(enAdmin, enTraceDebug, "%D | %s finished\n", __FUNCTION__);
-	return 0;
-}
-
-AsyncURL::Callback::Callback(AsyncURL_Handler* handler)
-: headers_(nullptr)
-, handler_(handler)
+#include <easylogging++.h>
+
+const long REQUEST_TIMEOUT_SEC = 30;
+const int POLL_TIMEOUT_MSEC = 1000;
+
+AsyncURL::Request::Request(boost::asio::io_service& io, const std::string& url, const std::vector<std::string>& extra_http_headers, const std::string& post_data, const std::string& action, Callback cb)
+: url_(url)
+, extra_http_headers_(extra_http_headers)
+, post_data_(post_data)
+, action_(action)
+, cb_(cb)
+, easy_(nullptr)
+, headers_(nullptr)
+, work_(io)
 {
 }
 
-AsyncURL::Callback::~Callback()
+AsyncURL::Request::~Request()
 {
 	curl_slist_free_all(headers_);
 }
 
-
-AsyncURL::AsyncURL()
+AsyncURL::AsyncURL(boost::asio::io_service& io, std::size_t max_in_flight)
+: io_(io)
+, max_in_flight_(max_in_flight > 0 ? max_in_flight : 1)
+, thread_(nullptr)
+, running_(false)
+, in_flight_(0)
 {
 }
 
 AsyncURL::~AsyncURL()
 {
+	stop();
 }
 
 void AsyncURL::stop()
 {
+	if (!thread_)
+		return;
+
+	running_ = false;
+	curl_multi_wakeup(curl_);
+	thread_->join();
+	delete thread_;
+	thread_ = nullptr;
+
+	for (auto eh : idle_handles_)
+		curl_easy_cleanup(eh);
+	idle_handles_.clear();
+
+	{
+		std::lock_guard<std::mutex> g(mutex_);
+		if (!pending_.empty())
+			LOG(DEBUG) << "AsyncURL: " << pending_.size() << " queued requests dropped";
+		for (auto cb : pending_)
+			delete cb;
+		pending_.clear();
+	}
+
 	curl_multi_cleanup(curl_);
-	if (inited_)
-		curl_global_cleanup();
+	curl_ = nullptr;
+	curl_share_cleanup(share_);
+	share_ = nullptr;
 }
 
 void AsyncURL::start()
 {
-	if (!inited_) {
-		curl_global_init(CURL_GLOBAL_DEFAULT);
-		inited_ = true;
-	}
+	if (thread_)
+		return;
+
 	curl_ = curl_multi_init();
-	thread_ = new std::thread(run_thread, this);
+	curl_multi_setopt(curl_, CURLMOPT_MAXCONNECTS, (long)max_in_flight_);
+
+	// the share is only touched from the worker thread, no lock callbacks needed
+	share_ = curl_share_init();
+	curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+	curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+
+	running_ = true;
+	thread_ = new std::thread(&AsyncURL::run, this);
 }
 
 std::size_t AsyncURL::write_cb(char *content, std::size_t size, std::size_t nmemb, void *buffer)
 {
-	//MDP_TRC(enAdmin, enTraceDebug, "%D | %s\n", __FUNCTION__) ;
 	auto tgt = static_cast<std::string*>(buffer);
 
 	tgt->append(content, size * nmemb);
 
-	//MDP_TRC(enAdmin, enTraceDebug, "%D | %s done\n", __FUNCTION__) ;
 	return size * nmemb;
 }
 
-void AsyncURL::request(const std::string& url, AsyncURL_Handler* handler, const std::vector<std::string>& extra_http_headers, const std::string& post_data, const std::string& action)
+void AsyncURL::request(const std::string& url, const std::vector<std::string>& extra_http_headers, const std::string& post_data, const std::string& action, Callback cb)
+{
+	auto req = new Request(io_, url, extra_http_headers, post_data, action, cb);
+	{
+		std::lock_guard<std::mutex> g(mutex_);
+		pending_.push_back(req);
+	}
+	if (curl_)
+		curl_multi_wakeup(curl_);
+}
+
+void AsyncURL::run()
 {
-	//MDP_TRC(enAdmin, enTraceDebug, "%D | %s\n", __FUNCTION__) ;
-	if (curl_) {
-		CURL *eh = curl_easy_init();
-		auto cb = new Callback(handler);
-		curl_easy_setopt(eh, CURLOPT_URL, url);
-		curl_easy_setopt(eh, CURLOPT_PRIVATE, cb);
-		curl_easy_setopt(eh, CURLOPT_WRITEDATA, &cb->data_);
-		curl_easy_setopt(eh, CURLOPT_WRITEFUNCTION, write_cb);
+	LOG(DEBUG) << "AsyncURL thread started";
+
+	while (running_) {
+		dispatch_pending();
+
+		int still_alive = 0;
+		curl_multi_perform(curl_, &still_alive);
+		process_done();
+
+		curl_multi_poll(curl_, NULL, 0, POLL_TIMEOUT_MSEC, NULL);
+	}
+
+	// abandon whatever is still running, callbacks are not invoked
+	for (auto req : active_) {
+		curl_multi_remove_handle(curl_, req->easy_);
+		curl_easy_cleanup(req->easy_);
+		delete req;
+	}
+	active_.clear();
+	in_flight_ = 0;
+
+	LOG(DEBUG) << "AsyncURL thread finished";
+}
+
+CURL* AsyncURL::acquire_handle()
+{
+	if (idle_handles_.empty())
+		return curl_easy_init();
+	CURL* eh = idle_handles_.back();
+	idle_handles_.pop_back();
+	return eh;
+}
+
+void AsyncURL::release_handle(CURL* eh)
+{
+	// reset drops the options but keeps the handle's caches alive
+	curl_easy_reset(eh);
+	if (idle_handles_.size() < max_in_flight_)
+		idle_handles_.push_back(eh);
+	else
+		curl_easy_cleanup(eh);
+}
+
+void AsyncURL::dispatch_pending()
+{
+	while (in_flight_ < max_in_flight_) {
+		Request* req;
+		{
+			std::lock_guard<std::mutex> g(mutex_);
+			if (pending_.empty())
+				return;
+			req = pending_.front();
+			pending_.pop_front();
+		}
+
+		CURL *eh = acquire_handle();
+		req->easy_ = eh;
+		curl_easy_setopt(eh, CURLOPT_URL, req->url_.c_str());
+		curl_easy_setopt(eh, CURLOPT_PRIVATE, req);
+		curl_easy_setopt(eh, CURLOPT_WRITEDATA, &req->response_.data);
+		curl_easy_setopt(eh, CURLOPT_WRITEFUNCTION, write_cb);
 		curl_easy_setopt(eh, CURLOPT_FAILONERROR, 0);
 		curl_easy_setopt(eh, CURLOPT_SSL_VERIFYPEER, false);
 		curl_easy_setopt(eh, CURLOPT_ENCODING, "gzip");
-
-		if (!extra_http_headers.empty()) {
-			for (auto& hdr : extra_http_headers)
-				cb->headers_ = curl_slist_append(cb->headers_, hdr.c_str());
-			curl_easy_setopt(eh, CURLOPT_HTTPHEADER, cb->headers_);
+		curl_easy_setopt(eh, CURLOPT_TCP_NODELAY, 1);
+		curl_easy_setopt(eh, CURLOPT_TCP_KEEPALIVE, 1);
+		curl_easy_setopt(eh, CURLOPT_NOSIGNAL, 1);
+		curl_easy_setopt(eh, CURLOPT_TIMEOUT, REQUEST_TIMEOUT_SEC);
+		curl_easy_setopt(eh, CURLOPT_SHARE, share_);
+
+		if (!req->extra_http_headers_.empty()) {
+			for (auto& hdr : req->extra_http_headers_)
+				req->headers_ = curl_slist_append(req->headers_, hdr.c_str());
+			curl_easy_setopt(eh, CURLOPT_HTTPHEADER, req->headers_);
 		}
 
-		if (!post_data.empty() || action == "POST" || action == "PUT" || action == "DELETE") {
-			if (action == "PUT" || action == "DELETE" || action == "POST")
-				curl_easy_setopt(eh, CURLOPT_CUSTOMREQUEST, action.c_str());
-			curl_easy_setopt(eh, CURLOPT_POSTFIELDS, post_data.c_str());
+		if (!req->post_data_.empty() || req->action_ == "POST" || req->action_ == "PUT" || req->action_ == "DELETE") {
+			if (req->action_ == "PUT" || req->action_ == "DELETE" || req->action_ == "POST")
+				curl_easy_setopt(eh, CURLOPT_CUSTOMREQUEST, req->action_.c_str());
+			curl_easy_setopt(eh, CURLOPT_POSTFIELDS, req->post_data_.c_str());
+			curl_easy_setopt(eh, CURLOPT_POSTFIELDSIZE, (long)req->post_data_.size());
 		}
 
 		curl_multi_add_handle(curl_, eh);
+		active_.insert(req);
+		++in_flight_;
 	}
-}
\ No newline at end of file
+}
+
+void AsyncURL::process_done()
+{
+	CURLMsg *msg;
+	int msgs_left = -1;
+
+	while ((msg = curl_multi_info_read(curl_, &msgs_left))) {
+		if (msg->msg == CURLMSG_DONE) {
+			AsyncURL::Request* req;
+			CURL *eh = msg->easy_handle;
+			curl_easy_getinfo(eh, CURLINFO_PRIVATE, &req);
+			curl_easy_getinfo(eh, CURLINFO_RESPONSE_CODE, &req->response_.http_code);
+			get_timings(eh, req->response_);
+			if (msg->data.result != CURLE_OK)
+				req->response_.error = curl_easy_strerror(msg->data.result);
+			else if (req->response_.http_code >= 400)
+				LOG(DEBUG) << "AsyncURL: response code " << req->response_.http_code;
+
+			curl_multi_remove_handle(curl_, eh);
+			release_handle(eh);
+			active_.erase(req);
+			--in_flight_;
+
+			io_.post([req]() {
+				std::unique_ptr<Request> guard(req);
+				req->cb_(req->response_);
+			});
+		}
+		else {
+			LOG(ERROR) << "AsyncURL: CURLMsg " << msg->msg;
+		}
+	}
+	dispatch_pending();
+}
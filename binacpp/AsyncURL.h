@@ -1,58 +1,95 @@
-/***************************************************************************
-*
+/***************************************************************************
+*
 *			Copyright (c) 2010-2020  Argo SE, Inc. All rights reserved.
-*
-* The following source code, and the ideas, expressions and concepts
-* incorporated therein, as well as the ideas, expressions and concepts of
-* any other material (whether tangible or intangible) disclosed in
-* conjunction with this source code, are the exclusive and proprietary
-* property, and constitutes confidential information, of Argo SE, Inc.
-* Accordingly, the user of this source code
-* agrees that it shall continue to be bound by the terms and conditions of
-* any and all confidentiality agreements executed with Argo SE, Inc.
-* concerning the disclosure of the source code and any other materials in
-* conjunction therewith.
-*
-*/
+*
+* The following source code, and the ideas, expressions and concepts
+* incorporated therein, as well as the ideas, expressions and concepts of
+* any other material (whether tangible or intangible) disclosed in
+* conjunction with this source code, are the exclusive and proprietary
+* property, and constitutes confidential information, of Argo SE, Inc.
+* Accordingly, the user of this source code
+* agrees that it shall continue to be bound by the terms and conditions of
+* any and all confidentiality agreements executed with Argo SE, Inc.
+* concerning the disclosure of the source code and any other materials in
+* conjunction therewith.
+*
+*/
 
 #pragma once
 
 #include <string>
 #include <vector>
+#include <deque>
+#include <set>
+#include <mutex>
+#include <atomic>
 #include <thread>
+#include <boost/asio.hpp>
 
-class AsyncURL_Handler {
-public:
-	virtual void response_cb(int http_code, const std::string& data) = 0;
-};
+#include "HttpResponse.h"
 
+typedef void CURL;
 typedef void CURLM;
+typedef void CURLSH;
 struct curl_slist;
 
+// curl_multi running on its own worker thread.
+// Easy handles are pooled and reused, connections are kept alive and DNS/TLS
+// sessions are shared between requests. At most max_in_flight requests are
+// active at a time, the rest wait in a queue. Completion callbacks are posted
+// to the io_service given to the constructor.
 class AsyncURL {
 public:
-	AsyncURL();
+	typedef HttpResponse Response;
+	typedef HttpCallback Callback;
+
+	AsyncURL(boost::asio::io_service& io, std::size_t max_in_flight = 8);
 	virtual ~AsyncURL();
 
 	void start();
 	void stop();
 
-	void request(const std::string& url, AsyncURL_Handler* handler, const std::vector<std::string>& extra_http_headers, const std::string& post_data, const std::string& action);
+	// thread-safe
+	void request(const std::string& url, const std::vector<std::string>& extra_http_headers, const std::string& post_data, const std::string& action, Callback cb);
 
 	CURLM* curl_multi() { return curl_; }
 
-	struct Callback {
-		Callback(AsyncURL_Handler* handler);
-		~Callback();
-		AsyncURL_Handler* handler_;
-		std::string data_;
+	struct Request {
+		Request(boost::asio::io_service& io, const std::string& url, const std::vector<std::string>& extra_http_headers, const std::string& post_data, const std::string& action, Callback cb);
+		~Request();
+		std::string url_;
+		std::vector<std::string> extra_http_headers_;
+		std::string post_data_;
+		std::string action_;
+		Callback cb_;
+		Response response_;
+		CURL* easy_;
 		curl_slist* headers_;
+		boost::asio::io_service::work work_;  // keeps io.run() alive until the callback is done
 	};
 
 private:
 	static std::size_t write_cb(char *content, std::size_t size, std::size_t nmemb, void *buffer);
 
+	void run();
+	void dispatch_pending();
+	void process_done();
+	CURL* acquire_handle();
+	void release_handle(CURL* eh);
+
+	boost::asio::io_service& io_;
+	const std::size_t max_in_flight_;
+
 	CURLM* curl_ {nullptr};
-	static bool inited_;
+	CURLSH* share_ {nullptr};
 	std::thread* thread_;
+	std::atomic<bool> running_;
+
+	std::mutex mutex_;
+	std::deque<Request*> pending_;  // guarded by mutex_
+
+	// worker thread only
+	std::size_t in_flight_;
+	std::set<Request*> active_;
+	std::vector<CURL*> idle_handles_;
 };
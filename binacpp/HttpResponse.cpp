@@ -0,0 +1,30 @@
+#include "HttpResponse.h"
+#include <curl/curl.h>
+
+void get_timings(CURL* eh, HttpResponse& response)
+{
+	curl_off_t t = 0;
+	if (curl_easy_getinfo(eh, CURLINFO_NAMELOOKUP_TIME_T, &t) == CURLE_OK)
+		response.namelookup_usec = t;
+	if (curl_easy_getinfo(eh, CURLINFO_CONNECT_TIME_T, &t) == CURLE_OK)
+		response.connect_usec = t;
+	if (curl_easy_getinfo(eh, CURLINFO_APPCONNECT_TIME_T, &t) == CURLE_OK)
+		response.appconnect_usec = t;
+	if (curl_easy_getinfo(eh, CURLINFO_PRETRANSFER_TIME_T, &t) == CURLE_OK)
+		response.pretransfer_usec = t;
+	if (curl_easy_getinfo(eh, CURLINFO_STARTTRANSFER_TIME_T, &t) == CURLE_OK)
+		response.starttransfer_usec = t;
+	if (curl_easy_getinfo(eh, CURLINFO_TOTAL_TIME_T, &t) == CURLE_OK)
+		response.total_usec = t;
+	curl_easy_getinfo(eh, CURLINFO_NUM_CONNECTS, &response.new_connects);
+}
+
+HttpCallback on_strand(boost::asio::io_service::strand& strand, HttpCallback cb)
+{
+	return [&strand, cb](HttpResponse& response) {
+		auto moved = std::make_shared<HttpResponse>(std::move(response));
+		strand.dispatch([cb, moved]() {
+			cb(*moved);
+		});
+	};
+}
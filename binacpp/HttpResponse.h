@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+#include <functional>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/io_service_strand.hpp>
+
+struct HttpResponse {
+	long http_code {0};
+	std::string error;  // empty on transport success
+	std::string data;
+
+	// transfer timings from the start of the request, microseconds
+	long long namelookup_usec {0};
+	long long connect_usec {0};
+	long long appconnect_usec {0};  // TLS handshake done, 0 for plain http
+	long long pretransfer_usec {0};  // request about to be sent
+	long long starttransfer_usec {0};  // first response byte
+	long long total_usec {0};
+	long new_connects {0};  // 0 if an existing connection was reused
+};
+
+typedef std::function<void(HttpResponse&)> HttpCallback;
+
+typedef void CURL;
+
+// fills the timing fields from a finished easy handle
+void get_timings(CURL* eh, HttpResponse& response);
+
+// wraps cb so that it runs on the strand; the response is moved there, not copied
+HttpCallback on_strand(boost::asio::io_service::strand& strand, HttpCallback cb);
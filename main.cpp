@@ -1,6 +1,13 @@
 #include "Bot.h"
 #include "DB.h"
 #include "version.h"
+#include "PreciseTimer.h"
+#include "LatencyStats.h"
+#include "ChainCache.h"
+#include "SignPool.h"
+#include "FastLog.h"
+#include "binacpp/AsioCURL.h"
+#include "binacpp/AsyncURL.h"
 
 #include <HexCoding.h>
 #include <Coin.h>
@@ -10,9 +17,12 @@
 
 #include <iostream>
 #include <string>
+#include <map>
+#include <thread>
 #include <boost/asio.hpp>
 
 #include <openssl/crypto.h>
+#include <curl/curl.h>
 
 INITIALIZE_EASYLOGGINGPP
 
@@ -46,11 +56,116 @@ void store_wallet(const std::string& keystore, const std::string& name, const st
 TW::PrivateKey load_wallet(const std::string& keystore, const char* password)
 {
 	TW::Data pass(password, password + strlen(password));
-	OPENSSL_cleanse((void*)password, PASSWORD_LEN);
+	OPENSSL_cleanse((void*)password, strnlen(password, PASSWORD_LEN));
 	auto stored_key = TW::Keystore::StoredKey::load(keystore);
 	return stored_key.privateKey(coin_type, pass);
 }
 
+// A config either describes one bot, or has a "bots" array; in the latter case
+// all other top-level keys are defaults for every bot.
+std::vector<nlohmann::json> bot_configs(const nlohmann::json& cfg)
+{
+	std::vector<nlohmann::json> result;
+	if (!cfg.contains("bots") || !cfg["bots"].is_array()) {
+		result.push_back(cfg);
+		return result;
+	}
+
+	nlohmann::json defaults = cfg;
+	defaults.erase("bots");
+	defaults.erase("pin_cpu");  // of the process, see pin_main
+	for (auto& bot : cfg["bots"]) {
+		if (bot.contains("pin_cpu"))
+			LOG(ERROR) << "pin_cpu of a bot is ignored, the io threads are shared: use the top-level pin_cpu or pin_cpus";
+		nlohmann::json bc = defaults;
+		bc.update(bot);
+		result.push_back(bc);
+	}
+	return result;
+}
+
+// every keystore is decrypted once, however many bots use it
+void unlock_keys(nlohmann::json& cfg, const std::map<std::string, std::string>& keystore_passes, std::map<std::string, std::pair<std::string, std::string>>& unlocked)
+{
+	bool keys_present = cfg["secret"].is_string() && !cfg["secret"].empty() && cfg["wallet"].is_string() && !cfg["wallet"].empty();
+	if (keys_present)
+		return;
+
+	std::string keystore = cfg["keystore"];
+	auto it = unlocked.find(keystore);
+	if (it == unlocked.end()) {
+		std::string keystore_pass;
+		auto pass = keystore_passes.find(keystore);
+		if (pass != keystore_passes.end())
+			keystore_pass = pass->second;
+		if (keystore_pass.empty())
+			keystore_pass = getpass(("Enter password for keystore " + keystore + ": ").c_str());
+		auto privateKey = load_wallet(keystore, keystore_pass.c_str());
+		OPENSSL_cleanse((void*)keystore_pass.data(), keystore_pass.size());
+
+		it = unlocked.emplace(keystore, std::make_pair(TW::hex(privateKey.bytes), TW::deriveAddress(coin_type, privateKey).substr(2))).first;
+	}
+	cfg["secret"] = it->second.first;
+	cfg["wallet"] = it->second.second;
+	//LOG(INFO) << cfg["secret"].asString();
+	//LOG(INFO) << cfg["wallet"].asString();
+}
+
+// passwords are taken out of a config, and of its "extra_wallets", before it is logged
+void take_keystore_pass(nlohmann::json& cfg, std::map<std::string, std::string>& keystore_passes)
+{
+	if (cfg.contains("keystore_pass")) {
+		if (cfg["keystore"].is_string() && cfg["keystore_pass"].is_string() && !std::string(cfg["keystore_pass"]).empty())
+			keystore_passes[cfg["keystore"]] = cfg["keystore_pass"];
+		cfg["keystore_pass"] = "";
+	}
+	if (cfg.contains("extra_wallets") && cfg["extra_wallets"].is_array()) {
+		for (auto& wc : cfg["extra_wallets"])
+			take_keystore_pass(wc, keystore_passes);
+	}
+}
+
+void pin_worker(const nlohmann::json& cfg, int index)
+{
+	if (!cfg.contains("pin_cpus") || !cfg["pin_cpus"].is_array() || index >= (int)cfg["pin_cpus"].size() || !cfg["pin_cpus"][index].is_number())
+		return;
+	int cpu = cfg["pin_cpus"][index];
+	if (PreciseTimer::pin_thread(cpu))
+		LOG(DEBUG) << "io thread #" << index << " pinned to CPU " << cpu;
+	else
+		LOG(ERROR) << "Cannot pin io thread #" << index << " to CPU " << cpu;
+}
+
+// the main io thread: "pin_cpus"[0] with worker threads, "pin_cpu" otherwise
+void pin_main(const nlohmann::json& cfg, int thread_count)
+{
+	if (thread_count > 1 && cfg.contains("pin_cpus")) {
+		pin_worker(cfg, 0);
+		return;
+	}
+	if (!cfg.contains("pin_cpu") || !cfg["pin_cpu"].is_number())
+		return;
+	int cpu = cfg["pin_cpu"];
+	if (PreciseTimer::pin_thread(cpu))
+		LOG(DEBUG) << "io thread pinned to CPU " << cpu;
+	else
+		LOG(ERROR) << "Cannot pin io thread to CPU " << cpu;
+}
+
+// a handler that throws is logged, the thread goes on running the others
+void run_io(int index)
+{
+	while (true) {
+		try {
+			io.run();
+			return;
+		}
+		catch (std::exception& e) {
+			LOG(ERROR) << "io thread #" << index << ": " << e.what();
+		}
+	}
+}
+
 int main(int argc, char* argv[])
 {
 	START_EASYLOGGINGPP(argc, argv);
@@ -59,6 +174,8 @@ int main(int argc, char* argv[])
 	defaultConf.setGlobally(el::ConfigurationType::Format, "%datetime | %msg");
 	el::Loggers::reconfigureLogger("default", defaultConf);
 
+	curl_global_init(CURL_GLOBAL_DEFAULT);
+
 	try {
 		LOG(INFO) << "=======================";
 		LOG(INFO) << "compounding-bot version " << VERSION << " started";
@@ -66,38 +183,104 @@ int main(int argc, char* argv[])
 		if (argc > 1) {
 			nlohmann::json cfg = load_config(argv[1]);
 
-			std::string keystore_pass;
-			if (cfg["keystore_pass"].is_string() && !std::string(cfg["keystore_pass"]).empty())
-				keystore_pass = cfg["keystore_pass"];
-
 			std::string database_pass = cfg["database"]["pass"];
-
 			cfg["database"]["pass"] = "";
-			cfg["keystore_pass"] = "";
 
-			LOG(DEBUG) << "Contents of " << argv[1] << ": " << Bot::pretty_print(cfg, true);
+			auto bot_cfgs = bot_configs(cfg);
+
+			// passwords are taken out of the configs before they are logged
+			std::map<std::string, std::string> keystore_passes;
+			for (auto& bc : bot_cfgs)
+				take_keystore_pass(bc, keystore_passes);
+			std::map<std::string, std::string> ignored;
+			take_keystore_pass(cfg, ignored);
+			if (cfg.contains("bots") && cfg["bots"].is_array()) {
+				for (auto& bc : cfg["bots"])
+					take_keystore_pass(bc, ignored);
+			}
 
-			bool keys_present = cfg["secret"].is_string() && !cfg["secret"].empty() && cfg["wallet"].is_string() && !cfg["wallet"].empty();
-			if (!keys_present) {
-				if (keystore_pass.empty())
-					keystore_pass = getpass("Enter password for keystore: ");
-				auto privateKey = load_wallet(cfg["keystore"], keystore_pass.c_str());
+			LOG(DEBUG) << "Contents of " << argv[1] << ": " << Bot::pretty_print(cfg, true);
 
-				cfg["secret"] = TW::hex(privateKey.bytes);
-				cfg["wallet"] = TW::deriveAddress(coin_type, privateKey).substr(2);
-				//LOG(INFO) << cfg["secret"].asString();
-				//LOG(INFO) << cfg["wallet"].asString();
+			std::map<std::string, std::pair<std::string, std::string>> unlocked;  // keystore -> secret, wallet
+			for (auto& bc : bot_cfgs) {
+				unlock_keys(bc, keystore_passes, unlocked);
+				if (bc["extra_wallets"].is_array()) {
+					for (auto& wc : bc["extra_wallets"])
+						unlock_keys(wc, keystore_passes, unlocked);
+				}
 			}
 
 			DB db;
+			auto& db_cfg = cfg["database"];
+			db.set_writer_options(db_cfg.value("batch_size", 50), db_cfg.value("flush_msec", 1000),
+				db_cfg.value("queue_size", 10000), db_cfg.value("spill_file", std::string("transaction.spill.sql")));
 			db.connect(cfg["database"]["host"], cfg["database"]["user"], database_pass, cfg["database"]["db"]);
 
-			Bot bot(cfg, io, &db);
+			int max_requests = 8;
+			if (cfg["max_requests"].is_number())
+				max_requests = cfg["max_requests"];
 
-			bot.init();
-			bot.start();
+			AsioCURL http(io);
+			AsyncURL async(io, max_requests);
+			async.start();
 
-			io.run();
+			LatencyStats stats;
+
+			std::unique_ptr<ChainCache> cache;
+			if (cfg["cache_file"].is_string())
+				cache.reset(new ChainCache(cfg["cache_file"], cfg.value("cache_blocks", 4096), cfg.value("cache_receipts", 65536)));
+
+			// bots sharing a wallet must share its nonces; filled by Bot::init, before the io threads start
+			NonceManagers nonces;
+
+			std::vector<std::unique_ptr<Bot>> bots;
+
+			// ladders are signed off the io threads; destroyed before the bots its handlers refer to
+			std::unique_ptr<SignPool> signer;
+			if (cfg["sign_threads"].is_number())
+				signer.reset(new SignPool(std::max(0, (int)cfg["sign_threads"])));
+
+			for (auto& bc : bot_cfgs) {
+				bots.emplace_back(new Bot(bc, io, &db, &http, &async, &stats, cache.get(), signer.get(), &nonces));
+				bots.back()->init();  // starts the bot once the nonce is known
+			}
+
+			// fire path records are formatted and written by a thread of their own
+			if (cfg["async_log"].is_boolean() && cfg["async_log"])
+				FastLog::start(cfg.value("async_log_records", 4096));
+
+			int thread_count = 1;
+			if (cfg["threads"].is_number())
+				thread_count = std::max(1, (int)cfg["threads"]);
+
+			std::vector<std::thread> threads;
+			auto join_threads = [&threads]() {
+				io.stop();
+				for (auto& t : threads)
+					t.join();
+			};
+			try {
+				for (int i = 1; i < thread_count; ++i) {
+					threads.emplace_back([&cfg, i]() {
+						pin_worker(cfg, i);
+						FastLog::attach();
+						run_io(i);
+					});
+				}
+				pin_main(cfg, thread_count);  // after the workers are started, they do not inherit it
+				FastLog::attach();
+				run_io(0);
+			}
+			catch (...) {
+				// no thread left joinable while the exception unwinds, the rings are written out
+				join_threads();
+				FastLog::stop();
+				throw;
+			}
+			join_threads();
+			FastLog::stop();
+
+			async.stop();
 		}
 		else {
 			LOG(ERROR) << "Usage: ./compounding-bot <config.json>";
@@ -111,5 +294,6 @@ int main(int argc, char* argv[])
 	catch (std::exception& e) {
 		LOG(ERROR) << "Exception: " << e.what();
 	}
+	curl_global_cleanup();
 	return 0;
 }
@@ -0,0 +1,566 @@
+#include "MockChain.h"
+
+#include <HexCoding.h>
+#include <Hash.h>
+#include <PublicKey.h>
+#include <Ethereum/Address.h>
+
+#include <easylogging++.h>
+#include <algorithm>
+#include <chrono>
+
+const uint64_t GAS_USED_COMPOUND = 150000;
+const uint64_t GAS_USED_REVERT = 30000;
+const uint64_t GAS_USED_TRANSFER = 21000;
+const uint64_t CHAIN_ID = 56;
+
+namespace {
+
+// top level fields of an RLP list, every field a byte string (legacy transactions only)
+std::vector<TW::Data> rlp_fields(const TW::Data& data)
+{
+	auto length = [&data](std::size_t pos, std::size_t bytes) {
+		if (pos + bytes > data.size())
+			throw std::invalid_argument("RLP: truncated");
+		std::size_t len = 0;
+		for (std::size_t i = 0; i < bytes; ++i)
+			len = (len << 8) | data[pos + i];
+		return len;
+	};
+
+	if (data.empty() || data[0] < 0xc0)
+		throw std::invalid_argument("RLP: not a list");
+	std::size_t pos = data[0] <= 0xf7 ? 1 : 1 + (data[0] - 0xf7);
+	std::size_t end = data[0] <= 0xf7 ? pos + (data[0] - 0xc0) : pos + length(1, data[0] - 0xf7);
+	if (end > data.size())
+		throw std::invalid_argument("RLP: truncated");
+
+	std::vector<TW::Data> fields;
+	while (pos < end) {
+		uint8_t b = data[pos];
+		std::size_t start, len;
+		if (b < 0x80) {
+			start = pos;
+			len = 1;
+		}
+		else if (b <= 0xb7) {
+			start = pos + 1;
+			len = b - 0x80;
+		}
+		else if (b <= 0xbf) {
+			start = pos + 1 + (b - 0xb7);
+			len = length(pos + 1, b - 0xb7);
+		}
+		else {
+			throw std::invalid_argument("RLP: nested list");
+		}
+		if (start + len > end)
+			throw std::invalid_argument("RLP: truncated");
+		fields.emplace_back(data.begin() + start, data.begin() + start + len);
+		pos = start + len;
+	}
+	return fields;
+}
+
+uint64_t to_uint(const TW::Data& bytes)
+{
+	uint64_t value = 0;
+	for (auto b : bytes)
+		value = (value << 8) | b;
+	return value;
+}
+
+TW::Data to_bytes(uint64_t value)
+{
+	TW::Data bytes;
+	for (; value; value >>= 8)
+		bytes.insert(bytes.begin(), uint8_t(value & 0xff));
+	return bytes;
+}
+
+// an RLP list of byte strings
+TW::Data rlp_list(const std::vector<TW::Data>& fields)
+{
+	auto prefix = [](TW::Data& out, std::size_t len, uint8_t offset) {
+		if (len <= 55) {
+			out.push_back(uint8_t(offset + len));
+			return;
+		}
+		auto bytes = to_bytes(len);
+		out.push_back(uint8_t(offset + 55 + bytes.size()));
+		out.insert(out.end(), bytes.begin(), bytes.end());
+	};
+
+	TW::Data payload;
+	for (auto& field : fields) {
+		if (field.size() != 1 || field[0] >= 0x80)
+			prefix(payload, field.size(), 0x80);
+		payload.insert(payload.end(), field.begin(), field.end());
+	}
+	TW::Data list;
+	prefix(list, payload.size(), 0xc0);
+	list.insert(list.end(), payload.begin(), payload.end());
+	return list;
+}
+
+// the signer of a legacy transaction, EIP-155 or not; chain_id 0 without EIP-155
+std::string recover_sender(const std::vector<TW::Data>& fields, uint64_t& chain_id)
+{
+	auto v = to_uint(fields[6]);
+	std::vector<TW::Data> signed_fields(fields.begin(), fields.begin() + 6);
+	uint8_t recovery_id;
+	if (v >= 35) {
+		chain_id = (v - 35) / 2;
+		recovery_id = uint8_t((v - 35) % 2);
+		signed_fields.push_back(to_bytes(chain_id));
+		signed_fields.emplace_back();
+		signed_fields.emplace_back();
+	}
+	else if (v == 27 || v == 28) {
+		chain_id = 0;
+		recovery_id = uint8_t(v - 27);
+	}
+	else {
+		throw std::invalid_argument("invalid signature v " + std::to_string(v));
+	}
+
+	auto& r = fields[7];
+	auto& s = fields[8];
+	if (r.size() > 32 || s.size() > 32)
+		throw std::invalid_argument("invalid signature");
+	TW::Data signature(65);
+	std::copy(r.begin(), r.end(), signature.begin() + (32 - r.size()));
+	std::copy(s.begin(), s.end(), signature.begin() + (64 - s.size()));
+	signature[64] = recovery_id;
+
+	auto key = TW::PublicKey::recover(signature, TW::Hash::keccak256(rlp_list(signed_fields)));
+	return TW::Ethereum::Address(key).string();
+}
+
+}
+
+MockChain::MockChain(boost::asio::io_service& io, const nlohmann::json& config)
+: io_(io)
+, block_timer_(io)
+, block_msec_(config.value("block_msec", 3000))
+, interval_sec_(config.value("compound_interval_sec", 60))
+, vault_(address(config.value("vault", std::string())))
+, compound_sig_(keccak_hex("compound()").substr(0, 10))
+, nearest_sig_(keccak_hex("nearestCompoundingTime()").substr(0, 10))
+, random_(config.value("seed", 1))
+, arrivals_(0)
+{
+	if (config.contains("latency_msec") && config["latency_msec"].is_object()) {
+		for (auto& item : config["latency_msec"].items())
+			latency_msec_[item.key()] = item.value();
+	}
+	if (config.contains("error_rate") && config["error_rate"].is_object()) {
+		for (auto& item : config["error_rate"].items())
+			error_rate_[item.key()] = item.value();
+	}
+	if (config.contains("competitors") && config["competitors"].is_array()) {
+		for (auto& c : config["competitors"]) {
+			Competitor competitor;
+			competitor.from_ = address(c.value("from", std::string()));
+			competitor.delay_msec_ = c.value("delay_msec", 0);
+			competitor.gas_price_ = c.value("gas_price", (uint64_t)5000000000);
+			competitors_.push_back(competitor);
+		}
+	}
+
+	auto now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+	nearest_time_ = now + config.value("first_bounty_sec", 30);
+
+	Block genesis;
+	genesis.number_ = config.value("start_block", (uint64_t)1000000);
+	genesis.timestamp_ = now;
+	genesis.hash_ = keccak_hex("block" + std::to_string(genesis.number_));
+	blocks_.push_back(genesis);
+}
+
+void MockChain::start()
+{
+	LOG(INFO) << "MockChain: vault " << vault_ << ", first bounty at " << nearest_time_ << ", " << competitors_.size() << " competitors";
+	schedule_block();
+	schedule_competitors();
+}
+
+void MockChain::schedule_block()
+{
+	// blocks at multiples of block_msec, like the validators' slots
+	auto now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	auto next = (now / block_msec_ + 1) * block_msec_;
+	block_timer_.expires_at(std::chrono::system_clock::time_point(std::chrono::milliseconds(next)));
+	block_timer_.async_wait([this](const boost::system::error_code& e) {
+		if (e)
+			return;
+		produce_block();
+		schedule_block();
+	});
+}
+
+void MockChain::produce_block()
+{
+	Block block;
+	block.number_ = blocks_.back().number_ + 1;
+	block.timestamp_ = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+	block.hash_ = keccak_hex("block" + std::to_string(block.number_));
+
+	// highest gas price first, then arrival; a sender's nonces in order
+	std::vector<Tx*> candidates;
+	for (auto& hash : pool_)
+		candidates.push_back(&txs_[hash]);
+	std::stable_sort(candidates.begin(), candidates.end(), [](const Tx* a, const Tx* b) {
+		return a->gas_price_ > b->gas_price_;
+	});
+
+	bool progress = true;
+	while (progress) {
+		progress = false;
+		for (auto tx : candidates) {
+			if (tx->mined_ || tx->nonce_ != mined_nonces_[tx->from_])
+				continue;
+			tx->mined_ = true;
+			tx->block_ = block.number_;
+			tx->index_ = block.txs_.size();
+			++mined_nonces_[tx->from_];
+			execute(*tx, block);
+			block.txs_.push_back(tx->hash_);
+			progress = true;
+		}
+	}
+
+	pool_.erase(std::remove_if(pool_.begin(), pool_.end(), [this](const std::string& hash) { return txs_[hash].mined_; }), pool_.end());
+	blocks_.push_back(block);
+	if (!block.txs_.empty())
+		LOG(DEBUG) << "MockChain: block #" << block.number_ << " at " << block.timestamp_ << " with " << block.txs_.size() << " transactions";
+
+	if (observer_) {
+		observer_("newHeads", block_json(block, false));
+		for (auto& hash : block.txs_) {
+			auto& tx = txs_[hash];
+			for (int i = 0; i < tx.log_count_; ++i)
+				observer_("logs", log_json(tx, i));
+		}
+	}
+}
+
+void MockChain::execute(Tx& tx, const Block& block)
+{
+	if (tx.to_ != vault_ || tx.input_.compare(0, 10, compound_sig_) != 0) {
+		tx.status_ = 1;
+		tx.gas_used_ = GAS_USED_TRANSFER;
+		return;
+	}
+
+	if (block.timestamp_ < nearest_time_) {
+		tx.status_ = 0;  // too early, or the bounty has just been taken
+		tx.gas_used_ = GAS_USED_REVERT;
+		return;
+	}
+
+	tx.status_ = 1;
+	tx.log_count_ = 1;
+	tx.gas_used_ = GAS_USED_COMPOUND;
+	LOG(INFO) << "MockChain: bounty at " << nearest_time_ << " won by " << tx.from_ << " in block #" << block.number_ << ", index " << tx.index_;
+	nearest_time_ += interval_sec_;
+	while (nearest_time_ <= block.timestamp_)
+		nearest_time_ += interval_sec_;
+	schedule_competitors();
+}
+
+void MockChain::schedule_competitors()
+{
+	auto now = std::chrono::system_clock::now();
+	competitor_timers_.erase(std::remove_if(competitor_timers_.begin(), competitor_timers_.end(), [now](const std::unique_ptr<boost::asio::system_timer>& t) {
+		return t->expiry() <= now;
+	}), competitor_timers_.end());
+	for (std::size_t i = 0; i < competitors_.size(); ++i) {
+		auto at = std::chrono::system_clock::from_time_t(nearest_time_) + std::chrono::milliseconds(competitors_[i].delay_msec_);
+		competitor_timers_.emplace_back(new boost::asio::system_timer(io_, at));
+		competitor_timers_.back()->async_wait([this, i, bounty = nearest_time_](const boost::system::error_code& e) {
+			if (e)
+				return;
+			auto& c = competitors_[i];
+			Tx tx;
+			tx.from_ = c.from_;
+			tx.to_ = vault_;
+			tx.input_ = compound_sig_;
+			tx.nonce_ = std::max(c.nonce_, nonce(c.from_, true));
+			tx.gas_ = 2000000;
+			tx.gas_price_ = c.gas_price_;
+			tx.hash_ = keccak_hex(c.from_ + std::to_string(bounty) + std::to_string(tx.nonce_));
+			c.nonce_ = tx.nonce_ + 1;
+			add_tx(tx);
+		});
+	}
+}
+
+nlohmann::json MockChain::handle(const nlohmann::json& request)
+{
+	nlohmann::json id = request.contains("id") ? request["id"] : nlohmann::json();
+	if (!request.is_object() || !request.contains("method") || !request["method"].is_string())
+		return error(id, "invalid request");
+
+	std::string method = request["method"];
+	nlohmann::json params = request.contains("params") ? request["params"] : nlohmann::json::array();
+
+	auto rate = error_rate_.find(method);
+	if (rate != error_rate_.end() && std::uniform_real_distribution<double>(0, 1)(random_) < rate->second)
+		return error(id, "injected error");
+
+	try {
+		if (method == "eth_blockNumber")
+			return result(id, to_hex(blocks_.back().number_));
+		if (method == "eth_chainId")
+			return result(id, to_hex(CHAIN_ID));
+		if (method == "eth_gasPrice")
+			return result(id, to_hex(5000000000));
+		if (method == "eth_estimateGas")
+			return result(id, to_hex(GAS_USED_COMPOUND));
+		if (method == "eth_getBalance")
+			return result(id, to_hex(1000000000000000000));
+		if (method == "eth_getTransactionCount")
+			return result(id, to_hex(nonce(address(params[0]), params[1] == "pending")));
+		if (method == "eth_call") {
+			std::string to = params[0]["to"];
+			std::string data = params[0]["data"];
+			if (lower(to) == vault_ && data.compare(0, 10, nearest_sig_) == 0)
+				return result(id, "0x" + word(nearest_time_));
+			return result(id, "0x");
+		}
+		if (method == "eth_sendRawTransaction") {
+			auto response = send_raw(params[0]);
+			response["id"] = id;
+			return response;
+		}
+		if (method == "eth_getBlockByNumber") {
+			std::string tag = params[0];
+			uint64_t number = tag == "latest" || tag == "pending" ? blocks_.back().number_ : from_hex(tag);
+			if (number < blocks_.front().number_ || number > blocks_.back().number_)
+				return result(id, nullptr);
+			return result(id, block_json(blocks_[number - blocks_.front().number_], params[1]));
+		}
+		if (method == "eth_getTransactionByHash") {
+			auto it = txs_.find(params[0]);
+			return result(id, it == txs_.end() ? nlohmann::json() : tx_json(it->second));
+		}
+		if (method == "eth_getTransactionReceipt") {
+			auto it = txs_.find(params[0]);
+			return result(id, it == txs_.end() || !it->second.mined_ ? nlohmann::json() : receipt_json(it->second));
+		}
+		if (method == "txpool_content") {
+			// as geth: sender -> nonce -> transaction; nothing is ever queued here
+			nlohmann::json content;
+			content["pending"] = nlohmann::json::object();
+			content["queued"] = nlohmann::json::object();
+			for (auto& t : txs_) {
+				if (!t.second.mined_)
+					content["pending"][t.second.from_][std::to_string(t.second.nonce_)] = tx_json(t.second);
+			}
+			return result(id, content);
+		}
+	}
+	catch (std::exception& e) {
+		return error(id, std::string("invalid params: ") + e.what());
+	}
+
+	auto response = error(id, "the method " + method + " does not exist/is not available");
+	response["error"]["code"] = -32601;
+	return response;
+}
+
+int MockChain::latency_msec(const std::string& method) const
+{
+	auto it = latency_msec_.find(method);
+	if (it == latency_msec_.end())
+		it = latency_msec_.find("default");
+	return it == latency_msec_.end() ? 0 : it->second;
+}
+
+nlohmann::json MockChain::send_raw(const std::string& raw)
+{
+	auto data = TW::parse_hex(raw);
+	auto fields = rlp_fields(data);
+	if (fields.size() != 9)
+		return error(nullptr, "only legacy transactions are supported");
+
+	// as geth: the sender is whoever signed it, a transaction for another chain is rejected
+	Tx tx;
+	uint64_t chain_id = 0;
+	tx.from_ = address(recover_sender(fields, chain_id));
+	if (chain_id != 0 && chain_id != CHAIN_ID)
+		return error(nullptr, "invalid sender");
+	tx.hash_ = "0x" + TW::hex(TW::Hash::keccak256(data));
+	tx.nonce_ = to_uint(fields[0]);
+	tx.gas_price_ = to_uint(fields[1]);
+	tx.gas_ = to_uint(fields[2]);
+	tx.to_ = "0x" + TW::hex(fields[3]);
+	tx.input_ = "0x" + TW::hex(fields[5]);
+	return add_tx(tx);
+}
+
+nlohmann::json MockChain::add_tx(Tx tx)
+{
+	if (txs_.count(tx.hash_))
+		return error(nullptr, "already known");
+	if (tx.nonce_ < mined_nonces_[tx.from_])
+		return error(nullptr, "nonce too low");
+
+	for (auto it = pool_.begin(); it != pool_.end(); ++it) {
+		auto& old = txs_[*it];
+		if (old.from_ != tx.from_ || old.nonce_ != tx.nonce_)
+			continue;
+		if (tx.gas_price_ * 10 < old.gas_price_ * 11)
+			return error(nullptr, "replacement transaction underpriced");
+		LOG(DEBUG) << "MockChain: " << tx.hash_ << " replaces " << old.hash_;
+		txs_.erase(*it);
+		pool_.erase(it);
+		break;
+	}
+
+	tx.arrival_ = ++arrivals_;
+	pool_.push_back(tx.hash_);
+	txs_[tx.hash_] = tx;
+	if (observer_)
+		observer_("newPendingTransactions", tx_json(tx));
+	return result(nullptr, tx.hash_);
+}
+
+uint64_t MockChain::nonce(const std::string& address, bool pending) const
+{
+	auto it = mined_nonces_.find(address);
+	uint64_t count = it == mined_nonces_.end() ? 0 : it->second;
+	if (!pending)
+		return count;
+
+	bool found = true;
+	while (found) {
+		found = false;
+		for (auto& hash : pool_) {
+			auto& tx = txs_.at(hash);
+			if (tx.from_ == address && tx.nonce_ == count) {
+				++count;
+				found = true;
+			}
+		}
+	}
+	return count;
+}
+
+nlohmann::json MockChain::block_json(const Block& block, bool full) const
+{
+	nlohmann::json doc;
+	doc["number"] = to_hex(block.number_);
+	doc["hash"] = block.hash_;
+	doc["timestamp"] = to_hex(block.timestamp_);
+	doc["transactions"] = nlohmann::json::array();
+	for (auto& hash : block.txs_) {
+		if (full)
+			doc["transactions"].push_back(tx_json(txs_.at(hash)));
+		else
+			doc["transactions"].push_back(hash);
+	}
+	return doc;
+}
+
+nlohmann::json MockChain::tx_json(const Tx& tx) const
+{
+	nlohmann::json doc;
+	doc["hash"] = tx.hash_;
+	doc["from"] = tx.from_;
+	doc["to"] = tx.to_;
+	doc["input"] = tx.input_;
+	doc["nonce"] = to_hex(tx.nonce_);
+	doc["gas"] = to_hex(tx.gas_);
+	doc["gasPrice"] = to_hex(tx.gas_price_);
+	doc["value"] = "0x0";
+	doc["blockNumber"] = tx.mined_ ? nlohmann::json(to_hex(tx.block_)) : nlohmann::json();
+	doc["transactionIndex"] = tx.mined_ ? nlohmann::json(to_hex(tx.index_)) : nlohmann::json();
+	return doc;
+}
+
+nlohmann::json MockChain::receipt_json(const Tx& tx) const
+{
+	nlohmann::json doc;
+	doc["transactionHash"] = tx.hash_;
+	doc["blockNumber"] = to_hex(tx.block_);
+	doc["transactionIndex"] = to_hex(tx.index_);
+	doc["from"] = tx.from_;
+	doc["to"] = tx.to_;
+	doc["status"] = to_hex(tx.status_);
+	doc["gasUsed"] = to_hex(tx.gas_used_);
+	doc["logs"] = nlohmann::json::array();
+	for (int i = 0; i < tx.log_count_; ++i)
+		doc["logs"].push_back(log_json(tx, i));
+	return doc;
+}
+
+nlohmann::json MockChain::log_json(const Tx& tx, int index) const
+{
+	nlohmann::json log;
+	log["address"] = tx.to_;
+	log["topics"] = nlohmann::json::array();
+	log["data"] = "0x";
+	log["blockNumber"] = to_hex(tx.block_);
+	log["transactionHash"] = tx.hash_;
+	log["logIndex"] = to_hex(index);
+	log["removed"] = false;
+	return log;
+}
+
+nlohmann::json MockChain::result(const nlohmann::json& id, const nlohmann::json& value)
+{
+	nlohmann::json doc;
+	doc["jsonrpc"] = "2.0";
+	doc["id"] = id;
+	doc["result"] = value;
+	return doc;
+}
+
+nlohmann::json MockChain::error(const nlohmann::json& id, const std::string& message)
+{
+	nlohmann::json doc;
+	doc["jsonrpc"] = "2.0";
+	doc["id"] = id;
+	doc["error"]["code"] = -32000;
+	doc["error"]["message"] = message;
+	return doc;
+}
+
+std::string MockChain::to_hex(uint64_t value)
+{
+	char buf[24];
+	snprintf(buf, sizeof(buf), "0x%llx", (unsigned long long)value);
+	return buf;
+}
+
+uint64_t MockChain::from_hex(const std::string& s)
+{
+	return std::stoull(s, nullptr, 16);
+}
+
+std::string MockChain::word(uint64_t value)
+{
+	char buf[17];
+	snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)value);
+	return std::string(48, '0') + buf;
+}
+
+std::string MockChain::keccak_hex(const std::string& data)
+{
+	return "0x" + TW::hex(TW::Hash::keccak256(TW::Data(data.begin(), data.end())));
+}
+
+std::string MockChain::lower(std::string s)
+{
+	std::transform(s.begin(), s.end(), s.begin(), ::tolower);
+	return s;
+}
+
+std::string MockChain::address(const std::string& s)
+{
+	if (s.compare(0, 2, "0x") == 0)
+		return lower(s);
+	return "0x" + lower(s);
+}
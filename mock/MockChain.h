@@ -0,0 +1,118 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+#include <random>
+#include <cstdint>
+#include <functional>
+#include <nlohmann/json.hpp>
+#include <boost/asio.hpp>
+#include <boost/asio/system_timer.hpp>
+
+// Stand-in for a BSC node serving one vault contract, for offline runs of the bot.
+// Blocks are produced every "block_msec" on the wall clock. The vault pays the
+// bounty to the first compound() mined in a block at or after nearestCompoundingTime,
+// which then moves "compound_interval_sec" ahead; earlier and later compounds
+// revert. Scripted competitors send their compound() at a fixed offset from every
+// bounty time. Raw transactions count for the address recovered from their
+// signature, with a nonce sequence per sender. Per-method latency and error rate
+// are configurable, random decisions come from a seeded generator.
+class MockChain
+{
+public:
+	// "newHeads" with a block header, "logs" with one log, "newPendingTransactions"
+	// with a transaction object, as eth_subscribe notifications carry them
+	typedef std::function<void(const std::string& event, const nlohmann::json& value)> Observer;
+
+	MockChain(boost::asio::io_service& io, const nlohmann::json& config);
+
+	void observe(Observer observer) { observer_ = observer; }
+
+	void start();
+
+	// a single JSON-RPC request, not a batch
+	nlohmann::json handle(const nlohmann::json& request);
+
+	int latency_msec(const std::string& method) const;
+
+private:
+	struct Tx {
+		std::string hash_;
+		std::string from_;
+		std::string to_;
+		std::string input_;
+		uint64_t nonce_ {0};
+		uint64_t gas_ {0};
+		uint64_t gas_price_ {0};
+		uint64_t arrival_ {0};  // order of arrival
+		bool mined_ {false};
+		uint64_t block_ {0};
+		int index_ {0};
+		int status_ {0};
+		int log_count_ {0};
+		uint64_t gas_used_ {0};
+	};
+
+	struct Block {
+		uint64_t number_ {0};
+		uint64_t timestamp_ {0};
+		std::string hash_;
+		std::vector<std::string> txs_;
+	};
+
+	struct Competitor {
+		std::string from_;
+		int delay_msec_ {0};
+		uint64_t gas_price_ {0};
+		uint64_t nonce_ {0};
+	};
+
+	void schedule_block();
+	void produce_block();
+	void schedule_competitors();
+	void execute(Tx& tx, const Block& block);
+
+	nlohmann::json send_raw(const std::string& raw);
+	nlohmann::json add_tx(Tx tx);
+	nlohmann::json block_json(const Block& block, bool full) const;
+	nlohmann::json tx_json(const Tx& tx) const;
+	nlohmann::json receipt_json(const Tx& tx) const;
+	nlohmann::json log_json(const Tx& tx, int index) const;
+
+	uint64_t nonce(const std::string& address, bool pending) const;
+
+	static nlohmann::json result(const nlohmann::json& id, const nlohmann::json& value);
+	static nlohmann::json error(const nlohmann::json& id, const std::string& message);
+	static std::string to_hex(uint64_t value);
+	static uint64_t from_hex(const std::string& s);
+	static std::string word(uint64_t value);  // 32 byte ABI-encoded uint
+	static std::string keccak_hex(const std::string& data);
+	static std::string lower(std::string s);
+	static std::string address(const std::string& s);  // "0x", lower case
+
+	boost::asio::io_service& io_;
+	boost::asio::system_timer block_timer_;
+	std::vector<std::unique_ptr<boost::asio::system_timer>> competitor_timers_;
+	Observer observer_;
+
+	const int block_msec_;
+	const uint64_t interval_sec_;
+	const std::string vault_;  // "0x..." lower case
+	const std::string compound_sig_;
+	const std::string nearest_sig_;
+
+	std::map<std::string, int> latency_msec_;  // "default" and per method
+	std::map<std::string, double> error_rate_;
+	mutable std::mt19937_64 random_;
+
+	std::vector<Competitor> competitors_;
+	uint64_t nearest_time_;
+	uint64_t arrivals_;
+
+	std::vector<Block> blocks_;
+	std::map<std::string, Tx> txs_;  // by hash
+	std::deque<std::string> pool_;  // hashes in arrival order
+	std::map<std::string, uint64_t> mined_nonces_;  // address -> transaction count
+};
@@ -0,0 +1,316 @@
+#include "MockServer.h"
+#include "MockChain.h"
+
+#include <easylogging++.h>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/beast/websocket.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <deque>
+#include <map>
+#include <algorithm>
+
+namespace beast = boost::beast;
+namespace http = boost::beast::http;
+namespace websocket = boost::beast::websocket;
+
+class MockServer::WsSession : public std::enable_shared_from_this<MockServer::WsSession>
+{
+public:
+	WsSession(boost::asio::ip::tcp::socket&& socket, MockServer& server)
+	: ws_(std::move(socket))
+	, server_(server)
+	, writing_(false)
+	{
+	}
+
+	void accept(http::request<http::string_body> request)
+	{
+		ws_.text(true);
+		ws_.async_accept(request, [self = shared_from_this()](const boost::system::error_code& e) {
+			if (!e)
+				self->read();
+		});
+	}
+
+	void publish(const std::string& event, const nlohmann::json& value)
+	{
+		for (auto& s : subscriptions_) {
+			auto& params = s.second;
+			if (params[0] != event)
+				continue;
+			if (event == "logs" && !matches(params, value))
+				continue;
+
+			nlohmann::json doc;
+			doc["jsonrpc"] = "2.0";
+			doc["method"] = "eth_subscription";
+			doc["params"]["subscription"] = s.first;
+			bool full = params.size() > 1 && params[1].is_boolean() && params[1];
+			doc["params"]["result"] = event == "newPendingTransactions" && !full ? value["hash"] : value;
+			send(doc.dump());
+		}
+	}
+
+	void close()
+	{
+		boost::system::error_code ignored;
+		beast::get_lowest_layer(ws_).socket().close(ignored);
+	}
+
+private:
+	void read()
+	{
+		ws_.async_read(buffer_, [self = shared_from_this()](const boost::system::error_code& e, std::size_t) {
+			self->on_read(e);
+		});
+	}
+
+	void on_read(const boost::system::error_code& e)
+	{
+		if (e)
+			return;  // closed
+
+		nlohmann::json response;
+		try {
+			auto request = nlohmann::json::parse(beast::buffers_to_string(buffer_.data()));
+			std::string method = request.value("method", std::string());
+			if (method == "eth_subscribe")
+				response = subscribe(request);
+			else if (method == "eth_unsubscribe")
+				response = unsubscribe(request);
+			else
+				response = server_.chain_.handle(request);
+		}
+		catch (std::exception& ex) {
+			response["jsonrpc"] = "2.0";
+			response["id"] = nullptr;
+			response["error"]["code"] = -32700;
+			response["error"]["message"] = std::string("parse error: ") + ex.what();
+		}
+		buffer_.consume(buffer_.size());
+		send(response.dump());
+		read();
+	}
+
+	nlohmann::json subscribe(const nlohmann::json& request)
+	{
+		nlohmann::json response;
+		response["jsonrpc"] = "2.0";
+		response["id"] = request.contains("id") ? request["id"] : nlohmann::json();
+		auto& params = request["params"];
+		if (!params.is_array() || params.empty() || (params[0] != "newHeads" && params[0] != "logs" && params[0] != "newPendingTransactions")) {
+			response["error"]["code"] = -32602;
+			response["error"]["message"] = "unsupported subscription";
+			return response;
+		}
+		char id[24];
+		snprintf(id, sizeof(id), "0x%x", ++server_.subscription_ids_);
+		subscriptions_[id] = params;
+		response["result"] = id;
+		return response;
+	}
+
+	nlohmann::json unsubscribe(const nlohmann::json& request)
+	{
+		nlohmann::json response;
+		response["jsonrpc"] = "2.0";
+		response["id"] = request.contains("id") ? request["id"] : nlohmann::json();
+		auto& params = request["params"];
+		response["result"] = params.is_array() && !params.empty() && params[0].is_string() && subscriptions_.erase(params[0]) > 0;
+		return response;
+	}
+
+	// address of a "logs" filter, a string or an array
+	static bool matches(const nlohmann::json& params, const nlohmann::json& log)
+	{
+		if (params.size() < 2 || !params[1].is_object() || !params[1].contains("address"))
+			return true;
+		auto address = [](const nlohmann::json& a) {
+			std::string s = a.is_string() ? a.get<std::string>() : std::string();
+			std::transform(s.begin(), s.end(), s.begin(), ::tolower);
+			return s;
+		};
+		auto& filter = params[1]["address"];
+		if (!filter.is_array())
+			return address(filter) == address(log["address"]);
+		for (auto& a : filter) {
+			if (address(a) == address(log["address"]))
+				return true;
+		}
+		return false;
+	}
+
+	void send(const std::string& message)
+	{
+		outbox_.push_back(message);
+		if (!writing_)
+			write_next();
+	}
+
+	void write_next()
+	{
+		if (outbox_.empty()) {
+			writing_ = false;
+			return;
+		}
+		writing_ = true;
+		ws_.async_write(boost::asio::buffer(outbox_.front()), [self = shared_from_this()](const boost::system::error_code& e, std::size_t) {
+			if (e)
+				return;
+			self->outbox_.pop_front();
+			self->write_next();
+		});
+	}
+
+	websocket::stream<beast::tcp_stream> ws_;
+	MockServer& server_;
+	beast::flat_buffer buffer_;
+	std::map<std::string, nlohmann::json> subscriptions_;  // by id
+	std::deque<std::string> outbox_;
+	bool writing_;
+};
+
+class MockServer::Session : public std::enable_shared_from_this<MockServer::Session>
+{
+public:
+	Session(boost::asio::ip::tcp::socket&& socket, MockServer& server)
+	: stream_(std::move(socket))
+	, server_(server)
+	, chain_(server.chain_)
+	, timer_(stream_.get_executor())
+	{
+	}
+
+	void read()
+	{
+		request_ = {};
+		http::async_read(stream_, buffer_, request_, [self = shared_from_this()](const boost::system::error_code& e, std::size_t) {
+			self->on_read(e);
+		});
+	}
+
+private:
+	void on_read(const boost::system::error_code& e)
+	{
+		if (e)
+			return;  // closed by the client
+
+		if (websocket::is_upgrade(request_)) {
+			auto ws = std::make_shared<WsSession>(stream_.release_socket(), server_);
+			server_.ws_sessions_.push_back(ws);
+			ws->accept(std::move(request_));
+			return;
+		}
+
+		nlohmann::json response;
+		int latency = 0;
+		try {
+			auto request = nlohmann::json::parse(request_.body());
+			if (request.is_array()) {
+				response = nlohmann::json::array();
+				for (auto& r : request) {
+					response.push_back(chain_.handle(r));
+					latency = std::max(latency, chain_.latency_msec(r.value("method", std::string())));
+				}
+			}
+			else {
+				response = chain_.handle(request);
+				latency = chain_.latency_msec(request.value("method", std::string()));
+			}
+		}
+		catch (std::exception& ex) {
+			response["jsonrpc"] = "2.0";
+			response["id"] = nullptr;
+			response["error"]["code"] = -32700;
+			response["error"]["message"] = std::string("parse error: ") + ex.what();
+		}
+
+		response_ = {};
+		response_.version(request_.version());
+		response_.result(http::status::ok);
+		response_.set(http::field::content_type, "application/json");
+		response_.keep_alive(request_.keep_alive());
+		response_.body() = response.dump();
+		response_.prepare_payload();
+
+		timer_.expires_after(std::chrono::milliseconds(latency));
+		timer_.async_wait([self = shared_from_this()](const boost::system::error_code&) {
+			self->write();
+		});
+	}
+
+	void write()
+	{
+		http::async_write(stream_, response_, [self = shared_from_this()](const boost::system::error_code& e, std::size_t) {
+			if (e)
+				return;
+			if (!self->response_.keep_alive()) {
+				boost::system::error_code ignored;
+				self->stream_.socket().shutdown(boost::asio::ip::tcp::socket::shutdown_send, ignored);
+				return;
+			}
+			self->read();
+		});
+	}
+
+	beast::tcp_stream stream_;
+	MockServer& server_;
+	MockChain& chain_;
+	boost::asio::steady_timer timer_;
+	beast::flat_buffer buffer_;
+	http::request<http::string_body> request_;
+	http::response<http::string_body> response_;
+};
+
+MockServer::MockServer(boost::asio::io_service& io, MockChain& chain, unsigned short port)
+: io_(io)
+, chain_(chain)
+, acceptor_(io, boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), port))
+, subscription_ids_(0)
+{
+	chain_.observe([this](const std::string& event, const nlohmann::json& value) {
+		publish(event, value);
+	});
+}
+
+void MockServer::start()
+{
+	LOG(INFO) << "MockServer: listening on http://127.0.0.1:" << acceptor_.local_endpoint().port() << "/";
+	accept();
+}
+
+void MockServer::accept()
+{
+	acceptor_.async_accept([this](const boost::system::error_code& e, boost::asio::ip::tcp::socket socket) {
+		if (!e) {
+			socket.set_option(boost::asio::ip::tcp::no_delay(true));
+			std::make_shared<Session>(std::move(socket), *this)->read();
+		}
+		else {
+			LOG(ERROR) << "MockServer: accept: " << e.message();
+		}
+		accept();
+	});
+}
+
+void MockServer::publish(const std::string& event, const nlohmann::json& value)
+{
+	ws_sessions_.erase(std::remove_if(ws_sessions_.begin(), ws_sessions_.end(), [](const std::weak_ptr<WsSession>& ws) {
+		return ws.expired();
+	}), ws_sessions_.end());
+	for (auto& weak : ws_sessions_) {
+		if (auto ws = weak.lock())
+			ws->publish(event, value);
+	}
+}
+
+void MockServer::drop_ws()
+{
+	LOG(INFO) << "MockServer: dropping " << ws_sessions_.size() << " websockets";
+	for (auto& weak : ws_sessions_) {
+		if (auto ws = weak.lock())
+			ws->close();
+	}
+	ws_sessions_.clear();
+}
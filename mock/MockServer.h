@@ -0,0 +1,39 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <string>
+#include <nlohmann/json.hpp>
+#include <boost/asio.hpp>
+
+class MockChain;
+
+// Plain HTTP/1.1 JSON-RPC endpoint with keep-alive, single and batch requests.
+// A response is held back by the configured latency of its method (the slowest
+// one for a batch). The same port upgrades to a websocket serving eth_subscribe
+// for "newHeads", "logs" (filtered by address) and "newPendingTransactions"
+// (hashes, or full transactions with true), and plain requests without latency.
+// Runs on one io_service thread together with the chain.
+class MockServer
+{
+public:
+	MockServer(boost::asio::io_service& io, MockChain& chain, unsigned short port);
+
+	void start();
+
+	// closes every websocket, as a restarting node does; subscriptions are gone
+	void drop_ws();
+
+private:
+	class Session;
+	class WsSession;
+
+	void accept();
+	void publish(const std::string& event, const nlohmann::json& value);
+
+	boost::asio::io_service& io_;
+	MockChain& chain_;
+	boost::asio::ip::tcp::acceptor acceptor_;
+	std::vector<std::weak_ptr<WsSession>> ws_sessions_;
+	unsigned subscription_ids_;
+};
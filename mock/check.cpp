@@ -0,0 +1,232 @@
+// Scripted run of the mock node, registered with ctest: raw transactions count
+// for the wallet that signed them, nonces are kept per sender, a second shot at a
+// nonce already taken is refused as it would be by a BSC node, NonceManager
+// moves the other holders of a wallet to the next nonce, and one holder's shots
+// in a row all go out. Over a websocket to the mock server, WsClient gets the
+// newHeads, logs and newPendingTransactions the bot subscribes to, subscribes
+// again after the node drops the connection, and is freed once stopped.
+
+#include "MockChain.h"
+#include "MockServer.h"
+#include "NonceManager.h"
+#include "WsClient.h"
+#include "MempoolWatcher.h"
+
+#include <HexCoding.h>
+#include <Hash.h>
+#include <PrivateKey.h>
+#include <PublicKey.h>
+#include <Ethereum/Address.h>
+#include <Ethereum/Transaction.h>
+#include <Ethereum/Signer.h>
+
+#include <easylogging++.h>
+#include <iostream>
+#include <algorithm>
+
+INITIALIZE_EASYLOGGINGPP
+
+namespace {
+
+// throwaway keys, nothing leaves the process
+const char SECRET_A[] = "4646464646464646464646464646464646464646464646464646464646464646";
+const char SECRET_B[] = "0101010101010101010101010101010101010101010101010101010101010101";
+const uint64_t CHAIN_ID = 56;
+const uint64_t GAS_PRICE = 5000000000;
+const char VAULT[] = "0x1111111111111111111111111111111111111111";
+const char COMPETITOR[] = "0x2222222222222222222222222222222222222222";
+const unsigned short WS_PORT = 18547;
+
+int failures = 0;
+
+void check(bool ok, const std::string& what)
+{
+	std::cout << (ok ? "ok   " : "FAIL ") << what << std::endl;
+	if (!ok)
+		++failures;
+}
+
+struct Wallet
+{
+	Wallet(const char* secret)
+	: key_(TW::parse_hex(secret))
+	{
+		address_ = TW::Ethereum::Address(key_.getPublicKey(TWPublicKeyTypeSECP256k1Extended)).string();
+		std::transform(address_.begin(), address_.end(), address_.begin(), ::tolower);
+	}
+
+	// a transfer to ourselves, signed as Bot::replace_stuck does
+	std::string raw(uint64_t nonce, uint64_t gas_price, uint64_t chain_id = CHAIN_ID) const
+	{
+		auto to = TW::parse_hex(address_);
+		auto transaction = std::make_shared<TW::Ethereum::TransactionNonTyped>(nonce, gas_price, 21000, to, 0, TW::Data());
+		auto signature = TW::Ethereum::Signer::sign(key_, chain_id, transaction);
+		return "0x" + TW::hex(transaction->encoded(signature, chain_id));
+	}
+
+	TW::PrivateKey key_;
+	std::string address_;  // "0x", lower case
+};
+
+nlohmann::json call(MockChain& chain, const std::string& method, const nlohmann::json& params)
+{
+	nlohmann::json request = {{"jsonrpc", "2.0"}, {"id", 1}, {"method", method}, {"params", params}};
+	return chain.handle(request);
+}
+
+nlohmann::json send(MockChain& chain, const std::string& raw)
+{
+	return call(chain, "eth_sendRawTransaction", {raw});
+}
+
+std::string error_of(const nlohmann::json& response)
+{
+	return response.contains("error") ? response["error"].value("message", std::string()) : std::string();
+}
+
+uint64_t count(MockChain& chain, const Wallet& w, const std::string& tag)
+{
+	auto response = call(chain, "eth_getTransactionCount", {w.address_, tag});
+	return response["result"].is_string() ? std::stoull(response["result"].get<std::string>(), nullptr, 16) : ~0ull;
+}
+
+// runs io until done() or the timeout
+bool run_until(boost::asio::io_service& io, std::function<bool()> done, std::chrono::milliseconds timeout)
+{
+	auto deadline = std::chrono::steady_clock::now() + timeout;
+	while (!done() && std::chrono::steady_clock::now() < deadline)
+		io.run_for(std::chrono::milliseconds(10));
+	return done();
+}
+
+// the subscriptions Bot makes with ws_url and mempool_ws, against MockServer
+void check_ws()
+{
+	boost::asio::io_service io;
+	boost::asio::io_service::work work(io);
+	boost::asio::io_service::strand strand(io);
+	nlohmann::json config = {{"block_msec", 100}, {"vault", VAULT}, {"first_bounty_sec", 0},
+		{"competitors", {{{"from", COMPETITOR}, {"delay_msec", 0}}}}};
+	MockChain chain(io, config);
+	MockServer server(io, chain, WS_PORT);
+	server.start();
+
+	int heads = 0, logs = 0;
+	std::size_t competitors = 0;
+	std::string compound = "compound()";
+	std::string sig = "0x" + TW::hex(TW::Hash::keccak256(TW::Data(compound.begin(), compound.end()))).substr(0, 8);
+	MempoolWatcher mempool(VAULT, sig, {}, [&competitors](const MempoolWatcher::Seen& seen) {
+		if (seen.from_ == COMPETITOR)
+			++competitors;
+	});
+	auto ws = std::make_shared<WsClient>(strand, "ws://127.0.0.1:" + std::to_string(WS_PORT) + "/");
+	ws->subscribe(nlohmann::json::array({"newHeads"}), [&heads](nlohmann::json& head) {
+		if (head["number"].is_string())
+			++heads;
+	});
+	ws->subscribe(nlohmann::json::array({"logs", {{"address", VAULT}}}), [&logs](nlohmann::json& log) {
+		if (log["address"] == VAULT)
+			++logs;
+	});
+	ws->subscribe(nlohmann::json::array({"newPendingTransactions", true}), [&mempool](nlohmann::json& tx) {
+		if (tx.is_object())
+			mempool.add(tx);
+	});
+	ws->start();
+	check(run_until(io, [&ws]() { return ws->ready(); }, std::chrono::seconds(2)), "ws: subscriptions confirmed");
+
+	// the competitor's compound() is due at once, it is mined by the next block
+	chain.start();
+	check(run_until(io, [&competitors]() { return competitors > 0; }, std::chrono::seconds(2)), "ws: competitor seen in newPendingTransactions");
+	check(run_until(io, [&logs]() { return logs > 0; }, std::chrono::seconds(2)), "ws: vault log");
+	check(run_until(io, [&heads]() { return heads > 1; }, std::chrono::seconds(2)), "ws: new heads");
+
+	// a restarting node: the client reconnects after its backoff and subscribes again
+	server.drop_ws();
+	check(run_until(io, [&ws]() { return !ws->ready(); }, std::chrono::seconds(1)), "ws: drop noticed");
+	check(run_until(io, [&ws]() { return ws->ready(); }, std::chrono::seconds(5)), "ws: resubscribed after reconnect");
+	int heads_before = heads;
+	check(run_until(io, [&]() { return heads > heads_before; }, std::chrono::seconds(2)), "ws: new heads after reconnect");
+
+	// stopped, the client lives only as long as its pending handlers
+	std::weak_ptr<WsClient> weak = ws;
+	strand.post([ws]() { ws->stop(); });
+	ws.reset();
+	check(run_until(io, [&weak]() { return weak.expired(); }, std::chrono::seconds(1)), "ws: client freed after stop");
+	heads_before = heads;
+	io.run_for(std::chrono::milliseconds(300));
+	check(heads == heads_before, "ws: no handler called after stop");
+}
+
+}
+
+int main()
+{
+	el::Configurations conf;
+	conf.setToDefault();
+	conf.setGlobally(el::ConfigurationType::Enabled, "false");
+	el::Loggers::reconfigureLogger("default", conf);
+
+	boost::asio::io_service io;
+	MockChain chain(io, {{"block_msec", 50}});
+	Wallet a(SECRET_A), b(SECRET_B);
+
+	// senders
+	auto sent = send(chain, a.raw(0, GAS_PRICE));
+	check(sent["result"].is_string(), "nonce 0 of A accepted " + error_of(sent));
+	auto tx = call(chain, "eth_getTransactionByHash", {sent["result"]});
+	check(tx["result"].is_object() && tx["result"]["from"] == a.address_, "sender recovered from the signature");
+	check(send(chain, b.raw(0, GAS_PRICE))["result"].is_string(), "nonce 0 of B accepted, nonces are per sender");
+	check(count(chain, a, "pending") == 1 && count(chain, b, "pending") == 1 && count(chain, a, "latest") == 0, "pending counts per sender");
+	check(error_of(send(chain, a.raw(1, GAS_PRICE, 97))) == "invalid sender", "other chain refused");
+
+	// two bots on wallet A, one NonceManager
+	NonceManager nonces;
+	bool moved = false;
+	auto first = nonces.add_holder(nullptr);
+	auto second = nonces.add_holder([&moved]() {
+		moved = true;
+	});
+	nonces.init(count(chain, a, "pending"));
+	auto nonce = nonces.next(first);
+	auto other = nonces.next(second);
+	check(nonce == 1 && other == 1, "both holders reserve the pending count");
+
+	sent = send(chain, a.raw((uint64_t)nonce, GAS_PRICE));
+	check(sent["result"].is_string(), "first holder's shot accepted " + error_of(sent));
+	check(error_of(send(chain, a.raw((uint64_t)other, GAS_PRICE + 1))) == "replacement transaction underpriced",
+		"second shot at the same nonce refused by the node");
+	nonces.sent(first, nonce, sent["result"], GAS_PRICE);
+	TW::uint256_t reserved;
+	check(moved && !nonces.reserved(second, reserved), "second holder told to sign again");
+	other = nonces.next(second);
+	sent = send(chain, a.raw((uint64_t)other, GAS_PRICE));
+	check(other == 2 && sent["result"].is_string(), "second holder's shot at the next nonce accepted " + error_of(sent));
+	nonces.sent(second, other, sent["result"], GAS_PRICE);
+
+	// one holder shooting twice in a row, as approve10x1min does: both go out
+	moved = false;
+	nonce = nonces.next(first);
+	sent = send(chain, a.raw((uint64_t)nonce, GAS_PRICE));
+	nonces.sent(first, nonce, sent["result"], GAS_PRICE);
+	check(nonces.reserved(first, reserved) && reserved == nonce + 1, "sender's reservation moved to the next nonce");
+	check(moved && !nonces.reserved(second, reserved), "other holder told to sign again");
+	auto again = nonces.next(first);
+	auto sent_again = send(chain, a.raw((uint64_t)again, GAS_PRICE));
+	check(nonce == 3 && again == 4 && sent["result"].is_string() && sent_again["result"].is_string(),
+		"two shots in a row from one holder accepted " + error_of(sent) + error_of(sent_again));
+	nonces.sent(first, again, sent_again["result"], GAS_PRICE);
+
+	// mined in nonce order
+	chain.start();
+	io.run_for(std::chrono::milliseconds(300));
+	check(count(chain, a, "latest") == 5 && count(chain, b, "latest") == 1, "mined per sender");
+	check(error_of(send(chain, a.raw(0, GAS_PRICE * 2))) == "nonce too low", "mined nonce refused");
+	nonces.resync(count(chain, a, "latest"), count(chain, a, "pending"));
+	check(nonces.in_flight() == 0 && nonces.next(first) == 5, "NonceManager resynced");
+
+	check_ws();
+
+	std::cout << (failures ? "FAILED" : "passed") << std::endl;
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,46 @@
+#include "MockChain.h"
+#include "MockServer.h"
+
+#include <easylogging++.h>
+
+#include <fstream>
+#include <sstream>
+
+INITIALIZE_EASYLOGGINGPP
+
+int main(int argc, char* argv[])
+{
+	START_EASYLOGGINGPP(argc, argv);
+	el::Configurations defaultConf;
+	defaultConf.setToDefault();
+	defaultConf.setGlobally(el::ConfigurationType::Format, "%datetime | %msg");
+	el::Loggers::reconfigureLogger("default", defaultConf);
+
+	if (argc < 2) {
+		LOG(ERROR) << "Usage: ./mock-node <mock_node.json>";
+		return 1;
+	}
+
+	try {
+		std::ifstream in(argv[1]);
+		if (!in) {
+			LOG(ERROR) << "Cannot open config file: " << argv[1];
+			return 1;
+		}
+		std::stringstream buffer;
+		buffer << in.rdbuf();
+		auto cfg = nlohmann::json::parse(buffer.str());
+
+		boost::asio::io_service io;
+		MockChain chain(io, cfg);
+		MockServer server(io, chain, cfg.value("port", 8545));
+		chain.start();
+		server.start();
+		io.run();
+	}
+	catch (std::exception& e) {
+		LOG(ERROR) << "Exception: " << e.what();
+		return 1;
+	}
+	return 0;
+}